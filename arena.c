@@ -0,0 +1,306 @@
+/*
+    Zerp: a Z-machine interpreter
+    arena.c : one allocation per running game
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "story.h"
+#include "arena.h"
+#include "undo.h"
+#include "hash.h"
+#include "dedup.h"
+#include "variables.h"
+
+#define align(n, to) (((n) + (to) - 1) & ~((size_t) (to) - 1))
+
+zarena_t *zArena = NULL;
+
+/* the current arena's stamps; writes with no arena in use land in zNoStamps */
+static unsigned int zNoStamps[ZPAGES];
+unsigned int *zPageStamp = zNoStamps;
+unsigned int zDirtyStamp = 1;
+static unsigned long long zNoHash;
+unsigned long long *zMemoryHash = &zNoHash;
+
+/* epochs are handed out in one sequence, so no two arenas share one */
+static unsigned int zArenaEpoch = 0;
+
+static zarena_t *zArenaPool = NULL;
+static int zArenaPoolSize = 0;
+
+static size_t zPageSize = 0;
+
+static int arena_map_image(zarena_t *arena);
+static void arena_clean(zarena_t *arena);
+static void guard_install();
+static void guard_fault(int sig, siginfo_t *info, void *context);
+
+/* A new arena holding a fresh copy of the story, with data_size bytes (zeroed) for the caller. */
+zarena_t *arena_create(size_t data_size) {
+    zarena_t *arena;
+    unsigned char *base;
+    size_t page, image_size, stack_at, call_stack_at, stamp_at, arena_at, data_at, size;
+    int mapped;
+
+    /* a pooled arena is already reset; only its data needs clearing */
+    if (zArenaPool && zArenaPool->data_size >= data_size) {
+        arena = zArenaPool;
+        zArenaPool = arena->next;
+        zArenaPoolSize--;
+        arena->next = NULL;
+        memset(arena->data, 0, arena->data_size);
+        return arena;
+    }
+
+    guard_install();
+    page = zPageSize;
+    image_size = align(zFilesize, page);
+    stack_at = image_size;
+    call_stack_at = stack_at + align(STACKSIZE * sizeof(zword_t), page) + page;
+    stamp_at = call_stack_at + align(CALLSTACKSIZE * sizeof(zstack_frame_t), page) + page;
+    arena_at = align(stamp_at + ZPAGES * sizeof(unsigned int), ARENA_ALIGN);
+    data_at = align(arena_at + sizeof(zarena_t), ARENA_ALIGN);
+    size = align(data_at + data_size, page);
+
+    /* most of it is stack no game reaches, so don't have it counted against commit */
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (mprotect(base + call_stack_at - page, page, PROT_NONE) || mprotect(base + stamp_at - page, page, PROT_NONE)) {
+        munmap(base, size);
+        return NULL;
+    }
+    mapped = zStoryFd >= 0;
+
+    arena = (zarena_t *) (base + arena_at);
+    arena->base = base;
+    arena->size = size;
+    arena->image_size = image_size;
+    arena->machine = base;
+    arena->stack = (zword_t *) (base + stack_at);
+    arena->call_stack = (zstack_frame_t *) (base + call_stack_at);
+    arena->page_stamp = (unsigned int *) (base + stamp_at);
+    arena->stamp = 1;
+    arena->epoch = ++zArenaEpoch;
+    arena->hash = story_memory_hash();
+    memset(arena->shared, 0, sizeof(arena->shared));
+    arena->shared_stamp = 0;
+    arena->undo = NULL;
+    arena->data = base + data_at;
+    arena->data_size = size - data_at;
+    arena->mapped = mapped;
+    arena->next = NULL;
+
+    if (!arena_map_image(arena)) {
+        munmap(base, size);
+        return NULL;
+    }
+    return arena;
+}
+
+/*
+    A new arena whose memory matches arena's. Like any new arena it starts
+    out sharing the story's pages, so only the pages arena has written are
+    copied, a run of them at a time; stacks and data are the caller's.
+*/
+zarena_t *arena_clone(zarena_t *arena, size_t data_size) {
+    zarena_t *clone;
+    int page, end;
+
+    clone = arena_create(data_size);
+    if (!clone)
+        return NULL;
+    for (page = 0; page < ZPAGES && (page << ZPAGE_SHIFT) < arena->image_size; page = end) {
+        if (!arena->page_stamp[page]) {
+            end = page + 1;
+            continue;
+        }
+        for (end = page; end < ZPAGES && (end << ZPAGE_SHIFT) < arena->image_size && arena->page_stamp[end]; end++)
+            clone->page_stamp[end] = clone->stamp;
+        memcpy(clone->machine + (page << ZPAGE_SHIFT), arena->machine + (page << ZPAGE_SHIFT),
+               (end - page) << ZPAGE_SHIFT);
+    }
+    clone->hash = arena->hash;
+    return clone;
+}
+
+/* Give the arena back. It goes to the pool if there's room, otherwise in one unmap. */
+void arena_destroy(zarena_t *arena) {
+    if (!arena)
+        return;
+    if (arena == zArena)
+        arena_use(NULL);
+    dedup_release(arena);
+    undo_free(arena->undo);
+    arena->undo = NULL;
+
+    if (zArenaPoolSize < ARENA_POOL && arena_reset(arena)) {
+        /* a deep game's stacks needn't stay committed while pooled */
+        madvise(arena->stack, (unsigned char *) arena->page_stamp - (unsigned char *) arena->stack, MADV_DONTNEED);
+        arena->next = zArenaPool;
+        zArenaPool = arena;
+        zArenaPoolSize++;
+        return;
+    }
+
+    munmap(arena->base, arena->size);
+}
+
+/* Put the pristine story back. Stacks and data are left alone; zerp_start() resets the stack pointers. */
+int arena_reset(zarena_t *arena) {
+    if (!arena->mapped) {
+        arena_restore(arena);
+        return TRUE;
+    }
+    if (!arena_map_image(arena))
+        return FALSE;
+    arena_clean(arena);
+    return TRUE;
+}
+
+/* Put the pristine story back by copying only the pages written since the game started */
+void arena_restore(zarena_t *arena) {
+    int page, len;
+
+    for (page = 0; page < ZPAGES; page++) {
+        if (!arena->page_stamp[page])
+            continue;
+        len = zFilesize - (page << ZPAGE_SHIFT);
+        if (len > ZPAGE_SIZE)
+            len = ZPAGE_SIZE;
+        if (len > 0)
+            memcpy(arena->machine + (page << ZPAGE_SHIFT), zGamefile + (page << ZPAGE_SHIFT), len);
+    }
+    arena_clean(arena);
+    if (arena == zArena)
+        globals_load();
+}
+
+/*
+    Start a new period of writes in the current arena. Returns a stamp to
+    hand to arena_dirty_pages() later: pages stamped after it have changed
+    since this call.
+*/
+unsigned int arena_checkpoint() {
+    if (!zArena)
+        return 0;
+    zArena->stamp = ++zDirtyStamp;
+    return zDirtyStamp - 1;
+}
+
+/*
+    Set a bit (page n is bit n % 8 of byte n / 8) in bitmap, which must hold
+    ZPAGES bits, for each page of the current arena written since the
+    checkpoint since; 0 means since the game started. Returns the number of
+    pages.
+*/
+int arena_dirty_pages(unsigned int since, unsigned char *bitmap) {
+    int page, count;
+
+    memset(bitmap, 0, ZPAGES / 8);
+    for (page = count = 0; page < ZPAGES; page++) {
+        if (zPageStamp[page] > since) {
+            bitmap[page >> 3] |= 1 << (page & 7);
+            count++;
+        }
+    }
+    return count;
+}
+
+/* first write to page since the last checkpoint */
+void page_touched(int page) {
+    if (zArena && zArena->undo)
+        undo_touch(page);
+    zPageStamp[page] = zDirtyStamp;
+}
+
+/* Point the interpreter at an arena's machine and stacks (NULL: at nothing) */
+void arena_use(zarena_t *arena) {
+    zArena = arena;
+    if (!arena) {
+        zPageStamp = zNoStamps;
+        zDirtyStamp = 1;
+        zMemoryHash = &zNoHash;
+        zMachine = 0;
+        zStack = zStackTop = 0;
+        zCallStack = zCallStackTop = 0;
+        return;
+    }
+    zMachine = arena->machine;
+    zStack = arena->stack;
+    zStackTop = zStack + STACKSIZE;
+    zCallStack = arena->call_stack;
+    zCallStackTop = zCallStack + CALLSTACKSIZE;
+    zPageStamp = arena->page_stamp;
+    zDirtyStamp = arena->stamp;
+    zMemoryHash = &arena->hash;
+    globals_load();
+}
+
+/*
+    (Re)load the image. Mapping the shared story over the old image throws
+    away whatever the game wrote in one call; without a shared story we
+    copy.
+*/
+static int arena_map_image(zarena_t *arena) {
+    if (arena->mapped) {
+        return mmap(arena->base, arena->image_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, zStoryFd, 0) != MAP_FAILED;
+    }
+    memcpy(arena->base, zGamefile, zFilesize);
+    return TRUE;
+}
+
+/* every page matches the story again, and there is nothing to undo */
+static void arena_clean(zarena_t *arena) {
+    dedup_release(arena);
+    undo_clear(arena->undo);
+    memset(arena->page_stamp, 0, ZPAGES * sizeof(unsigned int));
+    arena->stamp = 1;
+    arena->epoch = ++zArenaEpoch;
+    arena->hash = story_memory_hash();
+    if (arena == zArena)
+        zDirtyStamp = 1;
+}
+
+/* Catch writes to the stacks' guard pages; the first arena made installs it. */
+static void guard_install() {
+    struct sigaction sa;
+
+    if (zPageSize)
+        return;
+    zPageSize = sysconf(_SC_PAGESIZE);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = guard_fault;
+    /* fatal_error() longjmp()s out, so SIGSEGV mustn't stay blocked */
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+}
+
+/*
+    Only the current arena's stacks grow, so a fault in its guard pages is
+    the game overflowing one. Any other fault is a real crash: put the
+    default action back and let the instruction fault again.
+*/
+static void guard_fault(int sig, siginfo_t *info, void *context) {
+    unsigned char *at;
+
+    at = info->si_addr;
+    if (zArena && at >= (unsigned char *) zArena->call_stack - zPageSize && at < (unsigned char *) zArena->call_stack)
+        fatal_error("Value stack overflow!\n");
+    if (zArena && at >= (unsigned char *) zArena->page_stamp - zPageSize && at < (unsigned char *) zArena->page_stamp)
+        fatal_error("Call stack overflow");
+    signal(sig, SIG_DFL);
+}
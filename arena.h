@@ -0,0 +1,81 @@
+/*
+    Zerp: a Z-machine interpreter
+    arena.h : one allocation per running game
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN     64
+#define ARENA_POOL      32
+#define ARENA_SHARED    16      /* 64K of dynamic memory in 4K pages, for dedup.c */
+
+/*
+    Everything a running game writes lives in one page-aligned region:
+
+        machine     the story image. Over a shared story (story_share()) this
+                    is a private mapping, so only pages the game writes are
+                    its own - in practice, dynamic memory.
+        stack       STACKSIZE words, then a guard page
+        call_stack  CALLSTACKSIZE frames, then a guard page
+        page_stamp  ZPAGES dirty stamps (see zerp.h)
+        the arena   this struct
+        data        extra bytes for the owner (a session keeps itself here)
+
+    The undo ring (undo.c) hangs off the arena but is allocated separately,
+    as its size depends on what the game does. shared and shared_stamp
+    belong to dedup.c, which may map some of the image's pages over copies
+    held in common with other arenas.
+
+    The stacks are reserved much larger than any game needs, without
+    being counted against commit (MAP_NORESERVE); the system only
+    provides the pages they actually reach. Running off the top of
+    either hits its guard page, which is inaccessible, and the fault
+    handler turns that into a fatal_error() for the game - so pushing and
+    calling needn't check for room.
+
+    The image, the stacks, their guard pages and the page stamps each
+    start on a page boundary; the arena struct and data start on a cache
+    line (ARENA_ALIGN). The region is always anonymous memory from
+    mmap(); mapped says its image is mapped over the shared story.
+    Resetting an arena puts the pristine story back without touching the
+    allocator, and arena_restore() does the same by copying back only the
+    pages the game has written, which is what RESTART uses. Destroyed
+    arenas are reset, their stacks given back with madvise(), and kept,
+    up to ARENA_POOL of them, for the next arena_create(); past that,
+    destroying one is a single munmap().
+*/
+typedef struct zarena {
+    unsigned char *base;
+    size_t size;
+    size_t image_size;
+    unsigned char *machine;
+    zword_t *stack;
+    zstack_frame_t *call_stack;
+    unsigned int *page_stamp;
+    unsigned int stamp;
+    unsigned int epoch;
+    unsigned long long hash;
+    int shared[ARENA_SHARED];
+    unsigned int shared_stamp;
+    struct zundo *undo;
+    void *data;
+    size_t data_size;
+    int mapped;
+    struct zarena *next;
+} zarena_t;
+
+extern zarena_t *zArena;
+
+zarena_t *arena_create(size_t data_size);
+zarena_t *arena_clone(zarena_t *arena, size_t data_size);
+void arena_destroy(zarena_t *arena);
+int arena_reset(zarena_t *arena);
+void arena_restore(zarena_t *arena);
+void arena_use(zarena_t *arena);
+unsigned int arena_checkpoint();
+int arena_dirty_pages(unsigned int since, unsigned char *bitmap);
+
+#endif /* ARENA_H */
@@ -0,0 +1,137 @@
+/*
+    Zerp: a Z-machine interpreter
+    autosave.c : snapshots written in the background, for crash recovery
+
+    autosave() takes its copy of the game at once, while the game is
+    stopped at a read: snapshot_encode() copies only the pages written
+    since the game started and the live stacks, a few KB and a few
+    microseconds. Writing that out is what takes the time, so a thread of
+    its own does it: to a temporary file, synced, then renamed over the
+    old autosave, so a crash at any point leaves a whole snapshot behind.
+    A save still waiting when a newer one for the same file comes in is
+    replaced by it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "snapshot.h"
+#include "autosave.h"
+
+typedef struct autosave_job {
+    char *filename;
+    unsigned char *data;
+    size_t len;
+    struct autosave_job *next;
+} autosave_job_t;
+
+char *zAutosaveFile = NULL;
+int zAutosaveTurns = AUTOSAVE_TURNS;
+
+static pthread_mutex_t zAutosaveLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zAutosaveReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t zAutosaveIdle = PTHREAD_COND_INITIALIZER;
+static autosave_job_t *zAutosaveQueue = NULL, **zAutosaveTail = &zAutosaveQueue;
+static int zAutosaveBusy = FALSE;
+static int zAutosaveStarted = FALSE;
+
+static void *autosave_writer(void *unused);
+static void job_free(autosave_job_t *job);
+
+/* Queue a snapshot of the running game for writing to filename. FALSE if it couldn't be taken. */
+int autosave(char *filename) {
+    autosave_job_t *job, *queued;
+    pthread_t writer;
+
+    job = calloc(1, sizeof(autosave_job_t));
+    if (!job)
+        return FALSE;
+    job->filename = strdup(filename);
+    job->data = snapshot_encode(&job->len);
+    if (!job->filename || !job->data) {
+        job_free(job);
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&zAutosaveLock);
+    if (!zAutosaveStarted) {
+        if (pthread_create(&writer, NULL, autosave_writer, NULL)) {
+            pthread_mutex_unlock(&zAutosaveLock);
+            job_free(job);
+            return FALSE;
+        }
+        pthread_detach(writer);
+        zAutosaveStarted = TRUE;
+    }
+    for (queued = zAutosaveQueue; queued; queued = queued->next) {
+        if (!strcmp(queued->filename, filename))
+            break;
+    }
+    if (queued) {
+        /* not written yet: write this one instead */
+        free(queued->data);
+        queued->data = job->data;
+        queued->len = job->len;
+        job->data = NULL;
+        job_free(job);
+    } else {
+        *zAutosaveTail = job;
+        zAutosaveTail = &job->next;
+        pthread_cond_signal(&zAutosaveReady);
+    }
+    pthread_mutex_unlock(&zAutosaveLock);
+    return TRUE;
+}
+
+/* Wait until every queued save has been written. */
+void autosave_flush() {
+    pthread_mutex_lock(&zAutosaveLock);
+    while (zAutosaveQueue || zAutosaveBusy)
+        pthread_cond_wait(&zAutosaveIdle, &zAutosaveLock);
+    pthread_mutex_unlock(&zAutosaveLock);
+}
+
+static void *autosave_writer(void *unused) {
+    autosave_job_t *job;
+    char *temp;
+
+    pthread_mutex_lock(&zAutosaveLock);
+    while (TRUE) {
+        while (!zAutosaveQueue)
+            pthread_cond_wait(&zAutosaveReady, &zAutosaveLock);
+        job = zAutosaveQueue;
+        zAutosaveQueue = job->next;
+        if (!zAutosaveQueue)
+            zAutosaveTail = &zAutosaveQueue;
+        zAutosaveBusy = TRUE;
+        pthread_mutex_unlock(&zAutosaveLock);
+
+        temp = malloc(strlen(job->filename) + 5);
+        if (temp) {
+            sprintf(temp, "%s.new", job->filename);
+            if (!snapshot_write(temp, job->data, job->len, TRUE) || rename(temp, job->filename))
+                remove(temp);
+            free(temp);
+        }
+        job_free(job);
+
+        pthread_mutex_lock(&zAutosaveLock);
+        zAutosaveBusy = FALSE;
+        if (!zAutosaveQueue)
+            pthread_cond_broadcast(&zAutosaveIdle);
+    }
+    return NULL;
+}
+
+static void job_free(autosave_job_t *job) {
+    free(job->filename);
+    free(job->data);
+    free(job);
+}
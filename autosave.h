@@ -0,0 +1,18 @@
+/*
+    Zerp: a Z-machine interpreter
+    autosave.h : snapshots written in the background, for crash recovery
+*/
+
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#define AUTOSAVE_TURNS  10
+
+/* set (e.g. from the command line) to make zerp_run() autosave every zAutosaveTurns reads */
+extern char *zAutosaveFile;
+extern int zAutosaveTurns;
+
+int autosave(char *filename);
+void autosave_flush();
+
+#endif /* AUTOSAVE_H */
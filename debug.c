@@ -3,17 +3,38 @@
     debug.c : debugging monitor
 */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <regex.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #ifdef TARGET_OS_MAC
 #include <GlkClient/glk.h>
 #else
 #include "glk.h"
 #endif /* TARGET_OS_MAC */
 #include "zerp.h"
+#include "opcodes.h"
+#include "stack.h"
 #include "objects.h"
+#include "story.h"
+#include "arena.h"
+#include "undo.h"
+#include "trace.h"
+#include "profile.h"
+#include "json.h"
+#include "stats.h"
 #include "debug.h"
 
+volatile sig_atomic_t zMonitorBreak = 0;
+
+/* where 'i' last left off, for the rate */
+static unsigned long long zRateCount = 0;
+static clock_t zRateClock = 0;
+
 #define match_command(command) strncmp(command, cmd + pmatch[1].rm_so, 1) == 0
 
 #define match_args_and_call(func, failed_match) if (pmatch[3].rm_so != pmatch[3].rm_eo) { \
@@ -24,37 +45,22 @@
 
 /* event parsing loop freely stolen from Zarf's glk example code */
 void debug_monitor() {
-    char commandbuf[256], lastcommand[256];
+    char commandbuf[256];
     char *cx, *cmd;
-    int gotline, len, monitor, match;
+    int len, monitor;
     event_t ev;
-    char *parser = "^([cfghlnoqsx])( +([0-9a-f]+))?";
-    // char *parser = "\\([cghlnqsx]\\)\\( 0\\)?";
-    char *matched;
-    regex_t preg;
-    size_t nmatch = 4;
-    regmatch_t pmatch[4];
     
     monitor = TRUE;
     while(monitor) {
         glk_put_string("\nmonitor>");
-        // if (cmd)
-        //     strncpy(lastcommand, cmd, 256);
         glk_request_line_event(mainwin, commandbuf, 255, 0);
-        gotline = FALSE;
-        while (!gotline) {
+        do {
             glk_select(&ev);
-            if (ev.type == evtype_LineInput)
-                gotline = TRUE;
-        }
+        } while (ev.type != evtype_LineInput);
 
         len = ev.val1;
         commandbuf[len] = '\0';
 
-        for (cx = commandbuf; *cx; cx++) { 
-            *cx = glk_char_to_lower(*cx);
-        }
-        
         /* strip whitespace */
         for (cx = commandbuf; *cx == ' '; cx++) { };
         cmd = cx;
@@ -65,42 +71,89 @@ void debug_monitor() {
             monitor = FALSE;
             continue;
         }
-        
-        if ((match = regcomp(&preg, parser, REG_EXTENDED | REG_ICASE)) != 0) {
-            fatal_error("Bad regex\n");
-        }
+        monitor = debug_command(cmd);
+    }
+}
 
-        if ((match = regexec(&preg, cmd, nmatch, pmatch, 0)) != 0) {
-            glk_put_string("pardon? - try 'h' for help\n");
-        } else {
-            if(match_command("c")) {
-                monitor = FALSE;
-            } else if (match_command("f")) {
-                match_args_and_call(debug_print_callstack, 0xffff)
-            } else if (match_command("g")) {
-                match_args_and_call(debug_print_global, 0xff)
-            } else if (match_command("h")) {
-                debug_print_help();
-            } else if (match_command("l")) {
-                match_args_and_call(debug_print_local, 0xff)
-            } else if (match_command("n")) {
-                monitor = FALSE;                
-            } else if (match_command("o")) {
-                match_args_and_call(debug_print_object, 1);         
-            } else if (match_command("x")) {
-                match_args_and_call(debug_print_memory, 0xdeadbeef)
-            } else if (match_command("")) {
-                match_args_and_call(debug_print_zstring, 0)
-            } else if (match_command("q")) {
-                fatal_error("Debugger terminated game.");
-            } else if (match_command("s")) {
-                debug_print_stack();
-            } else if (match_command("x")) {
-                match_args_and_call(debug_print_memory, 0xdeadbeef)
-            }
+/* Carry out one monitor command. FALSE if it lets the game go on. */
+int debug_command(char *cmd) {
+    char *cx;
+    int match, monitor;
+    char *parser = "^([cfghiklmnoqrstx])( +([0-9a-f]+))?";
+    regex_t preg;
+    size_t nmatch = 4;
+    regmatch_t pmatch[4];
+
+    for (cx = cmd; *cx; cx++) { 
+        *cx = glk_char_to_lower(*cx);
+    }
+
+    if ((match = regcomp(&preg, parser, REG_EXTENDED | REG_ICASE)) != 0) {
+        fatal_error("Bad regex\n");
+    }
+
+    monitor = TRUE;
+    if ((match = regexec(&preg, cmd, nmatch, pmatch, 0)) != 0) {
+        glk_put_string("pardon? - try 'h' for help\n");
+    } else {
+        if(match_command("c")) {
+            monitor = FALSE;
+        } else if (match_command("f")) {
+            match_args_and_call(debug_print_callstack, 0xffff)
+        } else if (match_command("g")) {
+            match_args_and_call(debug_print_global, 0xff)
+        } else if (match_command("h")) {
+            debug_print_help();
+        } else if (match_command("i")) {
+            debug_print_rate();
+        } else if (match_command("k")) {
+            debug_print_caches();
+        } else if (match_command("l")) {
+            match_args_and_call(debug_print_local, 0xff)
+        } else if (match_command("m")) {
+            debug_print_footprint();
+        } else if (match_command("n")) {
+            monitor = FALSE;                
+        } else if (match_command("o")) {
+            match_args_and_call(debug_print_object, 1);         
+        } else if (match_command("")) {
+            match_args_and_call(debug_print_zstring, 0)
+        } else if (match_command("q")) {
+            fatal_error("Debugger terminated game.");
+        } else if (match_command("r")) {
+            debug_reset_counters();
+        } else if (match_command("s")) {
+            debug_print_stack();
+        } else if (match_command("t")) {
+            match_args_and_call(debug_print_top, 10)
+        } else if (match_command("x")) {
+            match_args_and_call(debug_print_memory, 0xdeadbeef)
         }
-        regfree(&preg);
     }
+    regfree(&preg);
+    return monitor;
+}
+
+/* Let SIGINT break into the monitor, at the next instruction */
+void debug_break_signal() {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = debug_interrupt;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+}
+
+/* zerp_execute() has seen zMonitorBreak */
+void debug_break() {
+    zMonitorBreak = 0;
+    glk_printf("\n[monitor at %05x]", instructionPC);
+    debug_monitor();
+}
+
+static void debug_interrupt(int sig) {
+    zMonitorBreak = 1;
 }
 
 static void debug_print_callstack(int frame) {
@@ -148,8 +201,8 @@ static void debug_print_callstack(int frame) {
         }
         glk_put_string("\nLocals:\n");
         
-        for (i = 1; i < 16; i++) {
-            glk_printf("%8x", aframe->locals[i]);
+        for (i = 0; i < aframe->local_count; i++) {
+            glk_printf("%8x", frame_locals(aframe)[i]);
         }
     }
 }
@@ -176,11 +229,16 @@ static void debug_print_help() {
     glk_put_string("f [frameno]     - print call stack frame, omit arg to show all frames\n");
     glk_put_string("g [globalno]    - print global variable <globalno>, omit arg to see all globals\n");
     glk_put_string("h               - this help information\n");
+    glk_put_string("i               - instructions run, and how fast since last asked\n");
+    glk_put_string("k               - cache hit rates\n");
     glk_put_string("l [localno]     - print local variable <localno>, omit arg to see all locals\n");
+    glk_put_string("m               - memory used by this game\n");
     glk_put_string("n               - execute next instruction\n");
     glk_put_string("p [address]     - print zstring at <address>\n");
     glk_put_string("q               - quit game\n");
+    glk_put_string("r               - reset the counters (and start profiling, if built with it)\n");
     glk_put_string("s               - print stack contents\n");
+    glk_put_string("t [count]       - top opcodes and routines since the last reset\n");
     glk_put_string("x [address]     - examine memory at <address>\n");
     glk_put_string("\n");
 }
@@ -189,7 +247,7 @@ static void debug_print_local(int number){
     if (number == 0xff) {
         dump_locals();
     } else {
-        if (number < 1 || number > 15) {
+        if (number < 1 || number > zFP->local_count) {
             glk_put_string("ERROR: local out of range\n");
             return;
         }
@@ -246,12 +304,97 @@ static void debug_print_object(int number) {
 	}
 }
 
+static void debug_print_rate() {
+    unsigned long long count;
+    clock_t now;
+    double seconds;
+
+    count = zStats->count[STAT_INSTRUCTIONS];
+    now = clock();
+    seconds = (double) (now - zRateClock) / CLOCKS_PER_SEC;
+    glk_printf("%llu instructions run", count);
+    if (seconds > 0)
+        glk_printf(", %.0f a second (of CPU time) since last asked", (count - zRateCount) / seconds);
+    glk_printf(" (%llu by every game)\n", stats_process()->count[STAT_INSTRUCTIONS]);
+    zRateCount = count;
+    zRateClock = now;
+}
+
+/* the profiler's busiest opcodes and routines since the last reset */
+static void debug_print_top(int count) {
+    char *text;
+    size_t size;
+    FILE *out;
+
+#ifndef ZPROFILE
+    glk_put_string("This build doesn't profile; rebuild with -DZPROFILE.\n");
+    return;
+#endif
+    if (!zProfiling) {
+        glk_put_string("Not profiling - 'r' starts it.\n");
+        return;
+    }
+    out = open_memstream(&text, &size);
+    if (!out)
+        return;
+    profile_report(out, count > 0 ? count : 10);
+    fclose(out);
+    glk_put_buffer(text, size);
+    free(text);
+}
+
+static void debug_print_caches() {
+    unsigned long long hits, misses;
+
+    hits = zStats->count[STAT_ROUTINE_HITS];
+    misses = zStats->count[STAT_ROUTINE_MISSES];
+    glk_printf("routine headers: %llu hits, %llu misses", hits, misses);
+    if (hits + misses)
+        glk_printf(" (%.1f%% hits)", 100.0 * hits / (hits + misses));
+    glk_printf("\ndictionary index: %llu lookups, %llu not found\n",
+               zStats->count[STAT_DICT_LOOKUPS], zStats->count[STAT_DICT_MISSES]);
+}
+
+/* what this game's arena takes, reserved and resident */
+static void debug_print_footprint() {
+    unsigned char *resident;
+    size_t page, pages, i, in;
+
+    glk_printf("arena: %lu bytes reserved", (unsigned long) zArena->size);
+    page = sysconf(_SC_PAGESIZE);
+    pages = (zArena->size + page - 1) / page;
+    resident = malloc(pages);
+    if (resident && !mincore(zArena->base, zArena->size, (void *) resident)) {
+        for (i = in = 0; i < pages; i++)
+            in += resident[i] & 1;
+        glk_printf(", %lu resident (some maybe shared with other games)", (unsigned long) (in * page));
+    }
+    free(resident);
+    glk_printf("\nstory image: %lu bytes\n", (unsigned long) zArena->image_size);
+    glk_printf("value stack: %ld words in use\n", (long) (zSP - zStack));
+    glk_printf("call stack: %ld frames in use\n", (long) (zFP - zCallStack));
+    if (zArena->undo)
+        glk_printf("undo: %d levels, %lu bytes\n", zArena->undo->count, (unsigned long) zArena->undo->bytes);
+    if (zTrace)
+        glk_printf("trace: %u records, %lu bytes\n", zTrace->size,
+                   (unsigned long) (sizeof(ztrace_t) + zTrace->size * sizeof(ztrace_record_t)));
+}
+
+static void debug_reset_counters() {
+    stats_reset();
+    zRateCount = 0;
+    zRateClock = clock();
+    profile_reset();
+    zProfiling = TRUE;
+    glk_put_string("Counters reset.\n");
+}
+
 static void dump_stack() {
     zword_t *s;
     int empty = TRUE;
     
     s = zSP;
-    while(s >= zFP->sp) {
+    while(s >= frame_bottom(zFP)) {
         glk_printf("%#08x : %04x\n", s, *s--);
         empty = FALSE;
     }
@@ -281,11 +424,11 @@ static void dump_locals() {
     int l, x, y;
     
     glk_printf("\nlocal variables in stack frame %#08x:\n", zFP);
-    for (x = 1; x < 16; x++)
+    for (x = 1; x <= zFP->local_count; x++)
         glk_printf("%8x", x);
     glk_put_string("\n");
 
-    for (l = 1; l < 16; l++) {
+    for (l = 1; l <= zFP->local_count; l++) {
         // if (l == 1 || l == 9)
         //     glk_printf("\n%02x", l);
         glk_printf("%8x", variable_get(l));
@@ -1,12 +1,19 @@
 /* 
     Zerp: a Z-machine interpreter
-    opcodes.h : debugging monitor
+    debug.h : debugging monitor
 */
 
 #ifndef DEBUG_H
 #define DEBUG_H
 
+/* set by SIGINT, once debug_break_signal() has asked for it */
+extern volatile sig_atomic_t zMonitorBreak;
+
 void debug_monitor();
+int debug_command(char *cmd);
+void debug_break_signal();
+void debug_break();
+static void debug_interrupt(int sig);
 static void debug_print_callstack();
 static void debug_print_global(int number);
 static void debug_print_help();
@@ -15,6 +22,11 @@ static void debug_print_stack();
 static void debug_print_memory(int address);
 static void debug_print_zstring(packed_addr_t address);
 static void debug_print_object(int number);
+static void debug_print_rate();
+static void debug_print_top(int count);
+static void debug_print_caches();
+static void debug_print_footprint();
+static void debug_reset_counters();
 static void dump_stack();
 static void dump_globals();
 static void dump_locals();
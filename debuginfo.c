@@ -0,0 +1,188 @@
+/*
+    Zerp: a Z-machine interpreter
+    debuginfo.c : routine names from the story's debugging information
+
+    Inform 6 writes gameinfo.dbg when it compiles with -k: an XML file
+    that gives, among much else, each routine's identifier, address and
+    byte count. Only those are read, by looking for the elements rather
+    than parsing the XML properly. A plain list of "address name" lines,
+    one routine to a line, is read too, for stories from elsewhere.
+
+    The table is for the whole process, like the story it describes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "debuginfo.h"
+
+static zdebug_routine_t *zDebugRoutines = NULL;
+static int zDebugCount = 0, zDebugSpace = 0;
+
+static int read_xml(char *text);
+static int read_list(char *text);
+static char *element(char *from, char *end, char *tag, char *buf, int len);
+static int add_routine(packed_addr_t address, unsigned int length, char *name);
+static int by_address(const void *a, const void *b);
+
+/* Load the routines in filename, replacing any already loaded. FALSE if it can't be read or has none. */
+int debuginfo_load(char *filename) {
+    FILE *file;
+    char *text;
+    long size;
+    int i, ok;
+
+    file = fopen(filename, "rb");
+    if (!file)
+        return FALSE;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    text = size >= 0 ? malloc(size + 1) : NULL;
+    if (!text || fread(text, 1, size, file) != size) {
+        free(text);
+        fclose(file);
+        return FALSE;
+    }
+    fclose(file);
+    text[size] = '\0';
+
+    for (i = 0; i < zDebugCount; i++)
+        free(zDebugRoutines[i].name);
+    zDebugCount = 0;
+    ok = strstr(text, "<routine>") ? read_xml(text) : read_list(text);
+    free(text);
+    if (!ok || !zDebugCount)
+        return FALSE;
+    qsort(zDebugRoutines, zDebugCount, sizeof(zdebug_routine_t), by_address);
+    return TRUE;
+}
+
+/* The name of the routine that starts at address, or NULL */
+char *debuginfo_name(packed_addr_t address) {
+    int low, high, mid;
+
+    for (low = 0, high = zDebugCount - 1; low <= high; ) {
+        mid = (low + high) / 2;
+        if (zDebugRoutines[mid].address == address)
+            return zDebugRoutines[mid].name;
+        if (zDebugRoutines[mid].address < address)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return NULL;
+}
+
+/* The address of the routine pc is in, or 0 if it isn't in one we know */
+packed_addr_t debuginfo_routine_at(packed_addr_t pc) {
+    int low, high, mid;
+
+    /* the last routine starting at or before pc */
+    for (low = 0, high = zDebugCount - 1; low <= high; ) {
+        mid = (low + high) / 2;
+        if (zDebugRoutines[mid].address <= pc)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    if (high < 0)
+        return 0;
+    if (zDebugRoutines[high].length && pc >= zDebugRoutines[high].address + zDebugRoutines[high].length)
+        return 0;
+    return zDebugRoutines[high].address;
+}
+
+/* each <routine> element's first <identifier>, <address> and <byte-count> */
+static int read_xml(char *text) {
+    char *at, *end, name[256], number[16];
+    packed_addr_t address;
+
+    for (at = strstr(text, "<routine>"); at; at = strstr(end, "<routine>")) {
+        end = strstr(at, "</routine>");
+        if (!end)
+            break;
+        if (!element(at, end, "identifier", name, sizeof(name)) || !element(at, end, "address", number, sizeof(number)))
+            continue;
+        address = strtoul(number, NULL, 10);
+        if (!add_routine(address, element(at, end, "byte-count", number, sizeof(number)) ? strtoul(number, NULL, 10) : 0, name))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* "address name" lines, the address in decimal or with 0x in hex */
+static int read_list(char *text) {
+    char *line, *next, *name, *end;
+    packed_addr_t address;
+
+    for (line = text; *line; line = next) {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        address = strtoul(line, &name, 0);
+        if (name == line || !address)
+            continue;
+        name += strspn(name, " \t");
+        for (end = name; end < next && *end != '\n' && *end != '\r' && *end != ' ' && *end != '\t'; end++) ;
+        if (end == name)
+            continue;
+        *end = '\0';
+        if (!add_routine(address, 0, name))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* the text of the first <tag> element between from and end, or NULL */
+static char *element(char *from, char *end, char *tag, char *buf, int len) {
+    char open[32];
+    char *at, *close;
+    int n;
+
+    snprintf(open, sizeof(open), "<%s", tag);
+    for (at = strstr(from, open); at && at < end; at = strstr(at + 1, open)) {
+        n = strlen(open);
+        if (at[n] == '>' || at[n] == ' ')
+            break;
+    }
+    if (!at || at >= end)
+        return NULL;
+    at = strchr(at, '>');
+    close = at ? strchr(at, '<') : NULL;
+    if (!close || close > end || close - at - 1 >= len)
+        return NULL;
+    memcpy(buf, at + 1, close - at - 1);
+    buf[close - at - 1] = '\0';
+    return buf;
+}
+
+static int add_routine(packed_addr_t address, unsigned int length, char *name) {
+    zdebug_routine_t *routines;
+
+    if (zDebugCount == zDebugSpace) {
+        routines = realloc(zDebugRoutines, (zDebugSpace ? zDebugSpace * 2 : 256) * sizeof(zdebug_routine_t));
+        if (!routines)
+            return FALSE;
+        zDebugRoutines = routines;
+        zDebugSpace = zDebugSpace ? zDebugSpace * 2 : 256;
+    }
+    zDebugRoutines[zDebugCount].name = strdup(name);
+    if (!zDebugRoutines[zDebugCount].name)
+        return FALSE;
+    zDebugRoutines[zDebugCount].address = address;
+    zDebugRoutines[zDebugCount].length = length;
+    zDebugCount++;
+    return TRUE;
+}
+
+static int by_address(const void *a, const void *b) {
+    const zdebug_routine_t *x = a, *y = b;
+
+    return x->address < y->address ? -1 : x->address > y->address;
+}
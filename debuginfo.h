@@ -0,0 +1,20 @@
+/*
+    Zerp: a Z-machine interpreter
+    debuginfo.h : routine names from the story's debugging information
+*/
+
+#ifndef DEBUGINFO_H
+#define DEBUGINFO_H
+
+/* one routine: its (byte) address, its length in bytes if known, and its name */
+typedef struct zdebug_routine {
+    packed_addr_t address;
+    unsigned int length;
+    char *name;
+} zdebug_routine_t;
+
+int debuginfo_load(char *filename);
+char *debuginfo_name(packed_addr_t address);
+packed_addr_t debuginfo_routine_at(packed_addr_t pc);
+
+#endif /* DEBUGINFO_H */
@@ -0,0 +1,277 @@
+/*
+    Zerp: a Z-machine interpreter
+    dedup.c : sharing identical pages of dynamic memory between games
+
+    Games of one story that sit at much the same point hold much the same
+    dynamic memory. A page a game has written either matches the story
+    again (the game put things back) or very often matches a page of some
+    other game. dedup_arena() maps the first kind back onto the story and
+    the second onto one copy kept in a page store, a memfd of its own.
+    Both mappings are private, so the game's next write to the page gets
+    it a fresh copy from the kernel: store_byte() carries on as before,
+    and its dirty stamps tell us later which shared pages have been
+    written and are the game's own again.
+
+    Works in whole system pages, and only on arenas mapped over a shared
+    story (story_share()); elsewhere it does nothing.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "story.h"
+#include "arena.h"
+#include "dedup.h"
+
+#define DEDUP_STORY     -1
+#define DEDUP_BUCKETS   1024
+#define STORE_GROW      64
+#define FNV_OFFSET      0xcbf29ce484222325ULL
+#define FNV_PRIME       0x100000001b3ULL
+
+/* a page in the store; next links its bucket, or the free list */
+typedef struct zslot {
+    unsigned long long hash;
+    int refs;
+    int next;
+} zslot_t;
+
+static int zStoreFd = -1;
+static unsigned char *zStore = NULL;
+static zslot_t *zSlots = NULL;
+static int zSlotSpace = 0, zSlotCount = 0;
+static int zFreeSlot = -1;
+static int zBucket[DEDUP_BUCKETS];
+static size_t zPage = 0;
+static zdedup_stats_t zStats;
+
+static int store_open();
+static int store_find(unsigned long long hash, unsigned char *data);
+static int store_add(unsigned long long hash, unsigned char *data);
+static void store_drop(int slot);
+static int map_over(unsigned char *memory, int fd, off_t offset);
+static int page_written(zarena_t *arena, int page, unsigned int since);
+static unsigned long long page_hash(unsigned char *data);
+
+/*
+    Share what can be shared of arena's dynamic memory, which should
+    belong to a game that's waiting for input. Pages shared by an earlier
+    pass and written since are let go first. Returns the number of pages
+    newly shared.
+*/
+int dedup_arena(zarena_t *arena) {
+    unsigned char *memory;
+    unsigned long long hash;
+    int dynamic, pages, page, slot, shared;
+
+    if (!arena->mapped || zStoryFd < 0 || !store_open())
+        return 0;
+    dynamic = zGamefile[STATIC_MEM] << 8 | zGamefile[STATIC_MEM + 1];
+    pages = (dynamic + zPage - 1) / zPage;
+    if (pages > ARENA_SHARED)
+        pages = ARENA_SHARED;
+
+    for (page = shared = 0; page < pages; page++) {
+        memory = arena->machine + page * zPage;
+        if (arena->shared[page]) {
+            if (!page_written(arena, page, arena->shared_stamp))
+                continue;
+            /* the kernel gave the game its own copy when it wrote */
+            if (arena->shared[page] == DEDUP_STORY) {
+                zStats.story--;
+            } else {
+                zStats.shared--;
+                store_drop(arena->shared[page] - 1);
+            }
+            arena->shared[page] = 0;
+        }
+        /* never written: still the story's page */
+        if (!page_written(arena, page, 0))
+            continue;
+
+        if (!memcmp(memory, zGamefile + page * zPage, zPage)) {
+            if (!map_over(memory, zStoryFd, page * zPage))
+                continue;
+            arena->shared[page] = DEDUP_STORY;
+            zStats.story++;
+        } else {
+            hash = page_hash(memory);
+            slot = store_find(hash, memory);
+            if (slot < 0 && (slot = store_add(hash, memory)) < 0)
+                continue;
+            zSlots[slot].refs++;
+            if (!map_over(memory, zStoreFd, (off_t) slot * zPage)) {
+                store_drop(slot);
+                continue;
+            }
+            arena->shared[page] = slot + 1;
+            zStats.shared++;
+        }
+        shared++;
+    }
+
+    /* a checkpoint, so that writes from here on can be told from those before */
+    arena->shared_stamp = arena->stamp++;
+    if (arena == zArena)
+        zDirtyStamp = arena->stamp;
+    return shared;
+}
+
+/* arena's pages are about to be (or have been) replaced wholesale: stop counting them as shared */
+void dedup_release(zarena_t *arena) {
+    int page;
+
+    for (page = 0; page < ARENA_SHARED; page++) {
+        if (arena->shared[page] == DEDUP_STORY) {
+            zStats.story--;
+        } else if (arena->shared[page]) {
+            zStats.shared--;
+            store_drop(arena->shared[page] - 1);
+        }
+        arena->shared[page] = 0;
+    }
+    arena->shared_stamp = 0;
+}
+
+void dedup_stats(zdedup_stats_t *stats) {
+    *stats = zStats;
+    stats->saved = (long) (zStats.story + zStats.shared - zStats.store) * zPage;
+}
+
+static int store_open() {
+    int i;
+
+    if (zStoreFd >= 0)
+        return TRUE;
+#ifdef __linux__
+    zStoreFd = memfd_create("zerp-pages", MFD_CLOEXEC);
+#endif
+    if (zStoreFd < 0)
+        return FALSE;
+    zPage = sysconf(_SC_PAGESIZE);
+    for (i = 0; i < DEDUP_BUCKETS; i++)
+        zBucket[i] = -1;
+    return TRUE;
+}
+
+static int store_find(unsigned long long hash, unsigned char *data) {
+    int slot;
+
+    for (slot = zBucket[hash % DEDUP_BUCKETS]; slot >= 0; slot = zSlots[slot].next) {
+        if (zSlots[slot].hash == hash && !memcmp(zStore + slot * zPage, data, zPage))
+            return slot;
+    }
+    return -1;
+}
+
+/* a new page in the store holding a copy of data, with no references yet; -1 if the store can't grow */
+static int store_add(unsigned long long hash, unsigned char *data) {
+    unsigned char *grown;
+    zslot_t *slots;
+    int slot, space;
+
+    if (zFreeSlot >= 0) {
+        slot = zFreeSlot;
+        zFreeSlot = zSlots[slot].next;
+    } else {
+        if (zSlotCount == zSlotSpace) {
+            space = zSlotSpace + STORE_GROW;
+            slots = realloc(zSlots, space * sizeof(zslot_t));
+            if (!slots)
+                return -1;
+            zSlots = slots;
+            if (ftruncate(zStoreFd, (off_t) space * zPage))
+                return -1;
+            grown = mmap(NULL, space * zPage, PROT_READ | PROT_WRITE, MAP_SHARED, zStoreFd, 0);
+            if (grown == MAP_FAILED)
+                return -1;
+            if (zStore)
+                munmap(zStore, zSlotSpace * zPage);
+            zStore = grown;
+            zSlotSpace = space;
+        }
+        slot = zSlotCount++;
+    }
+
+    memcpy(zStore + slot * zPage, data, zPage);
+    zSlots[slot].hash = hash;
+    zSlots[slot].refs = 0;
+    zSlots[slot].next = zBucket[hash % DEDUP_BUCKETS];
+    zBucket[hash % DEDUP_BUCKETS] = slot;
+    zStats.store++;
+    return slot;
+}
+
+/* one reference fewer; the last one gives the page back to the system */
+static void store_drop(int slot) {
+    int *link;
+
+    if (--zSlots[slot].refs > 0)
+        return;
+    for (link = &zBucket[zSlots[slot].hash % DEDUP_BUCKETS]; *link != slot; link = &zSlots[*link].next) ;
+    *link = zSlots[slot].next;
+#ifdef __linux__
+    fallocate(zStoreFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) slot * zPage, zPage);
+#endif
+    zSlots[slot].next = zFreeSlot;
+    zFreeSlot = slot;
+    zStats.store--;
+}
+
+/*
+    Replace the page at memory with a private mapping of fd at offset.
+    The new page is mapped elsewhere first and moved into place, so if
+    anything fails the old one is still there.
+*/
+static int map_over(unsigned char *memory, int fd, off_t offset) {
+#ifdef __linux__
+    void *page;
+
+    page = mmap(NULL, zPage, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+    if (page == MAP_FAILED)
+        return FALSE;
+    if (mremap(page, zPage, zPage, MREMAP_MAYMOVE | MREMAP_FIXED, memory) == MAP_FAILED) {
+        munmap(page, zPage);
+        return FALSE;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/* has any part of system page page been written since the stamp since? */
+static int page_written(zarena_t *arena, int page, unsigned int since) {
+    int zpage, end;
+
+    zpage = (page * zPage) >> ZPAGE_SHIFT;
+    end = ((page + 1) * zPage) >> ZPAGE_SHIFT;
+    for (; zpage < end && zpage < ZPAGES; zpage++) {
+        if (arena->page_stamp[zpage] > since)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* FNV-1a, a word at a time */
+static unsigned long long page_hash(unsigned char *data) {
+    unsigned long long hash, word;
+    size_t at;
+
+    hash = FNV_OFFSET;
+    for (at = 0; at < zPage; at += sizeof(word)) {
+        memcpy(&word, data + at, sizeof(word));
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    return hash;
+}
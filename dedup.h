@@ -0,0 +1,25 @@
+/*
+    Zerp: a Z-machine interpreter
+    dedup.h : sharing identical pages of dynamic memory between games
+*/
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+/*
+    What dedup_arena() has saved so far: pages put back onto the story,
+    pages mapped onto the page store, the distinct pages the store holds,
+    and what that comes to in bytes.
+*/
+typedef struct zdedup_stats {
+    int story;
+    int shared;
+    int store;
+    long saved;
+} zdedup_stats_t;
+
+int dedup_arena(struct zarena *arena);
+void dedup_release(struct zarena *arena);
+void dedup_stats(zdedup_stats_t *stats);
+
+#endif /* DEDUP_H */
@@ -10,20 +10,80 @@
     *not* be compiled into the Glk library itself.
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h>
 #include "glk.h"
 #include "glkstart.h"
 #include "zerp.h"
+#include "autosave.h"
+#include "opcodes.h"
+#include "trace.h"
+#include "profile.h"
+#include "sample.h"
+#include "debuginfo.h"
+#include "debug.h"
+#include "json.h"
+#include "stats.h"
+#include "latency.h"
 
 glkunix_argumentlist_t glkunix_arguments[] = {
+  { "-autosave", glkunix_arg_ValueFollows, "-autosave file: Snapshot the game to file as it goes." },
+  { "-every", glkunix_arg_NumberValue, "-every n: Autosave every n turns." },
+  { "-trace", glkunix_arg_ValueFollows, "-trace file: Trace the game into file (SIGUSR2 switches tracing off and on)." },
+  { "-decode", glkunix_arg_ValueFollows, "-decode file: Print a trace of the game instead of playing it." },
+  { "-profile", glkunix_arg_ValueFollows, "-profile file: Count instructions by opcode and routine, and write them to file (and file.csv)." },
+  { "-cycles", glkunix_arg_NoValue, "-cycles: Also time each routine while profiling." },
+  { "-sample", glkunix_arg_ValueFollows, "-sample file: Sample the game's call stack, and write folded stacks for a flame graph to file." },
+  { "-rate", glkunix_arg_NumberValue, "-rate n: Take n samples a second (of CPU time)." },
+  { "-debuginfo", glkunix_arg_ValueFollows, "-debuginfo file: Name routines from the story's debugging information (Inform's gameinfo.dbg)." },
+  { "-monitor", glkunix_arg_NoValue, "-monitor: Break into the debug monitor on Ctrl-C (SIGINT)." },
+  { "-slow", glkunix_arg_NumberValue, "-slow ms: Log turns that take longer than ms milliseconds, with their command (0: none)." },
+  { "-stats", glkunix_arg_ValueFollows, "-stats file: Append the counters summary (written at exit and on SIGUSR1) to file rather than stderr." },
   { "", glkunix_arg_ValueFollows, "filename: The game file to load." },
   { NULL, glkunix_arg_End, NULL }
 };
 
 int glkunix_startup_code(glkunix_startup_t *data)
 {
-  if (data->argc > 1) {
-	zFilename = data->argv[1];
+  int i;
+
+  for (i = 1; i < data->argc; i++) {
+    if (!strcmp(data->argv[i], "-autosave") && i + 1 < data->argc) {
+      zAutosaveFile = data->argv[++i];
+    } else if (!strcmp(data->argv[i], "-every") && i + 1 < data->argc) {
+      zAutosaveTurns = atoi(data->argv[++i]);
+    } else if (!strcmp(data->argv[i], "-trace") && i + 1 < data->argc) {
+      trace_signal(data->argv[++i]);
+      trace_start(TRACE_RECORDS);
+    } else if (!strcmp(data->argv[i], "-decode") && i + 1 < data->argc) {
+      zTraceDecode = data->argv[++i];
+    } else if (!strcmp(data->argv[i], "-profile") && i + 1 < data->argc) {
+      zProfileFile = data->argv[++i];
+      zProfiling = TRUE;
+    } else if (!strcmp(data->argv[i], "-cycles")) {
+      zProfileCycles = TRUE;
+    } else if (!strcmp(data->argv[i], "-sample") && i + 1 < data->argc) {
+      zSampleFile = data->argv[++i];
+    } else if (!strcmp(data->argv[i], "-rate") && i + 1 < data->argc) {
+      zSampleHz = atoi(data->argv[++i]);
+    } else if (!strcmp(data->argv[i], "-debuginfo") && i + 1 < data->argc) {
+      if (!debuginfo_load(data->argv[++i]))
+        fprintf(stderr, "zerp: no routines read from %s\n", data->argv[i]);
+    } else if (!strcmp(data->argv[i], "-monitor")) {
+      debug_break_signal();
+    } else if (!strcmp(data->argv[i], "-slow") && i + 1 < data->argc) {
+      zLatencySlow = atoi(data->argv[++i]);
+    } else if (!strcmp(data->argv[i], "-stats") && i + 1 < data->argc) {
+      zStatsFile = data->argv[++i];
+    } else {
+      zFilename = data->argv[i];
+    }
+  }
+  stats_signal();
+
+  if (zFilename) {
     zGamefileRef = glk_fileref_create_by_name(fileusage_BinaryMode, zFilename, 0);
 	
   } else {
@@ -0,0 +1,109 @@
+/*
+    Zerp: a Z-machine interpreter
+    hash.c : telling game states apart
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "hash.h"
+
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+static unsigned long long zStoryHash;
+static int zStoryHashed = FALSE;
+
+static unsigned long long stack_hash();
+static unsigned long long hash_bytes(unsigned long long hash, void *data, int len);
+static unsigned long long hash_number(unsigned long long hash, unsigned int value);
+
+/* the current game's state, from the running memory hash */
+unsigned long long state_hash() {
+    return *zMemoryHash ^ stack_hash();
+}
+
+/*
+    The same, with the memory part worked out afresh. Only bytes that
+    differ from the story contribute anything beyond the story's own hash,
+    and those are found comparing eight bytes at a time.
+*/
+unsigned long long state_hash_full() {
+    unsigned long long hash;
+    uint64_t now, was;
+    int dynamic, at, end;
+
+    hash = story_memory_hash();
+    dynamic = get_word(STATIC_MEM);
+    for (at = 0; at < dynamic; at = end) {
+        end = at + sizeof(uint64_t) <= dynamic ? at + sizeof(uint64_t) : dynamic;
+        if (end - at == sizeof(uint64_t)) {
+            memcpy(&now, zMachine + at, sizeof(uint64_t));
+            memcpy(&was, zGamefile + at, sizeof(uint64_t));
+            if (now == was)
+                continue;
+        }
+        for (; at < end; at++) {
+            if (zMachine[at] != zGamefile[at])
+                hash ^= zobrist(at, zGamefile[at]) ^ zobrist(at, zMachine[at]);
+        }
+    }
+    return hash ^ stack_hash();
+}
+
+/* the memory hash of the story as loaded, which every new game starts with */
+unsigned long long story_memory_hash() {
+    int dynamic, at;
+
+    if (!zStoryHashed) {
+        dynamic = zGamefile[STATIC_MEM] << 8 | zGamefile[STATIC_MEM + 1];
+        for (zStoryHash = 0, at = 0; at < dynamic; at++)
+            zStoryHash ^= zobrist(at, zGamefile[at]);
+        zStoryHashed = TRUE;
+    }
+    return zStoryHash;
+}
+
+/* len bytes of memory at offset are about to be replaced by data without store_byte(): keep the hash with them */
+void hash_overwrite(zword_t offset, unsigned char *data, int len) {
+    unsigned char *memory;
+    int i;
+
+    memory = zMachine + offset;
+    for (i = 0; i < len; i++) {
+        if (memory[i] != data[i])
+            *zMemoryHash ^= zobrist(offset + i, memory[i]) ^ zobrist(offset + i, data[i]);
+    }
+}
+
+/* FNV-1a over the live stacks and the PC; stack pointers go in as offsets, so the hash doesn't depend on the arena */
+static unsigned long long stack_hash() {
+    unsigned long long hash;
+    zstack_frame_t *frame;
+
+    hash = hash_bytes(FNV_OFFSET, zStack, (zSP - zStack + 1) * sizeof(zword_t));
+    for (frame = zCallStack; frame <= zFP; frame++) {
+        hash = hash_number(hash, frame->pc);
+        hash = hash_number(hash, frame->sp - zStack);
+        hash = hash_number(hash, frame->ret_store | frame->ret_keep << 8 | frame->args << 16 | frame->local_count << 24);
+    }
+    return hash_number(hash, zPC);
+}
+
+static unsigned long long hash_bytes(unsigned long long hash, void *data, int len) {
+    unsigned char *p;
+
+    for (p = data; len--; p++)
+        hash = (hash ^ *p) * FNV_PRIME;
+    return hash;
+}
+
+static unsigned long long hash_number(unsigned long long hash, unsigned int value) {
+    return hash_bytes(hash, &value, sizeof(value));
+}
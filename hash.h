@@ -0,0 +1,25 @@
+/*
+    Zerp: a Z-machine interpreter
+    hash.h : telling game states apart
+*/
+
+#ifndef HASH_H
+#define HASH_H
+
+/*
+    A 64-bit hash of everything that decides what the game does next:
+    dynamic memory, the live parts of the stacks and the PC. Two games of
+    the same story in the same state hash the same, wherever their
+    memory lives.
+
+    The memory part is kept up to date as the game writes (store_zbyte()
+    in zerp.h), so state_hash() costs only the stacks, which at a prompt
+    are a few dozen words. state_hash_full() works the memory part out
+    again from scratch, to check the running one.
+*/
+unsigned long long state_hash();
+unsigned long long state_hash_full();
+unsigned long long story_memory_hash();
+void hash_overwrite(zword_t offset, unsigned char *data, int len);
+
+#endif /* HASH_H */
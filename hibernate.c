@@ -0,0 +1,164 @@
+/*
+    Zerp: a Z-machine interpreter
+    hibernate.c : putting idle sessions away in as little memory as possible
+
+    A session waiting for input is mostly its story, which every session
+    shares, plus a few KB of dynamic memory that differs from the story in
+    a few hundred bytes, plus a shallow stack. Hibernating one keeps only
+    that difference, compressed, and gives its arena back; waking it takes
+    a fresh arena (usually from the pool), decompresses and attaches the
+    snapshot, which is a few memcpy()s. The undo ring isn't part of the
+    snapshot: it is kept as it is and handed to the new arena, so UNDO
+    works across a hibernation.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "json.h"
+#include "stats.h"
+#include "session.h"
+#include "arena.h"
+#include "undo.h"
+#include "snapshot.h"
+#include "lz.h"
+#include "hibernate.h"
+
+static int xor_pages(unsigned char *data, size_t len);
+
+/*
+    Put session away. It must be waiting for input (or stopped); the read
+    it is waiting on is cancelled in Glk, as its buffer goes with the
+    arena, and comes back with session_wake(). On success the session is
+    gone (but not its windows) and the result is malloc()ed; on failure
+    NULL, and the session is as it was.
+*/
+zhibernated_t *session_hibernate(zsession_t *session) {
+    zhibernated_t *hibernated, *shrunk;
+    unsigned char *raw;
+    size_t raw_len;
+    int len;
+
+    session_switch(session);
+    raw = snapshot_encode(&raw_len);
+    if (!raw)
+        return NULL;
+    xor_pages(raw, raw_len);
+    hibernated = malloc(sizeof(zhibernated_t) + lz_bound(raw_len));
+    if (!hibernated) {
+        free(raw);
+        return NULL;
+    }
+    len = lz_compress(raw, raw_len, (unsigned char *) (hibernated + 1), lz_bound(raw_len));
+    free(raw);
+    if (len < 0) {
+        free(hibernated);
+        return NULL;
+    }
+    shrunk = realloc(hibernated, sizeof(zhibernated_t) + len);
+    if (shrunk)
+        hibernated = shrunk;
+    hibernated->len = len;
+    hibernated->raw_len = raw_len;
+
+    if (zInput->type == INPUT_LINE)
+        glk_cancel_line_event(mainwin, NULL);
+    if (zInput->type == INPUT_CHAR)
+        glk_cancel_char_event(mainwin);
+    /* the undo ring outlives the arena, not knowing where its stacks were */
+    hibernated->undo = zArena->undo;
+    zArena->undo = NULL;
+    undo_detach(hibernated->undo);
+    session_switch(NULL);
+    hibernated->session = *session;
+
+    zerp_stop();
+    mainwin = statuswin = upperwin = NULL;
+    arena_destroy(session->arena);
+    return hibernated;
+}
+
+/*
+    Bring a hibernated session back, switched in, with the windows it had;
+    hibernated is freed. As with session_fork(), Glk hasn't been asked
+    for the read the game is waiting on (see read_resume()). NULL if it
+    can't be done, leaving hibernated alone.
+*/
+zsession_t *session_wake(zhibernated_t *hibernated) {
+    zsession_t *session;
+    zarena_t *arena;
+    unsigned char *raw;
+
+    raw = malloc(hibernated->raw_len);
+    if (!raw)
+        return NULL;
+    if (lz_decompress((unsigned char *) (hibernated + 1), hibernated->len, raw, hibernated->raw_len) != hibernated->raw_len
+        || !xor_pages(raw, hibernated->raw_len)) {
+        free(raw);
+        return NULL;
+    }
+
+    arena = arena_create(sizeof(zsession_t));
+    if (!arena) {
+        free(raw);
+        return NULL;
+    }
+    session = arena->data;
+    *session = hibernated->session;
+    session->arena = arena;
+    session_switch(session);
+    if (!snapshot_attach(raw, hibernated->raw_len)) {
+        free(raw);
+        /* not session_destroy(): the trace and latencies are still hibernated's */
+        session_switch(NULL);
+        zerp_stop();
+        mainwin = statuswin = upperwin = NULL;
+        arena_destroy(arena);
+        return NULL;
+    }
+    free(raw);
+    if (hibernated->undo) {
+        arena->undo = hibernated->undo;
+        undo_attach(arena->undo);
+        /* every page's next write must go through undo_touch() again */
+        arena_checkpoint();
+    }
+    free(hibernated);
+    return session;
+}
+
+/* Free a hibernated session that won't be woken, with what it carried across (trace, latencies, undo) */
+void hibernate_free(zhibernated_t *hibernated) {
+    if (!hibernated)
+        return;
+    free(hibernated->session.trace);
+    free(hibernated->session.latency);
+    undo_free(hibernated->undo);
+    free(hibernated);
+}
+
+/* XOR each page in the snapshot with the story's: the same call makes the delta and undoes it */
+static int xor_pages(unsigned char *data, size_t len) {
+    zsnapshot_t *header;
+    unsigned char *page;
+    int i, j, at, end;
+
+    header = (zsnapshot_t *) data;
+    if (len < sizeof(zsnapshot_t) || header->pages > ZPAGES
+        || header->pages_at + (size_t) header->pages * ZPAGE_SIZE > len)
+        return FALSE;
+    for (i = 0; i < header->pages; i++) {
+        page = data + header->pages_at + i * ZPAGE_SIZE;
+        at = header->page[i] << ZPAGE_SHIFT;
+        end = at + ZPAGE_SIZE < zFilesize ? at + ZPAGE_SIZE : zFilesize;
+        for (j = 0; at < end; at++, j++)
+            page[j] ^= zGamefile[at];
+    }
+    return TRUE;
+}
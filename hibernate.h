@@ -0,0 +1,28 @@
+/*
+    Zerp: a Z-machine interpreter
+    hibernate.h : putting idle sessions away in as little memory as possible
+*/
+
+#ifndef HIBERNATE_H
+#define HIBERNATE_H
+
+/*
+    A hibernated session: the session as it was switched out (its windows,
+    state and owner's data), and its game as a snapshot (snapshot.c) with
+    each page XORed against the story, compressed (lz.c). The compressed
+    bytes follow the struct, in the same allocation. The undo ring
+    (undo.c) is kept as it was, so that UNDO still works once the session
+    wakes.
+*/
+typedef struct zhibernated {
+    zsession_t session;
+    struct zundo *undo;
+    int len;
+    int raw_len;
+} zhibernated_t;
+
+zhibernated_t *session_hibernate(zsession_t *session);
+zsession_t *session_wake(zhibernated_t *hibernated);
+void hibernate_free(zhibernated_t *hibernated);
+
+#endif /* HIBERNATE_H */
@@ -0,0 +1,272 @@
+/*
+    Zerp: a Z-machine interpreter
+    json.c : just enough JSON for line protocols and reports
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "json.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define JSON_CHUNK 1024
+
+static char *skip_space(char *p);
+static char *skip_string(char *p);
+static char *skip_value(char *p);
+static char *find_member(char *json, char *key);
+static void read_string(char *p, char *value, int len);
+
+/* output */
+
+void json_append(jsonbuf_t *buf, char *text, int len) {
+    char *data;
+    int size;
+
+    if (buf->len + len + 1 > buf->size) {
+        size = ((buf->len + len + 1) / JSON_CHUNK + 1) * JSON_CHUNK;
+        data = realloc(buf->data, size);
+        if (!data)
+            return;
+        buf->data = data;
+        buf->size = size;
+    }
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+void json_printf(jsonbuf_t *buf, char *format, ...) {
+    va_list ap;
+    char small[256], *big;
+    int len;
+
+    va_start(ap, format);
+    len = vsnprintf(small, sizeof(small), format, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+    if (len < sizeof(small)) {
+        json_append(buf, small, len);
+        return;
+    }
+
+    big = malloc(len + 1);
+    if (!big)
+        return;
+    va_start(ap, format);
+    vsnprintf(big, len + 1, format, ap);
+    va_end(ap);
+    json_append(buf, big, len);
+    free(big);
+}
+
+/* a quoted, escaped string. Bytes are taken as Latin-1, which is what Glk gives us. */
+void json_string(jsonbuf_t *buf, char *text, int len) {
+    char esc[8];
+    unsigned char ch;
+    int start, i;
+
+    json_append(buf, "\"", 1);
+    for (start = i = 0; i < len; i++) {
+        ch = (unsigned char) text[i];
+        if (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\')
+            continue;
+        json_append(buf, text + start, i - start);
+        start = i + 1;
+        switch (ch) {
+            case '"': json_append(buf, "\\\"", 2); break;
+            case '\\': json_append(buf, "\\\\", 2); break;
+            case '\n': json_append(buf, "\\n", 2); break;
+            case '\t': json_append(buf, "\\t", 2); break;
+            case '\r': json_append(buf, "\\r", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", ch);
+                json_append(buf, esc, 6);
+                break;
+        }
+    }
+    json_append(buf, text + start, i - start);
+    json_append(buf, "\"", 1);
+}
+
+void json_reset(jsonbuf_t *buf) {
+    buf->len = 0;
+    if (buf->data)
+        buf->data[0] = '\0';
+}
+
+void json_free(jsonbuf_t *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->size = 0;
+}
+
+/* input */
+
+static char *skip_space(char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+    return p;
+}
+
+static char *skip_string(char *p) {
+    for (p++; *p && *p != '"'; p++) {
+        if (*p == '\\' && p[1])
+            p++;
+    }
+    return *p ? p + 1 : p;
+}
+
+static char *skip_value(char *p) {
+    int depth;
+
+    if (*p == '"')
+        return skip_string(p);
+    if (*p != '{' && *p != '[') {
+        while (*p && *p != ',' && *p != '}' && *p != ']')
+            p++;
+        return p;
+    }
+
+    depth = 0;
+    while (*p) {
+        if (*p == '"') {
+            p = skip_string(p);
+            continue;
+        }
+        if (*p == '{' || *p == '[')
+            depth++;
+        if ((*p == '}' || *p == ']') && --depth == 0)
+            return p + 1;
+        p++;
+    }
+    return p;
+}
+
+static char *find_member(char *json, char *key) {
+    char *p, *name;
+    int keylen, match;
+
+    keylen = strlen(key);
+    p = skip_space(json);
+    if (*p++ != '{')
+        return NULL;
+
+    while (TRUE) {
+        p = skip_space(p);
+        if (*p != '"')
+            return NULL;
+        name = p + 1;
+        p = skip_string(p);
+        match = (p - name - 1 == keylen && strncmp(name, key, keylen) == 0);
+        p = skip_space(p);
+        if (*p++ != ':')
+            return NULL;
+        p = skip_space(p);
+        if (match)
+            return p;
+        p = skip_space(skip_value(p));
+        if (*p++ != ',')
+            return NULL;
+    }
+}
+
+int json_get_string(char *json, char *key, char *value, int len) {
+    char *p;
+
+    if (!(p = find_member(json, key)) || *p != '"' || len < 1)
+        return FALSE;
+    read_string(p, value, len);
+    return TRUE;
+}
+
+int json_get_array_string(char *json, char *key, int index, char *value, int len) {
+    char *p;
+    int i;
+
+    if (!(p = find_member(json, key)) || *p != '[' || len < 1)
+        return FALSE;
+    for (p++, i = 0; ; i++) {
+        p = skip_space(p);
+        if (*p == ']' || !*p)
+            return FALSE;
+        if (i == index) {
+            if (*p != '"')
+                return FALSE;
+            read_string(p, value, len);
+            return TRUE;
+        }
+        p = skip_space(skip_value(p));
+        if (*p++ != ',')
+            return FALSE;
+    }
+}
+
+int json_get_number(char *json, char *key, long *value) {
+    char *p, *end;
+
+    if (!(p = find_member(json, key)))
+        return FALSE;
+    *value = strtol(p, &end, 10);
+    return end != p;
+}
+
+int json_get_bool(char *json, char *key, int *value) {
+    char *p;
+
+    if (!(p = find_member(json, key)))
+        return FALSE;
+    if (!strncmp(p, "true", 4)) {
+        *value = TRUE;
+    } else if (!strncmp(p, "false", 5)) {
+        *value = FALSE;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* unescape the string at p into value */
+static void read_string(char *p, char *value, int len) {
+    char hex[5];
+    int out, i;
+    long code;
+
+    for (p++, out = 0; *p && *p != '"'; p++) {
+        if (out >= len - 1)
+            break;
+        if (*p != '\\') {
+            value[out++] = *p;
+            continue;
+        }
+        switch (*++p) {
+            case 'n': value[out++] = '\n'; break;
+            case 't': value[out++] = '\t'; break;
+            case 'r': value[out++] = '\r'; break;
+            case 'b': value[out++] = '\b'; break;
+            case 'f': value[out++] = '\f'; break;
+            case 'u':
+                for (i = 0; i < 4 && p[1] && strchr("0123456789abcdefABCDEF", p[1]); i++)
+                    hex[i] = *++p;
+                hex[i] = '\0';
+                code = strtol(hex, NULL, 16);
+                value[out++] = code < 0x100 ? (char) code : '?';
+                break;
+            case '\0':
+                p--;
+                break;
+            default:
+                value[out++] = *p;
+                break;
+        }
+    }
+    value[out] = '\0';
+}
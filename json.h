@@ -0,0 +1,33 @@
+/*
+    Zerp: a Z-machine interpreter
+    json.h : just enough JSON for line protocols and reports
+*/
+
+#ifndef JSON_H
+#define JSON_H
+
+/* growable output buffer */
+typedef struct jsonbuf {
+    char *data;
+    int len, size;
+} jsonbuf_t;
+
+void json_append(jsonbuf_t *buf, char *text, int len);
+void json_printf(jsonbuf_t *buf, char *format, ...);
+void json_string(jsonbuf_t *buf, char *text, int len);
+void json_reset(jsonbuf_t *buf);
+void json_free(jsonbuf_t *buf);
+
+/*
+    Member lookup in a flat object, e.g. {"type":"line","value":"look"}.
+    Strings are unescaped into value (NUL terminated, truncated to len);
+    characters outside Latin-1 become '?'. json_get_array_string() takes
+    the index'th element of an array of strings. All return FALSE if the
+    key (or element) is missing or has the wrong type.
+*/
+int json_get_string(char *json, char *key, char *value, int len);
+int json_get_array_string(char *json, char *key, int index, char *value, int len);
+int json_get_number(char *json, char *key, long *value);
+int json_get_bool(char *json, char *key, int *value);
+
+#endif /* JSON_H */
@@ -0,0 +1,207 @@
+/*
+    Zerp: a Z-machine interpreter
+    latency.c : how long each turn takes, as histograms
+
+    A turn is what the player waits through: from the read the game was
+    waiting on being answered (read_complete()) to the game asking for
+    the next one, or stopping. Each is timed with the monotonic clock and
+    recorded, with the instructions it ran and the characters it printed
+    (from the counters in stats.c), in the story's histograms, which are
+    for the whole process, and in the current game's, if it has its own.
+    Sessions do, started and stopped with them; zerp's one game is the
+    story's.
+
+    The histograms are HDR style (see latency.h): a fixed array of counts
+    whose buckets widen with the value, so recording is an index and an
+    add, percentiles are read off by walking the counts, and histograms
+    from different games or processes add up bucket by bucket. They are
+    exported as JSON with the usual percentiles and the buckets in use.
+
+    A turn slower than zLatencySlow milliseconds is logged as a line of
+    JSON, where the stats summaries go, with the command that started it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "json.h"
+#include "stats.h"
+#include "latency.h"
+
+zlatency_t *zLatency = NULL;
+int zLatencySlow = LATENCY_SLOW;
+
+static zlatency_t zStoryLatency;
+
+/* the turn being run: only one game runs at a time */
+static int zInTurn = FALSE;
+static struct timespec zTurnStart;
+static unsigned long long zTurnInstructions, zTurnOutput;
+static char zTurnCommand[LATENCY_COMMAND];
+
+static unsigned int hist_index(unsigned long long value);
+static unsigned long long hist_low(unsigned int index);
+static unsigned long long hist_high(unsigned int index);
+static void hist_json(jsonbuf_t *out, zhistogram_t *hist);
+static void latency_slow(unsigned long long us, unsigned long long instructions, unsigned long long output);
+
+/* Give the current game its own histograms, if it hasn't any. FALSE if it can't have them. */
+int latency_start() {
+    if (zLatency)
+        return TRUE;
+    zLatency = calloc(1, sizeof(zlatency_t));
+    return zLatency != NULL;
+}
+
+void latency_stop() {
+    free(zLatency);
+    zLatency = NULL;
+}
+
+/* every turn the process has run */
+zlatency_t *latency_story() {
+    return &zStoryLatency;
+}
+
+/* The game's read has just been answered, with command (len characters), or a key if command is NULL */
+void latency_turn_begin(char *command, int len) {
+    clock_gettime(CLOCK_MONOTONIC, &zTurnStart);
+    zTurnInstructions = zStats->count[STAT_INSTRUCTIONS];
+    zTurnOutput = zStats->count[STAT_CHARS_PRINTED];
+    if (command) {
+        if (len > LATENCY_COMMAND - 1)
+            len = LATENCY_COMMAND - 1;
+        memcpy(zTurnCommand, command, len);
+        zTurnCommand[len] = '\0';
+    } else {
+        snprintf(zTurnCommand, LATENCY_COMMAND, "[key %d]", len);
+    }
+    zInTurn = TRUE;
+}
+
+/* The game wants input again, or has stopped: record the turn (after stats_turn_end() has counted it) */
+void latency_turn_end() {
+    struct timespec now;
+    unsigned long long us, instructions, output;
+
+    if (!zInTurn)
+        return;
+    zInTurn = FALSE;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - zTurnStart.tv_sec) * 1000000ULL + now.tv_nsec / 1000 - zTurnStart.tv_nsec / 1000;
+    /* the counters may have been reset (from the debug monitor) during the turn */
+    instructions = zStats->count[STAT_INSTRUCTIONS] >= zTurnInstructions ? zStats->count[STAT_INSTRUCTIONS] - zTurnInstructions : 0;
+    output = zStats->count[STAT_CHARS_PRINTED] >= zTurnOutput ? zStats->count[STAT_CHARS_PRINTED] - zTurnOutput : 0;
+
+    hist_record(&zStoryLatency.time, us);
+    hist_record(&zStoryLatency.instructions, instructions);
+    hist_record(&zStoryLatency.output, output);
+    if (zLatency) {
+        hist_record(&zLatency->time, us);
+        hist_record(&zLatency->instructions, instructions);
+        hist_record(&zLatency->output, output);
+    }
+    if (zLatencySlow > 0 && us > zLatencySlow * 1000ULL)
+        latency_slow(us, instructions, output);
+}
+
+/* latency's histograms as a JSON object */
+void latency_json(jsonbuf_t *out, zlatency_t *latency) {
+    json_printf(out, "{\"turns\":%llu,\"time_us\":", latency->time.count);
+    hist_json(out, &latency->time);
+    json_printf(out, ",\"instructions\":");
+    hist_json(out, &latency->instructions);
+    json_printf(out, ",\"output\":");
+    hist_json(out, &latency->output);
+    json_append(out, "}", 1);
+}
+
+void hist_record(zhistogram_t *hist, unsigned long long value) {
+    if (value >= HIST_LIMIT)
+        value = HIST_LIMIT - 1;
+    hist->bucket[hist_index(value)]++;
+    hist->count++;
+    hist->total += value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+/* The value percent of those recorded are at or below, to the bucket's precision (0 if there are none) */
+unsigned long long hist_percentile(zhistogram_t *hist, double percent) {
+    unsigned long long wanted, seen;
+    unsigned int i;
+
+    if (!hist->count)
+        return 0;
+    /* the first value at or above that share of them */
+    wanted = (unsigned long long) (percent / 100.0 * hist->count);
+    if (wanted < percent / 100.0 * hist->count || wanted < 1)
+        wanted++;
+    for (i = 0, seen = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->bucket[i];
+        if (seen >= wanted)
+            break;
+    }
+    /* nothing recorded is above the largest value, so don't report past it */
+    return i < HIST_BUCKETS && hist_high(i) < hist->max ? hist_high(i) : hist->max;
+}
+
+/* below HIST_SUB: the value; above, HIST_SUB / 2 buckets for each power of two */
+static unsigned int hist_index(unsigned long long value) {
+    unsigned int top, shift;
+
+    if (value < HIST_SUB)
+        return value;
+    for (top = HIST_SUB_BITS; value >> (top + 1); top++) ;
+    shift = top - (HIST_SUB_BITS - 1);
+    return HIST_SUB + (shift - 1) * (HIST_SUB / 2) + (value >> shift) - HIST_SUB / 2;
+}
+
+/* the lowest and highest values counted in a bucket */
+static unsigned long long hist_low(unsigned int index) {
+    if (index < HIST_SUB)
+        return index;
+    return (unsigned long long) ((index - HIST_SUB) % (HIST_SUB / 2) + HIST_SUB / 2) << ((index - HIST_SUB) / (HIST_SUB / 2) + 1);
+}
+
+static unsigned long long hist_high(unsigned int index) {
+    return index + 1 < HIST_BUCKETS ? hist_low(index + 1) - 1 : HIST_LIMIT - 1;
+}
+
+/* {"count","mean","max", percentiles, "buckets":[[lowest value,count],...]} with only the buckets in use */
+static void hist_json(jsonbuf_t *out, zhistogram_t *hist) {
+    unsigned int i;
+    int first;
+
+    json_printf(out, "{\"count\":%llu,\"mean\":%llu,\"max\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p99.9\":%llu,\"buckets\":[",
+                hist->count, hist->count ? hist->total / hist->count : 0, hist->max,
+                hist_percentile(hist, 50), hist_percentile(hist, 90), hist_percentile(hist, 99), hist_percentile(hist, 99.9));
+    for (i = 0, first = TRUE; i < HIST_BUCKETS; i++) {
+        if (!hist->bucket[i])
+            continue;
+        json_printf(out, "%s[%llu,%u]", first ? "" : ",", hist_low(i), hist->bucket[i]);
+        first = FALSE;
+    }
+    json_append(out, "]}", 2);
+}
+
+static void latency_slow(unsigned long long us, unsigned long long instructions, unsigned long long output) {
+    jsonbuf_t buf;
+
+    memset(&buf, 0, sizeof(buf));
+    json_printf(&buf, "{\"type\":\"slow_turn\"");
+    stats_story(&buf);
+    json_printf(&buf, ",\"turn\":%llu,\"time_us\":%llu,\"instructions\":%llu,\"output\":%llu,\"command\":",
+                zStats->count[STAT_TURNS], us, instructions, output);
+    json_string(&buf, zTurnCommand, strlen(zTurnCommand));
+    json_append(&buf, "}\n", 2);
+    stats_write(&buf);
+    json_free(&buf);
+}
@@ -0,0 +1,55 @@
+/*
+    Zerp: a Z-machine interpreter
+    latency.h : how long each turn takes, as histograms
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*
+    Histogram buckets, HDR style: values below HIST_SUB each have their
+    own, and above that each power of two is split into HIST_SUB / 2, so
+    a value is known to within about 6%. Values of HIST_LIMIT or more
+    are counted as HIST_LIMIT - 1.
+*/
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_LIMIT_BITS 40
+#define HIST_LIMIT      (1ULL << HIST_LIMIT_BITS)
+#define HIST_BUCKETS    (HIST_SUB + (HIST_LIMIT_BITS - HIST_SUB_BITS) * HIST_SUB / 2)
+
+#define LATENCY_SLOW    100     /* ms: turns taking longer are logged */
+#define LATENCY_COMMAND 64      /* how much of the command a slow turn's log keeps */
+
+typedef struct zhistogram {
+    unsigned long long count, total, max;
+    unsigned int bucket[HIST_BUCKETS];
+} zhistogram_t;
+
+/*
+    A game's turns, from the read that started each being answered to
+    the next read: the time taken (in microseconds, of real time: what
+    the player waits), the instructions run and the characters printed.
+*/
+typedef struct zlatency {
+    zhistogram_t time;
+    zhistogram_t instructions;
+    zhistogram_t output;
+} zlatency_t;
+
+/* the current game's turns, or NULL if it has none of its own (sessions keep their own) */
+extern zlatency_t *zLatency;
+
+/* turns slower than this many milliseconds are logged, with their command; 0 logs none */
+extern int zLatencySlow;
+
+int latency_start();
+void latency_stop();
+zlatency_t *latency_story();
+void latency_turn_begin(char *command, int len);
+void latency_turn_end();
+void latency_json(jsonbuf_t *out, zlatency_t *latency);
+void hist_record(zhistogram_t *hist, unsigned long long value);
+unsigned long long hist_percentile(zhistogram_t *hist, double percent);
+
+#endif /* LATENCY_H */
@@ -0,0 +1,144 @@
+/*
+    Zerp: a Z-machine interpreter
+    lz.c : a small, fast LZ77 codec
+
+    Single pass, greedy, with a hash table of where each four bytes were
+    last seen. Good at what hibernation gives it: a mostly zero XOR delta
+    and a stack of small numbers.
+*/
+
+#include <string.h>
+#include "lz.h"
+
+#define LZ_HASH_BITS    12
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_OFFSET   0xffff
+#define LZ_LAST_LITERALS 5      /* the block format ends with at least this many literals */
+#define LZ_MATCH_LIMIT  12      /* and no match starts this close to the end */
+
+static unsigned int read32(unsigned char *p);
+static unsigned char *put_length(unsigned char *op, int n);
+static unsigned char *put_sequence(unsigned char *op, unsigned char *end, unsigned char *literals, int lit_len, int offset, int match_len);
+
+int lz_compress(unsigned char *src, int len, unsigned char *dst, int cap) {
+    int table[1 << LZ_HASH_BITS];
+    unsigned char *op, *end;
+    unsigned int seq;
+    int i, anchor, ref, m, h;
+
+    memset(table, 0xff, sizeof(table));
+    op = dst;
+    end = dst + cap;
+    for (i = anchor = 0; i < len - LZ_MATCH_LIMIT; ) {
+        seq = read32(src + i);
+        h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+        ref = table[h];
+        table[h] = i;
+        if (ref < 0 || i - ref > LZ_MAX_OFFSET || read32(src + ref) != seq) {
+            i++;
+            continue;
+        }
+        for (m = LZ_MIN_MATCH; i + m < len - LZ_LAST_LITERALS && src[i + m] == src[ref + m]; m++) ;
+        op = put_sequence(op, end, src + anchor, i - anchor, i - ref, m);
+        if (!op)
+            return -1;
+        i += m;
+        anchor = i;
+    }
+    op = put_sequence(op, end, src + anchor, len - anchor, 0, 0);
+    return op ? op - dst : -1;
+}
+
+int lz_decompress(unsigned char *src, int len, unsigned char *dst, int cap) {
+    unsigned char *ip, *iend, *op, *oend;
+    int token, lit, match, offset, b;
+
+    ip = src;
+    iend = src + len;
+    op = dst;
+    oend = dst + cap;
+    while (ip < iend) {
+        token = *ip++;
+        lit = token >> 4;
+        if (lit == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                lit += b = *ip++;
+            } while (b == 255);
+        }
+        if (lit > iend - ip || lit > oend - op)
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > op - dst)
+            return -1;
+        match = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                match += b = *ip++;
+            } while (b == 255);
+        }
+        if (match > oend - op)
+            return -1;
+        /* the match may overlap what it's making, so a byte at a time */
+        for (; match; match--, op++)
+            *op = op[-offset];
+    }
+    return op - dst;
+}
+
+static unsigned int read32(unsigned char *p) {
+    unsigned int v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* the bytes after a token for a length of n that didn't fit its nibble */
+static unsigned char *put_length(unsigned char *op, int n) {
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+/* literals, then (unless match_len is 0, which ends the block) a match; NULL if it won't fit before end */
+static unsigned char *put_sequence(unsigned char *op, unsigned char *end, unsigned char *literals, int lit_len, int offset, int match_len) {
+    unsigned char *token;
+
+    if (end - op < 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1)
+        return NULL;
+    token = op++;
+    if (lit_len >= 15) {
+        *token = 15 << 4;
+        op = put_length(op, lit_len - 15);
+    } else {
+        *token = lit_len << 4;
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if (!match_len)
+        return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    match_len -= LZ_MIN_MATCH;
+    if (match_len >= 15) {
+        *token |= 15;
+        op = put_length(op, match_len - 15);
+    } else {
+        *token |= match_len;
+    }
+    return op;
+}
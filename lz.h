@@ -0,0 +1,22 @@
+/*
+    Zerp: a Z-machine interpreter
+    lz.h : a small, fast LZ77 codec
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+/* the most lz_compress() can need for len bytes */
+#define lz_bound(len) ((len) + (len) / 255 + 16)
+
+/*
+    The format is LZ4's block format: a token (literal run length and
+    match length, a nibble each), the literals, then a two-byte offset
+    back into what has been decoded. Both return the length of their
+    output, or -1 if it doesn't fit in cap (or, decompressing, if the
+    input is damaged).
+*/
+int lz_compress(unsigned char *src, int len, unsigned char *dst, int cap);
+int lz_decompress(unsigned char *src, int len, unsigned char *dst, int cap);
+
+#endif /* LZ_H */
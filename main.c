@@ -19,6 +19,12 @@
 #include "glk.h"
 #endif /* TARGET_OS_MAC */
 #include "zerp.h"
+#include "story.h"
+#include "arena.h"
+#include "opcodes.h"
+#include "trace.h"
+#include "json.h"
+#include "stats.h"
 
 /* functions */
 static void show_banner();
@@ -38,26 +44,54 @@ winid_t upperwin = NULL;
 
 void glk_main(void)
 {
-    strid_t      file;
-    struct stat  info;
     char         errbuff[SMALLBUFF];
-  
 
-	/* TODO: Put the window init code somewhere else */
-	glk_stylehint_set(wintype_TextGrid, style_Alert, stylehint_ReverseColor, 1);
-    mainwin = glk_window_open(0, 0, 0, wintype_TextBuffer, 1);
+    open_windows();
     if (!mainwin) {
         return; 
     }
 
-    glk_set_window(mainwin);
-
     if (!zGamefileRef) {
       glk_put_string("No gamefile. Usage: zerp gamefile\n");
       return;
     }
   
-    file = glk_stream_open_file(zGamefileRef, filemode_Read, 0);
+    if (!load_gamefile(zGamefileRef))
+        return;
+
+    /*
+        Gamefile is kept pristine for save compression/restarts. Here we make a copy
+        that we can write to.
+    */
+    story_share();
+    arena_use(arena_create(0));
+    if (!zArena) {
+        strerror_r(errno, errbuff, SMALLBUFF);
+        glk_printf("zerp: %s", errbuff);
+        return;
+    }
+
+    // show_banner();
+    open_windows();
+
+    if (zTraceDecode) {
+        if (zerp_start())
+            trace_decode(zTraceDecode);
+    } else {
+        zerp_run();
+        stats_dump("exit");
+    }
+    
+    arena_destroy(zArena);
+    return;
+}
+
+/* Load the story into zGamefile. Returns FALSE, having said why, on failure. */
+int load_gamefile(frefid_t ref) {
+    strid_t      file;
+    char         errbuff[SMALLBUFF];
+
+    file = glk_stream_open_file(ref, filemode_Read, 0);
     if (file == NULL)
         goto error;
 
@@ -65,57 +99,71 @@ void glk_main(void)
 		zFilesize = glk_stream_get_position(file);
 	    if (zFilesize < 64) {
 	        glk_put_string("This is too small to be a z-code file.\n");
-	        return;
+	        glk_stream_close(file, NULL);
+	        return FALSE;
 	    }
 
 		glk_stream_set_position(file, 0, seekmode_Start);
 		zGamefile = malloc(zFilesize);
-	    zMachine = malloc(zFilesize);
-	    if (!zMachine || !zGamefile)
+	    if (!zGamefile) {
+	        glk_stream_close(file, NULL);
 	        goto error;
+	    }
 		glk_get_buffer_stream(file, (char*)zGamefile, zFilesize);
-    
-    /*
-        Gamefile is kept pristine for save compression/restarts. Here we make a copy
-        that we can write to.
-    */
-    memcpy(zMachine, zGamefile, zFilesize);    
+		glk_stream_close(file, NULL);
 
     // zGamefile = mmap (NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
     // if (zGamefile == MAP_FAILED)
     //     goto error;
 
-    
-    // show_banner();
-	zGameVersion = get_byte(0);
+	zGameVersion = zGamefile[Z_VERSION];
     switch (zGameVersion) {
 			case Z_VERSION_1:
 			case Z_VERSION_2:
 			case Z_VERSION_6:
 			case Z_VERSION_7:
 		        glk_printf("Unsupported version: this file needs version %d.", zGameVersion);
-		        return;
+		        return FALSE;
 				break;
 			default:
 				break;
     }
 
-	/* Provide status line for V3 */
-	if (zGameVersion < Z_VERSION_4) {
-		statuswin = glk_window_open(mainwin, winmethod_Above | winmethod_Fixed, 1, wintype_TextGrid, 0);
-		set_screen_width(statuswin);
-	}
-
-    zerp_run();
-    
-    free(zMachine);
-    // munmap ((void*) zGamefile, info.st_size);
-    return;
+    return TRUE;
 
     error:
         strerror_r(errno, errbuff, SMALLBUFF);
         glk_printf("zerp: %s", errbuff);
-        return;
+        return FALSE;
+}
+
+/* Open the story window, and once the story is known, the V3 status line */
+void open_windows() {
+    if (!mainwin) {
+	    /* TODO: Put the window init code somewhere else */
+	    glk_stylehint_set(wintype_TextGrid, style_Alert, stylehint_ReverseColor, 1);
+        mainwin = glk_window_open(0, 0, 0, wintype_TextBuffer, MAINWIN_ROCK);
+        if (!mainwin)
+            return;
+        glk_set_window(mainwin);
+    }
+
+	/* Provide status line for V3 */
+	if (zGameVersion && zGameVersion < Z_VERSION_4 && !statuswin) {
+		statuswin = glk_window_open(mainwin, winmethod_Above | winmethod_Fixed, 1, wintype_TextGrid, STATUSWIN_ROCK);
+		set_screen_width(statuswin);
+	}
+}
+
+/* Put the screen back the way a new game finds it */
+void reset_windows() {
+    if (upperwin) {
+        glk_window_close(upperwin, NULL);
+        upperwin = NULL;
+    }
+    glk_window_clear(mainwin);
+    if (statuswin)
+        glk_window_clear(statuswin);
 }
 
 static void show_banner() {
@@ -139,6 +187,7 @@ void show_status_line() {
     glk_set_window(statuswin);
     glk_window_clear(statuswin);
 	glk_set_style(style_Alert);
+	stat_glk();
 
     glk_window_get_size(statuswin, &width, &height);
 	for (i = 0; i < width; i++)
@@ -187,22 +236,24 @@ int glk_printf(char *format, ...) {
     
     va_start(ap, format);
     res = vsnprintf(buf, SMALLBUFF, format, ap);
-    if (res >= 0)
+    if (res >= 0) {
         glk_put_string(buf);
+        stat_print(strlen(buf));
+    }
     va_end(ap);
     return res;
 }
 
 void fatal_error(char *message) {
     glk_printf("\nFATAL ERROR: %#04x : %s\n", zPC, message);
+
+    /* unwind to zerp_execute() if we are inside it */
+    zerp_abort();
+
+    stats_dump("fatal");
     
     /* free any space we might have alloc'd */
-    if (zStack)
-        free(zStack);
-    if (zCallStack)
-        free(zCallStack);
-    if (zMachine)
-        free(zMachine);
+    arena_destroy(zArena);
         
     /* And.... done. */    
     glk_exit();
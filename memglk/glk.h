@@ -0,0 +1,209 @@
+/*
+    Zerp: a Z-machine interpreter
+    memglk/glk.h : the subset of the Glk API implemented by memglk
+
+    Constants and types follow Andrew Plotkin's Glk 0.7 specification
+    (http://www.eblong.com/zarf/glk/index.html) so that code written
+    against glkterm or cheapglk compiles unchanged. Only the calls memglk
+    actually provides are declared here.
+*/
+
+#ifndef GLK_H
+#define GLK_H
+
+#define GLK_MODULE_LINE_ECHO
+
+typedef unsigned int glui32;
+typedef signed int glsi32;
+
+typedef struct glk_window_struct *winid_t;
+typedef struct glk_stream_struct *strid_t;
+typedef struct glk_fileref_struct *frefid_t;
+
+#define gestalt_Version (0)
+#define gestalt_CharInput (1)
+#define gestalt_LineInput (2)
+#define gestalt_CharOutput (3)
+#define   gestalt_CharOutput_CannotPrint (0)
+#define   gestalt_CharOutput_ApproxPrint (1)
+#define   gestalt_CharOutput_ExactPrint (2)
+#define gestalt_MouseInput (4)
+#define gestalt_Timer (5)
+#define gestalt_Graphics (6)
+#define gestalt_DrawImage (7)
+#define gestalt_Sound (8)
+#define gestalt_SoundVolume (9)
+#define gestalt_SoundNotify (10)
+#define gestalt_Hyperlinks (11)
+#define gestalt_HyperlinkInput (12)
+#define gestalt_SoundMusic (13)
+#define gestalt_GraphicsTransparency (14)
+#define gestalt_Unicode (15)
+#define gestalt_LineInputEcho (17)
+
+#define evtype_None (0)
+#define evtype_Timer (1)
+#define evtype_CharInput (2)
+#define evtype_LineInput (3)
+#define evtype_MouseInput (4)
+#define evtype_Arrange (5)
+#define evtype_Redraw (6)
+#define evtype_SoundNotify (7)
+#define evtype_Hyperlink (8)
+
+typedef struct event_struct {
+    glui32 type;
+    winid_t win;
+    glui32 val1, val2;
+} event_t;
+
+#define keycode_Unknown  (0xffffffff)
+#define keycode_Left     (0xfffffffe)
+#define keycode_Right    (0xfffffffd)
+#define keycode_Up       (0xfffffffc)
+#define keycode_Down     (0xfffffffb)
+#define keycode_Return   (0xfffffffa)
+#define keycode_Delete   (0xfffffff9)
+#define keycode_Escape   (0xfffffff8)
+#define keycode_Tab      (0xfffffff7)
+#define keycode_PageUp   (0xfffffff6)
+#define keycode_PageDown (0xfffffff5)
+#define keycode_Home     (0xfffffff4)
+#define keycode_End      (0xfffffff3)
+
+#define style_Normal (0)
+#define style_Emphasized (1)
+#define style_Preformatted (2)
+#define style_Header (3)
+#define style_Subheader (4)
+#define style_Alert (5)
+#define style_Note (6)
+#define style_BlockQuote (7)
+#define style_Input (8)
+#define style_User1 (9)
+#define style_User2 (10)
+#define style_NUMSTYLES (11)
+
+typedef struct stream_result_struct {
+    glui32 readcount;
+    glui32 writecount;
+} stream_result_t;
+
+#define wintype_AllTypes (0)
+#define wintype_Pair (1)
+#define wintype_Blank (2)
+#define wintype_TextBuffer (3)
+#define wintype_TextGrid (4)
+#define wintype_Graphics (5)
+
+#define winmethod_Left  (0x00)
+#define winmethod_Right (0x01)
+#define winmethod_Above (0x02)
+#define winmethod_Below (0x03)
+#define winmethod_DirMask (0x0f)
+
+#define winmethod_Fixed (0x10)
+#define winmethod_Proportional (0x20)
+#define winmethod_DivisionMask (0xf0)
+
+#define fileusage_Data (0x00)
+#define fileusage_SavedGame (0x01)
+#define fileusage_Transcript (0x02)
+#define fileusage_InputRecord (0x03)
+#define fileusage_TypeMask (0x0f)
+
+#define fileusage_TextMode   (0x100)
+#define fileusage_BinaryMode (0x000)
+
+#define filemode_Write (0x01)
+#define filemode_Read (0x02)
+#define filemode_ReadWrite (0x03)
+#define filemode_WriteAppend (0x05)
+
+#define seekmode_Start (0)
+#define seekmode_Current (1)
+#define seekmode_End (2)
+
+#define stylehint_Indentation (0)
+#define stylehint_ParaIndentation (1)
+#define stylehint_Justification (2)
+#define stylehint_Size (3)
+#define stylehint_Weight (4)
+#define stylehint_Oblique (5)
+#define stylehint_Proportional (6)
+#define stylehint_TextColor (7)
+#define stylehint_BackColor (8)
+#define stylehint_ReverseColor (9)
+#define stylehint_NUMHINTS (10)
+
+extern void glk_main(void);
+
+extern void glk_exit(void);
+extern void glk_set_interrupt_handler(void (*func)(void));
+extern void glk_tick(void);
+
+extern glui32 glk_gestalt(glui32 sel, glui32 val);
+
+extern unsigned char glk_char_to_lower(unsigned char ch);
+extern unsigned char glk_char_to_upper(unsigned char ch);
+
+extern winid_t glk_window_get_root(void);
+extern winid_t glk_window_open(winid_t split, glui32 method, glui32 size,
+    glui32 wintype, glui32 rock);
+extern void glk_window_close(winid_t win, stream_result_t *result);
+extern void glk_window_get_size(winid_t win, glui32 *widthptr,
+    glui32 *heightptr);
+extern winid_t glk_window_iterate(winid_t win, glui32 *rockptr);
+extern glui32 glk_window_get_rock(winid_t win);
+extern glui32 glk_window_get_type(winid_t win);
+extern strid_t glk_window_get_stream(winid_t win);
+extern void glk_window_clear(winid_t win);
+extern void glk_window_move_cursor(winid_t win, glui32 xpos, glui32 ypos);
+extern void glk_set_window(winid_t win);
+
+extern strid_t glk_stream_open_file(frefid_t fileref, glui32 fmode,
+    glui32 rock);
+extern strid_t glk_stream_open_memory(char *buf, glui32 buflen, glui32 fmode,
+    glui32 rock);
+extern void glk_stream_close(strid_t str, stream_result_t *result);
+extern void glk_stream_set_position(strid_t str, glsi32 pos, glui32 seekmode);
+extern glui32 glk_stream_get_position(strid_t str);
+extern void glk_stream_set_current(strid_t str);
+extern strid_t glk_stream_get_current(void);
+
+extern void glk_put_char(unsigned char ch);
+extern void glk_put_char_stream(strid_t str, unsigned char ch);
+extern void glk_put_string(char *s);
+extern void glk_put_string_stream(strid_t str, char *s);
+extern void glk_put_buffer(char *buf, glui32 len);
+extern void glk_put_buffer_stream(strid_t str, char *buf, glui32 len);
+extern void glk_set_style(glui32 styl);
+extern void glk_set_style_stream(strid_t str, glui32 styl);
+
+extern glsi32 glk_get_char_stream(strid_t str);
+extern glui32 glk_get_line_stream(strid_t str, char *buf, glui32 len);
+extern glui32 glk_get_buffer_stream(strid_t str, char *buf, glui32 len);
+
+extern void glk_stylehint_set(glui32 wintype, glui32 styl, glui32 hint,
+    glsi32 val);
+extern void glk_stylehint_clear(glui32 wintype, glui32 styl, glui32 hint);
+
+extern frefid_t glk_fileref_create_temp(glui32 usage, glui32 rock);
+extern frefid_t glk_fileref_create_by_name(glui32 usage, char *name,
+    glui32 rock);
+extern frefid_t glk_fileref_create_by_prompt(glui32 usage, glui32 fmode,
+    glui32 rock);
+extern void glk_fileref_destroy(frefid_t fref);
+extern void glk_fileref_delete_file(frefid_t fref);
+extern glui32 glk_fileref_does_file_exist(frefid_t fref);
+
+extern void glk_select(event_t *event);
+extern void glk_select_poll(event_t *event);
+
+extern void glk_request_line_event(winid_t win, char *buf, glui32 maxlen,
+    glui32 initlen);
+extern void glk_request_char_event(winid_t win);
+extern void glk_cancel_line_event(winid_t win, event_t *event);
+extern void glk_cancel_char_event(winid_t win);
+
+#endif /* GLK_H */
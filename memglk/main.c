@@ -0,0 +1,103 @@
+/*
+    Zerp: a Z-machine interpreter
+    memglk/main.c : headless entrypoint - commands on stdin, plain text on stdout
+
+    Whenever the game waits for input, everything printed to text buffer
+    windows since the last wait is written to stdout and one line is read
+    from stdin. End of input ends the game.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "glk.h"
+#include "memglk.h"
+#include "../glkstart.h"
+
+#define SCREEN_WIDTH_DEFAULT    80
+#define SCREEN_HEIGHT_DEFAULT   24
+#define INPUT_MAX               256
+
+static void headless_flush(memglk_context_t *ctx);
+static int headless_readline(char *buf, int len);
+static void headless_select(memglk_context_t *ctx);
+static void headless_exit(memglk_context_t *ctx);
+static int headless_prompt(memglk_context_t *ctx, glui32 usage, glui32 fmode, char *buf, int len);
+
+static memglk_hooks_t headless_hooks = { headless_select, headless_exit, headless_prompt };
+
+int main(int argc, char **argv) {
+    glkunix_startup_t startdata;
+    memglk_context_t *ctx;
+
+    ctx = memglk_context_create(SCREEN_WIDTH_DEFAULT, SCREEN_HEIGHT_DEFAULT);
+    if (!ctx) {
+        fprintf(stderr, "%s: unable to create glk context\n", argv[0]);
+        return 1;
+    }
+    memglk_set_hooks(ctx, &headless_hooks, NULL);
+    memglk_set_context(ctx);
+
+    startdata.argc = argc;
+    startdata.argv = argv;
+    if (!glkunix_startup_code(&startdata))
+        return 1;
+
+    glk_main();
+    glk_exit();
+    return 0;
+}
+
+static void headless_flush(memglk_context_t *ctx) {
+    winid_t win;
+    char *text;
+    glui32 len;
+
+    for (win = glk_window_iterate(NULL, NULL); win; win = glk_window_iterate(win, NULL)) {
+        if ((text = memglk_window_text(win, &len)) && len)
+            fwrite(text, 1, len, stdout);
+        memglk_window_consume(win);
+    }
+    fflush(stdout);
+}
+
+static int headless_readline(char *buf, int len) {
+    int n;
+
+    if (!fgets(buf, len, stdin))
+        return -1;
+    n = strlen(buf);
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r'))
+        buf[--n] = '\0';
+    return n;
+}
+
+static void headless_select(memglk_context_t *ctx) {
+    char line[INPUT_MAX];
+    glui32 type;
+    int len;
+
+    headless_flush(ctx);
+    if (!memglk_input_pending(&type))
+        return;
+    if ((len = headless_readline(line, INPUT_MAX)) < 0)
+        return;
+
+    if (type == evtype_LineInput) {
+        memglk_line_input(line, len);
+    } else {
+        memglk_char_input(len ? (unsigned char) line[0] : keycode_Return);
+    }
+}
+
+static void headless_exit(memglk_context_t *ctx) {
+    headless_flush(ctx);
+    exit(0);
+}
+
+static int headless_prompt(memglk_context_t *ctx, glui32 usage, glui32 fmode, char *buf, int len) {
+    headless_flush(ctx);
+    fputs(fmode == filemode_Read ? "\nFile to read: " : "\nFile to write: ", stdout);
+    fflush(stdout);
+    return headless_readline(buf, len) > 0;
+}
@@ -0,0 +1,894 @@
+/*
+    Zerp: a Z-machine interpreter
+    memglk/memglk.c : in-memory Glk - per-session windows, streams and events
+
+    Windows are kept as a flat list rather than the Glk pair window tree:
+    grid windows split their height off the window they were opened from
+    and give it back when they are closed, which is all a Z-machine screen
+    needs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "glk.h"
+#include "memglk.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define EVENT_QUEUE     16
+#define TEXT_CHUNK      1024
+#define FILENAME_MAX_LEN 256
+
+#define STREAM_WINDOW   1
+#define STREAM_MEMORY   2
+#define STREAM_FILE     3
+
+struct glk_window_struct {
+    glui32 rock;
+    glui32 type;
+    glui32 width, height;
+    winid_t split;
+    strid_t str;
+    glui32 style;
+
+    /* text buffer: output not yet consumed by the embedding program */
+    char *text;
+    glui32 textlen, textsize;
+    int cleared;
+
+    /* text grid: width * height cells */
+    char *cells;
+    glui32 curx, cury;
+    int dirty;
+
+    /* pending input */
+    char *line_buf;
+    glui32 line_maxlen;
+    int line_request, char_request;
+
+    winid_t next;
+};
+
+struct glk_stream_struct {
+    glui32 rock;
+    int type;
+    glui32 fmode;
+    winid_t win;
+    char *buf;
+    glui32 buflen, bufpos, bufeof;
+    FILE *file;
+    glui32 readcount, writecount;
+    strid_t next;
+};
+
+struct glk_fileref_struct {
+    glui32 rock;
+    glui32 usage;
+    char *filename;
+    frefid_t next;
+};
+
+struct memglk_context_struct {
+    glui32 width, height;
+    winid_t windows;
+    strid_t streams;
+    frefid_t filerefs;
+    strid_t current;
+    event_t events[EVENT_QUEUE];
+    int event_head, event_count;
+    memglk_hooks_t hooks;
+    void *data;
+};
+
+static memglk_context_t *ctx = NULL;
+static char *base_dir = NULL;
+
+static strid_t stream_new(int type, glui32 fmode, glui32 rock);
+static void stream_delete(strid_t str);
+static void window_put_char(winid_t win, unsigned char ch);
+static void window_put_buffer(winid_t win, char *buf, glui32 len);
+static void queue_event(glui32 type, winid_t win, glui32 val1, glui32 val2);
+
+/* contexts */
+
+memglk_context_t *memglk_context_create(glui32 width, glui32 height) {
+    memglk_context_t *c;
+
+    c = calloc(1, sizeof(memglk_context_t));
+    if (!c)
+        return NULL;
+    c->width = width;
+    c->height = height;
+    return c;
+}
+
+void memglk_context_destroy(memglk_context_t *c) {
+    memglk_context_t *saved;
+    winid_t win;
+    strid_t str;
+    frefid_t fref;
+
+    if (!c)
+        return;
+
+    saved = ctx;
+    ctx = c;
+    while ((win = c->windows)) {
+        c->windows = win->next;
+        free(win->text);
+        free(win->cells);
+        free(win);
+    }
+    while ((str = c->streams)) {
+        c->streams = str->next;
+        if (str->file)
+            fclose(str->file);
+        free(str);
+    }
+    while ((fref = c->filerefs)) {
+        c->filerefs = fref->next;
+        free(fref->filename);
+        free(fref);
+    }
+    ctx = (saved == c) ? NULL : saved;
+    free(c);
+}
+
+void memglk_set_context(memglk_context_t *c) {
+    ctx = c;
+}
+
+memglk_context_t *memglk_get_context() {
+    return ctx;
+}
+
+void memglk_set_hooks(memglk_context_t *c, memglk_hooks_t *hooks, void *data) {
+    if (hooks) {
+        c->hooks = *hooks;
+    } else {
+        memset(&c->hooks, 0, sizeof(memglk_hooks_t));
+    }
+    c->data = data;
+}
+
+void *memglk_get_data(memglk_context_t *c) {
+    return c->data;
+}
+
+/* general functions */
+
+void glk_exit(void) {
+    if (ctx && ctx->hooks.exit)
+        ctx->hooks.exit(ctx);
+    exit(0);
+}
+
+void glk_set_interrupt_handler(void (*func)(void)) {
+}
+
+void glk_tick(void) {
+}
+
+glui32 glk_gestalt(glui32 sel, glui32 val) {
+    switch (sel) {
+        case gestalt_Version:
+            return 0x00000700;
+        case gestalt_LineInput:
+            return (val >= 32 && val < 127) || (val >= 160 && val < 256);
+        case gestalt_CharInput:
+            return (val >= 32 && val < 127) || (val >= 160 && val < 256) || val == keycode_Return;
+        case gestalt_CharOutput:
+            if ((val >= 32 && val < 127) || (val >= 160 && val < 256) || val == '\n')
+                return gestalt_CharOutput_ExactPrint;
+            return gestalt_CharOutput_CannotPrint;
+        case gestalt_LineInputEcho:
+            return TRUE;
+        default:
+            return 0;
+    }
+}
+
+unsigned char glk_char_to_lower(unsigned char ch) {
+    if (ch >= 'A' && ch <= 'Z')
+        return ch + ('a' - 'A');
+    if (ch >= 0xc0 && ch <= 0xde && ch != 0xd7)
+        return ch + 0x20;
+    return ch;
+}
+
+unsigned char glk_char_to_upper(unsigned char ch) {
+    if (ch >= 'a' && ch <= 'z')
+        return ch - ('a' - 'A');
+    if (ch >= 0xe0 && ch <= 0xfe && ch != 0xf7)
+        return ch - 0x20;
+    return ch;
+}
+
+/* windows */
+
+winid_t glk_window_get_root(void) {
+    return ctx->windows;
+}
+
+winid_t glk_window_open(winid_t split, glui32 method, glui32 size, glui32 wintype, glui32 rock) {
+    winid_t win, *tail;
+
+    if (ctx->windows && !split)
+        return NULL;
+    if (wintype != wintype_TextBuffer && wintype != wintype_TextGrid && wintype != wintype_Blank)
+        return NULL;
+
+    win = calloc(1, sizeof(struct glk_window_struct));
+    if (!win)
+        return NULL;
+    win->rock = rock;
+    win->type = wintype;
+    win->split = split;
+
+    if (!split) {
+        win->width = ctx->width;
+        win->height = ctx->height;
+    } else {
+        win->width = split->width;
+        if ((method & winmethod_DivisionMask) == winmethod_Proportional)
+            size = (split->height * size) / 100;
+        if (size > split->height)
+            size = split->height;
+        win->height = size;
+        split->height -= size;
+    }
+
+    if (wintype == wintype_TextGrid) {
+        win->cells = malloc(win->width * win->height + 1);
+        if (!win->cells && win->width * win->height) {
+            free(win);
+            return NULL;
+        }
+        memset(win->cells, ' ', win->width * win->height);
+    }
+
+    win->str = stream_new(STREAM_WINDOW, filemode_Write, 0);
+    if (!win->str) {
+        free(win->cells);
+        free(win);
+        return NULL;
+    }
+    win->str->win = win;
+
+    for (tail = &ctx->windows; *tail; tail = &(*tail)->next) ;
+    *tail = win;
+
+    return win;
+}
+
+void glk_window_close(winid_t win, stream_result_t *result) {
+    winid_t *link, other;
+
+    if (!win)
+        return;
+
+    for (link = &ctx->windows; *link && *link != win; link = &(*link)->next) ;
+    if (!*link)
+        return;
+    *link = win->next;
+
+    /* give our lines back to the window we split from, and orphan anything split from us */
+    for (other = ctx->windows; other; other = other->next) {
+        if (other->split == win)
+            other->split = win->split;
+    }
+    if (win->split)
+        win->split->height += win->height;
+
+    if (result) {
+        result->readcount = win->str->readcount;
+        result->writecount = win->str->writecount;
+    }
+    if (ctx->current == win->str)
+        ctx->current = NULL;
+    stream_delete(win->str);
+    free(win->text);
+    free(win->cells);
+    free(win);
+}
+
+void glk_window_get_size(winid_t win, glui32 *widthptr, glui32 *heightptr) {
+    if (widthptr)
+        *widthptr = win ? win->width : 0;
+    if (heightptr)
+        *heightptr = win ? win->height : 0;
+}
+
+winid_t glk_window_iterate(winid_t win, glui32 *rockptr) {
+    win = win ? win->next : ctx->windows;
+    if (rockptr)
+        *rockptr = win ? win->rock : 0;
+    return win;
+}
+
+glui32 glk_window_get_rock(winid_t win) {
+    return win->rock;
+}
+
+glui32 glk_window_get_type(winid_t win) {
+    return win->type;
+}
+
+strid_t glk_window_get_stream(winid_t win) {
+    return win->str;
+}
+
+void glk_window_clear(winid_t win) {
+    if (!win)
+        return;
+
+    if (win->type == wintype_TextBuffer) {
+        win->textlen = 0;
+        win->cleared = TRUE;
+    } else if (win->type == wintype_TextGrid) {
+        memset(win->cells, ' ', win->width * win->height);
+        win->curx = win->cury = 0;
+        win->dirty = TRUE;
+    }
+}
+
+void glk_window_move_cursor(winid_t win, glui32 xpos, glui32 ypos) {
+    if (!win || win->type != wintype_TextGrid)
+        return;
+    win->curx = xpos;
+    win->cury = ypos;
+}
+
+void glk_set_window(winid_t win) {
+    ctx->current = win ? win->str : NULL;
+}
+
+static void window_put_char(winid_t win, unsigned char ch) {
+    char *text;
+
+    if (win->type == wintype_TextBuffer) {
+        if (win->textlen >= win->textsize) {
+            text = realloc(win->text, win->textsize + TEXT_CHUNK);
+            if (!text)
+                return;
+            win->text = text;
+            win->textsize += TEXT_CHUNK;
+        }
+        win->text[win->textlen++] = ch;
+    } else if (win->type == wintype_TextGrid) {
+        if (ch == '\n') {
+            win->curx = 0;
+            win->cury++;
+            return;
+        }
+        if (win->curx >= win->width) {
+            win->curx = 0;
+            win->cury++;
+        }
+        if (win->cury >= win->height)
+            return;
+        win->cells[win->cury * win->width + win->curx++] = ch;
+        win->dirty = TRUE;
+    }
+}
+
+static void window_put_buffer(winid_t win, char *buf, glui32 len) {
+    char *text;
+    glui32 size;
+
+    if (win->type != wintype_TextBuffer) {
+        while (len--)
+            window_put_char(win, *buf++);
+        return;
+    }
+    if (win->textlen + len > win->textsize) {
+        size = ((win->textlen + len) / TEXT_CHUNK + 1) * TEXT_CHUNK;
+        text = realloc(win->text, size);
+        if (!text)
+            return;
+        win->text = text;
+        win->textsize = size;
+    }
+    memcpy(win->text + win->textlen, buf, len);
+    win->textlen += len;
+}
+
+/* streams */
+
+static strid_t stream_new(int type, glui32 fmode, glui32 rock) {
+    strid_t str;
+
+    str = calloc(1, sizeof(struct glk_stream_struct));
+    if (!str)
+        return NULL;
+    str->type = type;
+    str->fmode = fmode;
+    str->rock = rock;
+    str->next = ctx->streams;
+    ctx->streams = str;
+    return str;
+}
+
+static void stream_delete(strid_t str) {
+    strid_t *link;
+
+    for (link = &ctx->streams; *link && *link != str; link = &(*link)->next) ;
+    if (*link)
+        *link = str->next;
+    if (str->file)
+        fclose(str->file);
+    free(str);
+}
+
+strid_t glk_stream_open_file(frefid_t fileref, glui32 fmode, glui32 rock) {
+    strid_t str;
+    FILE *file;
+    char *mode;
+
+    if (!fileref)
+        return NULL;
+
+    switch (fmode) {
+        case filemode_Write: mode = "wb"; break;
+        case filemode_Read: mode = "rb"; break;
+        case filemode_ReadWrite: mode = "r+b"; break;
+        case filemode_WriteAppend: mode = "ab"; break;
+        default: return NULL;
+    }
+    file = fopen(fileref->filename, mode);
+    if (!file && fmode == filemode_ReadWrite)
+        file = fopen(fileref->filename, "w+b");
+    if (!file)
+        return NULL;
+
+    str = stream_new(STREAM_FILE, fmode, rock);
+    if (!str) {
+        fclose(file);
+        return NULL;
+    }
+    str->file = file;
+    return str;
+}
+
+strid_t glkunix_stream_open_pathname(char *pathname, glui32 textmode, glui32 rock) {
+    struct glk_fileref_struct fref;
+
+    fref.filename = pathname;
+    return glk_stream_open_file(&fref, filemode_Read, rock);
+}
+
+strid_t glk_stream_open_memory(char *buf, glui32 buflen, glui32 fmode, glui32 rock) {
+    strid_t str;
+
+    str = stream_new(STREAM_MEMORY, fmode, rock);
+    if (!str)
+        return NULL;
+    str->buf = buf;
+    str->buflen = buf ? buflen : 0;
+    str->bufeof = (fmode == filemode_Write) ? 0 : str->buflen;
+    return str;
+}
+
+void glk_stream_close(strid_t str, stream_result_t *result) {
+    if (!str || str->type == STREAM_WINDOW)
+        return;
+    if (result) {
+        result->readcount = str->readcount;
+        result->writecount = str->writecount;
+    }
+    if (ctx->current == str)
+        ctx->current = NULL;
+    stream_delete(str);
+}
+
+void glk_stream_set_position(strid_t str, glsi32 pos, glui32 seekmode) {
+    glsi32 base;
+
+    if (!str)
+        return;
+    if (str->type == STREAM_FILE) {
+        fseek(str->file, pos, seekmode == seekmode_End ? SEEK_END : (seekmode == seekmode_Current ? SEEK_CUR : SEEK_SET));
+    } else if (str->type == STREAM_MEMORY) {
+        base = (seekmode == seekmode_End) ? str->bufeof : (seekmode == seekmode_Current ? str->bufpos : 0);
+        pos += base;
+        if (pos < 0)
+            pos = 0;
+        if (pos > str->bufeof)
+            pos = str->bufeof;
+        str->bufpos = pos;
+    }
+}
+
+glui32 glk_stream_get_position(strid_t str) {
+    if (!str)
+        return 0;
+    if (str->type == STREAM_FILE)
+        return ftell(str->file);
+    if (str->type == STREAM_MEMORY)
+        return str->bufpos;
+    return str->writecount;
+}
+
+void glk_stream_set_current(strid_t str) {
+    ctx->current = str;
+}
+
+strid_t glk_stream_get_current(void) {
+    return ctx->current;
+}
+
+void glk_put_char_stream(strid_t str, unsigned char ch) {
+    if (!str || !(str->fmode & filemode_Write))
+        return;
+    str->writecount++;
+    switch (str->type) {
+        case STREAM_WINDOW:
+            window_put_char(str->win, ch);
+            break;
+        case STREAM_MEMORY:
+            if (str->bufpos < str->buflen) {
+                str->buf[str->bufpos++] = ch;
+                if (str->bufpos > str->bufeof)
+                    str->bufeof = str->bufpos;
+            }
+            break;
+        case STREAM_FILE:
+            putc(ch, str->file);
+            break;
+    }
+}
+
+void glk_put_buffer_stream(strid_t str, char *buf, glui32 len) {
+    if (!str || !(str->fmode & filemode_Write))
+        return;
+    switch (str->type) {
+        case STREAM_WINDOW:
+            str->writecount += len;
+            window_put_buffer(str->win, buf, len);
+            break;
+        case STREAM_FILE:
+            str->writecount += len;
+            fwrite(buf, 1, len, str->file);
+            break;
+        default:
+            while (len--)
+                glk_put_char_stream(str, *buf++);
+            break;
+    }
+}
+
+void glk_put_string_stream(strid_t str, char *s) {
+    glk_put_buffer_stream(str, s, strlen(s));
+}
+
+void glk_put_char(unsigned char ch) {
+    glk_put_char_stream(ctx->current, ch);
+}
+
+void glk_put_string(char *s) {
+    glk_put_buffer_stream(ctx->current, s, strlen(s));
+}
+
+void glk_put_buffer(char *buf, glui32 len) {
+    glk_put_buffer_stream(ctx->current, buf, len);
+}
+
+void glk_set_style_stream(strid_t str, glui32 styl) {
+    if (str && str->type == STREAM_WINDOW)
+        str->win->style = styl;
+}
+
+void glk_set_style(glui32 styl) {
+    glk_set_style_stream(ctx->current, styl);
+}
+
+glsi32 glk_get_char_stream(strid_t str) {
+    int ch;
+
+    if (!str || !(str->fmode & filemode_Read))
+        return -1;
+    if (str->type == STREAM_FILE) {
+        if ((ch = getc(str->file)) == EOF)
+            return -1;
+    } else if (str->type == STREAM_MEMORY) {
+        if (str->bufpos >= str->bufeof)
+            return -1;
+        ch = (unsigned char) str->buf[str->bufpos++];
+    } else {
+        return -1;
+    }
+    str->readcount++;
+    return ch;
+}
+
+glui32 glk_get_buffer_stream(strid_t str, char *buf, glui32 len) {
+    glui32 got;
+
+    if (!str || !(str->fmode & filemode_Read))
+        return 0;
+    if (str->type == STREAM_FILE) {
+        got = fread(buf, 1, len, str->file);
+    } else if (str->type == STREAM_MEMORY) {
+        got = str->bufeof - str->bufpos;
+        if (got > len)
+            got = len;
+        memcpy(buf, str->buf + str->bufpos, got);
+        str->bufpos += got;
+    } else {
+        return 0;
+    }
+    str->readcount += got;
+    return got;
+}
+
+glui32 glk_get_line_stream(strid_t str, char *buf, glui32 len) {
+    glui32 got;
+    glsi32 ch;
+
+    if (!len)
+        return 0;
+    for (got = 0; got < len - 1; ) {
+        if ((ch = glk_get_char_stream(str)) < 0)
+            break;
+        buf[got++] = ch;
+        if (ch == '\n')
+            break;
+    }
+    buf[got] = '\0';
+    return got;
+}
+
+void glk_stylehint_set(glui32 wintype, glui32 styl, glui32 hint, glsi32 val) {
+}
+
+void glk_stylehint_clear(glui32 wintype, glui32 styl, glui32 hint) {
+}
+
+/* file references */
+
+static frefid_t fileref_new(char *filename, glui32 usage, glui32 rock) {
+    frefid_t fref;
+    char *name;
+    int len;
+
+    len = strlen(filename) + (base_dir && filename[0] != '/' ? strlen(base_dir) + 1 : 0) + 1;
+    name = malloc(len);
+    fref = calloc(1, sizeof(struct glk_fileref_struct));
+    if (!name || !fref) {
+        free(name);
+        free(fref);
+        return NULL;
+    }
+    if (base_dir && filename[0] != '/') {
+        snprintf(name, len, "%s/%s", base_dir, filename);
+    } else {
+        strcpy(name, filename);
+    }
+    fref->filename = name;
+    fref->usage = usage;
+    fref->rock = rock;
+    fref->next = ctx->filerefs;
+    ctx->filerefs = fref;
+    return fref;
+}
+
+void glkunix_set_base_file(char *filename) {
+    char *slash;
+
+    free(base_dir);
+    base_dir = NULL;
+    if (!filename || !(slash = strrchr(filename, '/')))
+        return;
+    base_dir = malloc(slash - filename + 1);
+    if (!base_dir)
+        return;
+    memcpy(base_dir, filename, slash - filename);
+    base_dir[slash - filename] = '\0';
+}
+
+frefid_t glk_fileref_create_temp(glui32 usage, glui32 rock) {
+    char name[] = "/tmp/memglkXXXXXX";
+    int fd;
+
+    if ((fd = mkstemp(name)) < 0)
+        return NULL;
+    close(fd);
+    return fileref_new(name, usage, rock);
+}
+
+frefid_t glk_fileref_create_by_name(glui32 usage, char *name, glui32 rock) {
+    if (!name || !*name)
+        return NULL;
+    return fileref_new(name, usage, rock);
+}
+
+frefid_t glk_fileref_create_by_prompt(glui32 usage, glui32 fmode, glui32 rock) {
+    char name[FILENAME_MAX_LEN];
+
+    if (!ctx->hooks.prompt || !ctx->hooks.prompt(ctx, usage, fmode, name, FILENAME_MAX_LEN))
+        return NULL;
+    name[FILENAME_MAX_LEN - 1] = '\0';
+    return glk_fileref_create_by_name(usage, name, rock);
+}
+
+void glk_fileref_destroy(frefid_t fref) {
+    frefid_t *link;
+
+    if (!fref)
+        return;
+    for (link = &ctx->filerefs; *link && *link != fref; link = &(*link)->next) ;
+    if (*link)
+        *link = fref->next;
+    free(fref->filename);
+    free(fref);
+}
+
+void glk_fileref_delete_file(frefid_t fref) {
+    if (fref)
+        remove(fref->filename);
+}
+
+glui32 glk_fileref_does_file_exist(frefid_t fref) {
+    FILE *file;
+
+    if (!fref || !(file = fopen(fref->filename, "rb")))
+        return FALSE;
+    fclose(file);
+    return TRUE;
+}
+
+/* events */
+
+static void queue_event(glui32 type, winid_t win, glui32 val1, glui32 val2) {
+    event_t *ev;
+
+    if (ctx->event_count >= EVENT_QUEUE)
+        return;
+    ev = &ctx->events[(ctx->event_head + ctx->event_count++) % EVENT_QUEUE];
+    ev->type = type;
+    ev->win = win;
+    ev->val1 = val1;
+    ev->val2 = val2;
+}
+
+void glk_select(event_t *event) {
+    if (!ctx->event_count && ctx->hooks.select)
+        ctx->hooks.select(ctx);
+    if (!ctx->event_count)
+        glk_exit();
+
+    *event = ctx->events[ctx->event_head];
+    ctx->event_head = (ctx->event_head + 1) % EVENT_QUEUE;
+    ctx->event_count--;
+}
+
+void glk_select_poll(event_t *event) {
+    event->type = evtype_None;
+    event->win = NULL;
+    event->val1 = event->val2 = 0;
+}
+
+void glk_request_line_event(winid_t win, char *buf, glui32 maxlen, glui32 initlen) {
+    if (!win || win->line_request || win->char_request)
+        return;
+    win->line_request = TRUE;
+    win->line_buf = buf;
+    win->line_maxlen = maxlen;
+}
+
+void glk_request_char_event(winid_t win) {
+    if (!win || win->line_request || win->char_request)
+        return;
+    win->char_request = TRUE;
+}
+
+void glk_cancel_line_event(winid_t win, event_t *event) {
+    if (event) {
+        event->type = evtype_None;
+        event->win = NULL;
+        event->val1 = event->val2 = 0;
+    }
+    if (!win || !win->line_request)
+        return;
+    win->line_request = FALSE;
+    if (event) {
+        event->type = evtype_LineInput;
+        event->win = win;
+    }
+}
+
+void glk_cancel_char_event(winid_t win) {
+    if (win)
+        win->char_request = FALSE;
+}
+
+/* memglk input */
+
+int memglk_input_pending(glui32 *type) {
+    winid_t win;
+
+    for (win = ctx->windows; win; win = win->next) {
+        if (win->line_request || win->char_request) {
+            if (type)
+                *type = win->line_request ? evtype_LineInput : evtype_CharInput;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int memglk_line_input(char *text, int len) {
+    winid_t win;
+
+    for (win = ctx->windows; win && !win->line_request; win = win->next) ;
+    if (!win)
+        return FALSE;
+
+    if (len > win->line_maxlen)
+        len = win->line_maxlen;
+    memcpy(win->line_buf, text, len);
+    win->line_request = FALSE;
+
+    /* echo the input as a real screen would */
+    window_put_buffer(win, text, len);
+    window_put_char(win, '\n');
+
+    queue_event(evtype_LineInput, win, len, 0);
+    return TRUE;
+}
+
+int memglk_char_input(glui32 ch) {
+    winid_t win;
+
+    for (win = ctx->windows; win && !win->char_request; win = win->next) ;
+    if (!win)
+        return FALSE;
+
+    win->char_request = FALSE;
+    queue_event(evtype_CharInput, win, ch, 0);
+    return TRUE;
+}
+
+/* memglk output */
+
+char *memglk_window_text(winid_t win, glui32 *len) {
+    if (!win || win->type != wintype_TextBuffer) {
+        *len = 0;
+        return NULL;
+    }
+    *len = win->textlen;
+    return win->text;
+}
+
+char *memglk_window_cells(winid_t win, glui32 *width, glui32 *height) {
+    if (!win || win->type != wintype_TextGrid) {
+        *width = *height = 0;
+        return NULL;
+    }
+    *width = win->width;
+    *height = win->height;
+    return win->cells;
+}
+
+int memglk_window_cleared(winid_t win) {
+    return win && win->cleared;
+}
+
+int memglk_window_dirty(winid_t win) {
+    return win && (win->dirty || win->textlen);
+}
+
+void memglk_window_consume(winid_t win) {
+    if (!win)
+        return;
+    win->textlen = 0;
+    win->cleared = FALSE;
+    win->dirty = FALSE;
+}
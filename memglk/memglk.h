@@ -0,0 +1,56 @@
+/*
+    Zerp: a Z-machine interpreter
+    memglk/memglk.h : in-memory Glk - per-session windows, streams and events
+
+    memglk keeps all of its state in a context rather than in process
+    globals, so one process can host any number of Glk "screens". Every
+    Glk call operates on the current context, selected with
+    memglk_set_context(). Text buffer windows collect their output in a
+    byte buffer and text grid windows are a plain array of cells; nothing
+    is ever rendered; the embedding program drains the windows itself.
+*/
+
+#ifndef MEMGLK_H
+#define MEMGLK_H
+
+typedef struct memglk_context_struct memglk_context_t;
+
+/*
+    Callbacks from memglk into the embedding program. Any of them may be
+    NULL.
+
+    select:  glk_select() was called with an empty event queue. The hook
+             should queue input (memglk_line_input() etc.); if the queue is
+             still empty afterwards glk_exit() is called.
+    exit:    glk_exit() was called. Should not return; if it does the
+             process exits.
+    prompt:  glk_fileref_create_by_prompt() wants a file name. Copy one into
+             buf (at most len bytes, NUL terminated) and return TRUE, or
+             return FALSE to cancel.
+*/
+typedef struct memglk_hooks_struct {
+    void (*select)(memglk_context_t *ctx);
+    void (*exit)(memglk_context_t *ctx);
+    int (*prompt)(memglk_context_t *ctx, glui32 usage, glui32 fmode, char *buf, int len);
+} memglk_hooks_t;
+
+memglk_context_t *memglk_context_create(glui32 width, glui32 height);
+void memglk_context_destroy(memglk_context_t *ctx);
+void memglk_set_context(memglk_context_t *ctx);
+memglk_context_t *memglk_get_context();
+void memglk_set_hooks(memglk_context_t *ctx, memglk_hooks_t *hooks, void *data);
+void *memglk_get_data(memglk_context_t *ctx);
+
+/* input - each returns FALSE if no window of the current context wants it */
+int memglk_line_input(char *text, int len);
+int memglk_char_input(glui32 ch);
+int memglk_input_pending(glui32 *type);
+
+/* output */
+char *memglk_window_text(winid_t win, glui32 *len);
+char *memglk_window_cells(winid_t win, glui32 *width, glui32 *height);
+int memglk_window_cleared(winid_t win);
+int memglk_window_dirty(winid_t win);
+void memglk_window_consume(winid_t win);
+
+#endif /* MEMGLK_H */
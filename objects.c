@@ -11,6 +11,8 @@
 #endif /* TARGET_OS_MAC */
 #include "zerp.h"
 #include "objects.h"
+#include "json.h"
+#include "stats.h"
 
 zobject_v3_t *get_object_v3(int number) {
     if (number == 0 || number > 0xff) {
@@ -59,6 +61,7 @@ zword_t get_property_address_v3(int object, int property) {
     zbyte_t prop_len;
     zword_t prop_ptr;
 
+    stat_add(STAT_PROPERTY_LOOKUPS, 1);
     prop_ptr = object_properties_v3(object);
 
     while (prop_len = get_byte(prop_ptr++)) {
@@ -74,6 +77,7 @@ zword_t get_property_address_v4(int object, int property) {
     zbyte_t prop_len, prop_num;
     zword_t prop_ptr;
 
+    stat_add(STAT_PROPERTY_LOOKUPS, 1);
     prop_ptr = object_properties_v4(object);
 
     while (prop_len = get_byte(prop_ptr++) ) {
@@ -253,14 +257,14 @@ int remove_object_v3(int object) {
     obj_parent = get_object_v3(obj->parent);
 
     if (obj_parent->child == object) {
-        obj_parent->child = obj->sibling;
+        set_object_byte(obj_parent, child, obj->sibling)
     } else {
         for (prev_sibling = obj_parent->child; get_object_v3(prev_sibling)->sibling != object; prev_sibling = get_object_v3(prev_sibling)->sibling) ;
-        get_object_v3(prev_sibling)->sibling = obj->sibling;
+        set_object_byte(get_object_v3(prev_sibling), sibling, obj->sibling)
     }
 
-    obj->parent = 0;
-	obj->sibling = 0;
+    set_object_byte(obj, parent, 0)
+	set_object_byte(obj, sibling, 0)
 
     return 0;
 }
@@ -288,6 +292,7 @@ int remove_object_v4(int object) {
 }
 
 int remove_object(int object) {
+	stat_add(STAT_OBJECT_MOVES, 1);
 	if (zGameVersion < Z_VERSION_4) {
 		remove_object_v3(object);
 	} else {
@@ -304,9 +309,9 @@ int insert_object_v3(int object, int destination) {
     if (obj->parent)
         remove_object_v3(object);
 
-    obj->sibling = dest->child;
-    dest->child = object;
-    obj->parent = destination;
+    set_object_byte(obj, sibling, dest->child)
+    set_object_byte(dest, child, object)
+    set_object_byte(obj, parent, destination)
 
     return destination;
 }
@@ -328,6 +333,7 @@ int insert_object_v4(int object, int destination) {
 }
 
 int insert_object(int object, int destination) {
+	stat_add(STAT_OBJECT_MOVES, 1);
 	if (zGameVersion < Z_VERSION_4) {
 		insert_object_v3(object, destination);
 	} else {
@@ -335,6 +341,59 @@ int insert_object(int object, int destination) {
 	}
 }
 
+/* the object table has no count; by convention it runs up to the first object's properties */
+int object_count() {
+    int count;
+
+	if (zGameVersion < Z_VERSION_4) {
+	    count = (object_property_table_v3(1) - zObjects) / sizeof(zobject_v3_t);
+	    return count > 0xff ? 0xff : count;
+	} else {
+	    count = (object_property_table_v4(1) - zObjects) / sizeof(zobject_v4_t);
+	    return count > 0xffff ? 0xffff : count;
+	}
+}
+
+/* where object's entry is in memory, and its size */
+zword_t object_address(int number, int *size) {
+	if (zGameVersion < Z_VERSION_4) {
+	    *size = sizeof(zobject_v3_t);
+	    return (zword_t) ((unsigned char *) get_object_v3(number) - zMachine);
+	} else {
+	    *size = sizeof(zobject_v4_t);
+	    return (zword_t) ((unsigned char *) get_object_v4(number) - zMachine);
+	}
+}
+
+zword_t object_property_table(int number) {
+	if (zGameVersion < Z_VERSION_4) {
+	    return object_property_table_v3(number);
+	} else {
+	    return object_property_table_v4(number);
+	}
+}
+
+/* the object's short name, decoded into buf rather than printed. Returns its length. */
+int object_name(int number, char *buf, int len) {
+    strid_t str, current;
+    stream_result_t result;
+
+    current = glk_stream_get_current();
+    str = glk_stream_open_memory(buf, len - 1, filemode_Write, 0);
+    if (!str) {
+        buf[0] = '\0';
+        return 0;
+    }
+    glk_stream_set_current(str);
+    print_object_name(number);
+    glk_stream_close(str, &result);
+    glk_stream_set_current(current);
+    if (result.writecount > len - 1)
+        result.writecount = len - 1;
+    buf[result.writecount] = '\0';
+    return result.writecount;
+}
+
 void print_object_name(int number) {
     zword_t prop_table;
     
@@ -367,7 +426,7 @@ int set_attribute_v3(int object, int attribute) {
 
     bit = 1 << -((attribute % 8) - 7);
     obj = get_object_v3(object);
-    obj->attributes[attribute /8] = obj->attributes[attribute / 8] | bit;
+    set_object_byte(obj, attributes[attribute / 8], obj->attributes[attribute / 8] | bit)
     return 1;
 }
 
@@ -377,7 +436,7 @@ int set_attribute_v4(int object, int attribute) {
 
     bit = 1 << -((attribute % 8) - 7);
     obj = get_object_v4(object);
-    obj->attributes[attribute /8] = obj->attributes[attribute / 8] | bit;
+    set_object_byte(obj, attributes[attribute / 8], obj->attributes[attribute / 8] | bit)
     return 1;
 }
 
@@ -395,7 +454,7 @@ int clear_attribute_v3(int object, int attribute) {
 
     bit = 1 << -((attribute % 8) - 7);
     obj = get_object_v3(object);
-    obj->attributes[attribute /8] = obj->attributes[attribute / 8] & ~bit;
+    set_object_byte(obj, attributes[attribute / 8], obj->attributes[attribute / 8] & ~bit)
     return 0;
 }
 
@@ -405,7 +464,7 @@ int clear_attribute_v4(int object, int attribute) {
 
     bit = 1 << -((attribute % 8) - 7);
     obj = get_object_v4(object);
-    obj->attributes[attribute /8] = obj->attributes[attribute / 8] & ~bit;
+    set_object_byte(obj, attributes[attribute / 8], obj->attributes[attribute / 8] & ~bit)
     return 0;
 }
 
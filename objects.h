@@ -29,8 +29,12 @@ typedef struct zobject_v4 {
 #define V4_SHORT_PROP_MASK 0x40
 
 
+/* objects are read through these structs but written with store_byte(), so writes are stamped and hashed */
+#define object_offset(obj_addr, field) ((zword_t) ((unsigned char *) &(obj_addr)->field - zMachine))
+#define set_object_byte(obj_addr, field, value) store_byte(object_offset(obj_addr, field), value)
+
 #define get_object_number_v4(obj_addr, node) ((zword_t)((obj_addr->node[0] << 8) | obj_addr->node[1]))
-#define set_object_number_v4(obj_addr, node, value) obj_addr->node[0] = (value & 0xff00) >> 8; obj_addr->node[1] = value & 0xff;
+#define set_object_number_v4(obj_addr, node, value) set_object_byte(obj_addr, node[0], ((value) & 0xff00) >> 8) set_object_byte(obj_addr, node[1], (value) & 0xff)
 
 /*
 zobject_t *get_object(int number);
@@ -41,6 +45,11 @@ int object_parent(int object);
 int object_sibling(int object);
 int object_child(int object);
 int remove_object(int object);
+int insert_object(int object, int destination);
+int object_count();
+zword_t object_address(int number, int *size);
+zword_t object_property_table(int number);
+int object_name(int number, char *buf, int len);
 void print_object_name(int number);
 int get_attribute(int object, int attribute);
 int set_attribute(int object, int attribute);
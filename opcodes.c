@@ -61,6 +61,8 @@ int decode_instruction(packed_addr_t pc, zinstruction_t *instruction, zoperand_t
         instruction->opcode = instruction->bytes & OPCODE_4BIT;
         if (instruction->count == COUNT_1OP)
             decode_short(&pc, instruction, operands);
+        else
+            operands->type = NONE;
     } else { /* OP_LONG */
         /*
             4.3.2
@@ -107,11 +109,13 @@ inline static int decode_variable(packed_addr_t *pc, zinstruction_t* instruction
 	    while (shift >= 0 && (optype = (*types_ptr >> shift) & 0x3) != 0x3) {
 	        operands->type = optype;
 	        if (optype == LARGE_CONST) {
-	            (operands++)->bytes = get_word((*pc)++);
-	            (*pc)++;
+	            operands->bytes = get_word(*pc);
+	            *pc += 2;
 	        } else {
-	            (operands++)->bytes = (zword_t) get_byte((*pc)++);
+	            operands->bytes = (zword_t) get_byte((*pc)++);
 	        }
+	        operands->kind = operand_kind(optype, operands->bytes);
+	        operands++;
 	        shift = shift - 2; opcount++;
 	    }
 		types_ptr++;
@@ -135,16 +139,18 @@ inline static int decode_short(packed_addr_t *pc, zinstruction_t *instruction, z
     operands->type = optype;
     switch (optype) {
         case LARGE_CONST:
-            (operands++)->bytes = get_word((*pc)++);
-            (*pc)++;
+            operands->bytes = get_word(*pc);
+            *pc += 2;
             break;
         case SMALL_CONST:
-            (operands++)->bytes = get_byte((*pc)++);
+            operands->bytes = get_byte((*pc)++);
             break;
         case VARIABLE:
-            (operands++)->bytes = (zword_t) get_byte((*pc)++);
+            operands->bytes = (zword_t) get_byte((*pc)++);
             break;
     }
+    operands->kind = operand_kind(optype, operands->bytes);
+    operands++;
     
     /* tag the end of the operand list with NONE type */
     operands->type = NONE;
@@ -169,7 +175,9 @@ inline static int decode_long(packed_addr_t *pc, zinstruction_t *instruction, zo
         } else {
             operands->type = SMALL_CONST;
         }
-        (operands++)->bytes = (zword_t) get_byte((*pc)++);
+        operands->bytes = (zword_t) get_byte((*pc)++);
+        operands->kind = operand_kind(operands->type, operands->bytes);
+        operands++;
     }
     /* tag the end of the operand list with NONE type */
     operands->type = NONE;
@@ -221,10 +229,10 @@ int decode_store_and_branch(packed_addr_t *pc, zinstruction_t *instruction, zwor
 					}
                 case SAVE:
                 case RESTORE:
-					if (zGameVersion < Z_VERSION_3) {
+					if (zGameVersion < Z_VERSION_4) {
 						decode_branch_op(pc, instruction, branch);
 					} else if (zGameVersion == Z_VERSION_4) {
-						decode_store_op(pc, instruction, branch);
+						decode_store_op(pc, instruction, store);
 					} else {
 						/* Illegal */
 					}
@@ -303,6 +311,24 @@ int decode_store_and_branch(packed_addr_t *pc, zinstruction_t *instruction, zwor
     }
 }
 
+/*
+    The result of the SAVE whose branch (V3) or store byte (V4 on) is at
+    pc, for carrying on after a RESTORE. Returns its length.
+*/
+int decode_save_result(packed_addr_t pc, zword_t *store, zbranch_t *branch) {
+    zinstruction_t instruction;
+    packed_addr_t start;
+
+    memset(&instruction, 0, sizeof(zinstruction_t));
+    start = pc;
+    if (zGameVersion < Z_VERSION_4) {
+        decode_branch_op(&pc, &instruction, branch);
+    } else {
+        decode_store_op(&pc, &instruction, store);
+    }
+    return pc - start;
+}
+
 static void decode_branch_op(packed_addr_t *pc, zinstruction_t *instruction, zbranch_t *branch) {
     int branch_short, branch_long;
     
@@ -504,7 +530,7 @@ static void print_variable(zbyte_t number, int flags) {
     }
 }
 
-static char * opcode_name(char *buf, zbyte_t opcount, zbyte_t opcode) {
+char *opcode_name(char *buf, zbyte_t opcount, zbyte_t opcode) {
     switch (opcount) {
         case COUNT_2OP:
             switch (opcode) {
@@ -647,6 +673,7 @@ static char * opcode_name(char *buf, zbyte_t opcount, zbyte_t opcode) {
                 case CHECK_UNICODE: strcpy(buf, "CHECK_UNICODE"); break;
 				default: strcpy(buf, "UNKNOWN"); break;
 			}
+			break;
         default:
             strcpy(buf, "UNKNOWN"); break;
     }
@@ -15,9 +15,15 @@ typedef struct zinstruction {
     zbyte_t branch_flag;
 } zinstruction_t;
 
+/*
+    kind is worked out from type and bytes as the operand is decoded, so
+    taking its value is one switch: a constant, a pop, or a local or
+    global read straight from its slot (see operand_value()).
+*/
 typedef struct zoperand {
     zword_t bytes;
     zbyte_t type;
+    zbyte_t kind;
 } zoperand_t;
 
 typedef struct zbranch {
@@ -28,6 +34,7 @@ typedef struct zbranch {
 } zbranch_t;
     
 int decode_instruction(packed_addr_t pc, zinstruction_t *instruction, zoperand_t *operands, zword_t *store, zbranch_t *branch);
+int decode_save_result(packed_addr_t pc, zword_t *store, zbranch_t *branch);
 void print_zinstruction(packed_addr_t instructionPC, zinstruction_t *instruction, zoperand_t *operands,
     zword_t *store_operand, zbranch_t *branch_operand, int flags);
 inline static int decode_variable(packed_addr_t *pc, zinstruction_t *instruction, zbyte_t optypes, zoperand_t *operands);
@@ -36,7 +43,7 @@ inline static int decode_long(packed_addr_t *pc, zinstruction_t *instruction, zo
 static int decode_store_branch(packed_addr_t *pc, zinstruction_t *instruction);
 static void decode_branch_op(packed_addr_t *pc, zinstruction_t *instruction, zbranch_t *branch);
 static void decode_store_op(packed_addr_t *pc, zinstruction_t *instruction, zword_t *store);
-static char * opcode_name(char *buf, zbyte_t opcount, zbyte_t opcode);
+char *opcode_name(char *buf, zbyte_t opcount, zbyte_t opcode);
 static void print_variable(zbyte_t number, int flags);
 static void print_operand(zoperand_t *op_ptr);
 static void print_operand_list(zoperand_t *op_ptr);
@@ -48,6 +55,14 @@ static void print_operand_list(zoperand_t *op_ptr);
 #define VARIABLE            0x2
 #define NONE                0x3
 
+#define OPERAND_CONST       0x0
+#define OPERAND_STACK       0x1
+#define OPERAND_LOCAL       0x2
+#define OPERAND_GLOBAL      0x3
+
+#define operand_kind(type, value) ((type) != VARIABLE ? OPERAND_CONST : \
+    ((value) == 0 ? OPERAND_STACK : ((value) < 0x10 ? OPERAND_LOCAL : OPERAND_GLOBAL)))
+
 #define OP_VARIABLE         0x3
 #define OP_SHORT            0x2
 #define OP_EXTENDED         0xbe
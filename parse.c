@@ -12,27 +12,72 @@
 #include "zerp.h"
 #include "zscii.h"
 #include "parse.h"
+#include "variables.h"
+#include "story.h"
+#include "json.h"
+#include "stats.h"
+#include "latency.h"
 
-zword_t read(zword_t input_buffer, zword_t parse_buffer) {
-	zbyte_t input_len, parse_len;
-	zword_t input_ptr;
-	int gotline, len;
-	char buffer[257];
-	char *cx, *cmd;
+/*
+    Reads are split in two so the interpreter can stop while it waits. The
+    request records what the game asked for and asks Glk for the input;
+    read_complete() collects the Glk event and finishes the opcode.
+*/
+void read_line_request(zword_t input_buffer, zword_t parse_buffer, int store_flag, zbyte_t store) {
+	zInput->type = INPUT_LINE;
+	zInput->text = input_buffer;
+	zInput->parse = parse_buffer;
+	zInput->store_flag = store_flag;
+	zInput->store = store;
+
+	glk_request_line_event(mainwin, zInput->buffer, get_byte(input_buffer), 0);
+	stat_glk();
+}
+
+void read_char_request(zword_t device, zbyte_t store) {
+	zInput->type = INPUT_CHAR;
+	zInput->store_flag = TRUE;
+	zInput->store = store;
+
+	glk_request_char_event(mainwin);
+	stat_glk();
+}
+
+/* ask Glk again for the read in zInput, for a game put back by snapshot_attach() */
+void read_resume() {
+	if (zInput->type == INPUT_LINE) {
+		glk_request_line_event(mainwin, zInput->buffer, get_byte(zInput->text), 0);
+	} else if (zInput->type == INPUT_CHAR) {
+		glk_request_char_event(mainwin);
+	}
+}
+
+void read_complete() {
 	event_t ev;
-	
-	input_len = get_byte(input_buffer);
-	parse_len = get_byte(parse_buffer);
-	
-	glk_request_line_event(mainwin, buffer, input_len, 0);
-    gotline = FALSE;
-    while (!gotline) {
-        glk_select(&ev);
-        if (ev.type == evtype_LineInput)
-            gotline = TRUE;
-    }
+	glui32 wanted;
+
+	wanted = (zInput->type == INPUT_LINE) ? evtype_LineInput : evtype_CharInput;
+	do {
+		glk_select(&ev);
+		stat_glk();
+	} while (ev.type != wanted);
+	latency_turn_begin(wanted == evtype_LineInput ? zInput->buffer : NULL, ev.val1);
 
-    len = ev.val1;
+	zInput->type = INPUT_NONE;
+	if (wanted == evtype_LineInput) {
+		zInput->buffer[ev.val1] = '\0';
+		store_input(zInput->text, zInput->parse, zInput->buffer, ev.val1);
+		if (zInput->store_flag)
+			variable_set(zInput->store, 0xa);
+	} else {
+		variable_set(zInput->store, ev.val1);
+	}
+}
+
+/* copy a line of input into the game's text buffer and tokenise it */
+void store_input(zword_t input_buffer, zword_t parse_buffer, char *buffer, int len) {
+	zword_t input_ptr;
+	char *cx, *cmd;
 
     for (cx = buffer; *cx; cx++) { 
         *cx = glk_char_to_lower(*cx);
@@ -68,24 +113,6 @@ zword_t read(zword_t input_buffer, zword_t parse_buffer) {
 	
 	if (zGameVersion < Z_VERSION_5 || parse_buffer)
 		tokenise(input_buffer, parse_buffer, 0, 0);
-	
-	return 0xa;
-}
-
-zbyte_t read_char(zword_t device) {
-	int gotchar;
-	event_t ev;
-
-
-	glk_request_char_event(mainwin);
-    gotchar = FALSE;
-    while (!gotchar) {
-        glk_select(&ev);
-        if (ev.type == evtype_CharInput)
-            gotchar = TRUE;
-    }
-
-	return ev.val1;
 }
 
 void tokenise(zword_t text, zword_t parse_buffer, zword_t dictionary, zword_t flag) {
@@ -95,6 +122,7 @@ void tokenise(zword_t text, zword_t parse_buffer, zword_t dictionary, zword_t fl
 	zword_t zstring[3];
 	int char_count, done, token_found, sep_found;
 	
+	stat_add(STAT_LINES_TOKENISED, 1);
 	pbufftmp = parse_buffer;
 	max_tokens = get_byte(parse_buffer++);
 	parse_buffer++; /* space for total tokens found */
@@ -227,9 +255,17 @@ void encode_zstring(char *token_buffer, int buf_len, zword_t *zstring, int zstri
 }
 
 zword_t lookup_entry(zword_t *zstring) {
-	zword_t word, total_entries;
+	zword_t word, total_entries, entry;
 	zbyte_t entry_length;
 
+	stat_add(STAT_DICT_LOOKUPS, 1);
+	if (zDictIndex) {
+		entry = story_lookup(zstring, zGameVersion < Z_VERSION_4 ? DICT_RESOLUTION_V3 : DICT_RESOLUTION_V4);
+		if (!entry)
+			stat_add(STAT_DICT_MISSES, 1);
+		return entry;
+	}
+
 	entry_length = get_byte(zDictionaryHeader + get_byte(zDictionaryHeader) + 1);
 	total_entries = get_word(zDictionaryHeader + get_byte(zDictionaryHeader) + 2);
 	/* Do a linear search - faster algo to come */
@@ -240,5 +276,6 @@ zword_t lookup_entry(zword_t *zstring) {
 		}
 	}
 
+	stat_add(STAT_DICT_MISSES, 1);
 	return 0;
 }
\ No newline at end of file
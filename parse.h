@@ -6,7 +6,11 @@
 #define DICT_RESOLUTION_V3		2
 #define DICT_RESOLUTION_V4		3
 
-zword_t read(zword_t input_buffer, zword_t parse_buffer);
+void read_line_request(zword_t input_buffer, zword_t parse_buffer, int store_flag, zbyte_t store);
+void read_char_request(zword_t device, zbyte_t store);
+void read_resume();
+void read_complete();
+void store_input(zword_t input_buffer, zword_t parse_buffer, char *buffer, int len);
 void tokenise(zword_t text, zword_t parse_buffer, zword_t dictionary, zword_t flag);
 int check_separator(zword_t separators, zbyte_t total, zbyte_t value);
 void encode_zstring(char *token_buffer, int buf_len, zword_t *zstring, int zstring_len);
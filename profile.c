@@ -0,0 +1,327 @@
+/*
+    Zerp: a Z-machine interpreter
+    profile.c : counting where a game spends its instructions
+
+    With -DZPROFILE and zProfiling set, every instruction is counted by
+    its (operand count, opcode) and charged to the routine it runs in,
+    found from the current frame's routine address. A call stamps its
+    frame with the instruction count so far (frame->entry), and the
+    return works out the routine's inclusive count from it. With
+    zProfileCycles the clock is read whenever the running routine
+    changes, so each routine also gets the cycles spent in its own code.
+
+    The counts are for the whole process, over all its games. A frame
+    entered before counting started has no stamp, and one stamped before
+    the last reset is told by its stamp; neither adds anything inclusive.
+    Undo and restore, which put back frames as they were, are caught by
+    the check on the frame's routine.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "opcodes.h"
+#include "profile.h"
+#include "debuginfo.h"
+
+#define PROFILE_GROW    256     /* routines to start with; a power of two */
+
+int zProfiling = FALSE;
+int zProfileCycles = FALSE;
+unsigned long long zProfileCount = 0;
+char *zProfileFile = NULL;
+
+static unsigned long long zProfileStart = 0;
+static unsigned long long zOpcodeCounts[PROFILE_COUNTS][256];
+static zprofile_routine_t *zRoutineTable = NULL;
+static int zRoutineSpace = 0, zRoutineCount = 0;
+
+/* the routine being charged, and the frame it was found from */
+static zprofile_routine_t *zCurrent = NULL;
+static zstack_frame_t *zCurrentFrame = NULL;
+static unsigned long long zClock = 0;
+
+static zprofile_routine_t *routine_find(packed_addr_t address);
+static void routine_switch();
+static int outer_live(zprofile_routine_t *routine, zstack_frame_t *frame);
+static unsigned long long profile_clock();
+static int by_exclusive(const void *a, const void *b);
+
+void profile_instruction(zbyte_t count, zbyte_t opcode) {
+    zOpcodeCounts[count][opcode]++;
+    zProfileCount++;
+    if (zFP != zCurrentFrame || !zCurrent || zCurrent->address != zFP->routine)
+        routine_switch();
+    if (zCurrent)
+        zCurrent->exclusive++;
+}
+
+/* frame has just been entered */
+void profile_call(zstack_frame_t *frame) {
+    zprofile_routine_t *routine;
+
+    /* 0 is "no stamp"; the call itself has been counted, so that's once in 2^32 calls at most */
+    frame->entry = (unsigned int) zProfileCount;
+    routine = routine_find(frame->routine);
+    if (!routine)
+        return;
+    routine->calls++;
+    if (!outer_live(routine, frame)) {
+        routine->outer = frame;
+        routine->outer_entry = frame->entry;
+    }
+}
+
+/* frame is about to be left */
+void profile_return(zstack_frame_t *frame) {
+    zprofile_routine_t *routine;
+    unsigned int ran;
+
+    if (!frame->entry)
+        return;
+    ran = (unsigned int) zProfileCount - frame->entry;
+    routine = routine_find(frame->routine);
+    /* a stamp from before the reset seems to have run more than everything since */
+    if (routine && routine->outer == frame && routine->outer_entry == frame->entry) {
+        if (ran <= zProfileCount - zProfileStart)
+            routine->inclusive += ran;
+        routine->outer = NULL;
+    }
+    frame->entry = 0;
+}
+
+/* Start counting again from nothing */
+void profile_reset() {
+    memset(zOpcodeCounts, 0, sizeof(zOpcodeCounts));
+    zProfileStart = zProfileCount;
+    zRoutineCount = 0;
+    if (zRoutineTable)
+        memset(zRoutineTable, 0, zRoutineSpace * sizeof(zprofile_routine_t));
+    zCurrent = NULL;
+    zCurrentFrame = NULL;
+}
+
+/* instructions counted since the last reset */
+unsigned long long profile_count() {
+    return zProfileCount - zProfileStart;
+}
+
+unsigned long long profile_opcode(zbyte_t count, int opcode) {
+    return count < PROFILE_COUNTS && opcode >= 0 && opcode < 256 ? zOpcodeCounts[count][opcode] : 0;
+}
+
+/* Every routine seen, most exclusive instructions first, in a malloc()ed array. Returns how many, or -1. */
+int profile_routines(zprofile_routine_t ***sorted) {
+    int i, n;
+
+    *sorted = malloc((zRoutineCount ? zRoutineCount : 1) * sizeof(zprofile_routine_t *));
+    if (!*sorted)
+        return -1;
+    for (i = n = 0; i < zRoutineSpace; i++) {
+        if (zRoutineTable[i].calls || zRoutineTable[i].exclusive || zRoutineTable[i].inclusive)
+            (*sorted)[n++] = &zRoutineTable[i];
+    }
+    qsort(*sorted, n, sizeof(zprofile_routine_t *), by_exclusive);
+    return n;
+}
+
+/*
+    What to call the routine at address in a report: its name from the
+    debugging information if there is any, otherwise its address. The
+    outermost frame starts at the initial pc, not at a routine.
+*/
+char *profile_name(packed_addr_t address, char *buf, int len) {
+    char *name;
+
+    if (!address) {
+        snprintf(buf, len, "?");
+    } else if ((name = debuginfo_name(address))) {
+        snprintf(buf, len, "%s", name);
+    } else if (zGamefile && address == (zGamefile[PC_INITIAL] << 8 | zGamefile[PC_INITIAL + 1])) {
+        name = debuginfo_name(debuginfo_routine_at(address));
+        snprintf(buf, len, "%s", name ? name : "main");
+    } else {
+        snprintf(buf, len, "r%05x", address);
+    }
+    return buf;
+}
+
+/* The busiest opcodes and routines (limit of each, 0 for all), as text */
+void profile_report(FILE *out, int limit) {
+    zprofile_routine_t **routines;
+    int count, opcode, shown, i, n;
+    unsigned long long most, under, total;
+    char name[64];
+
+    total = profile_count();
+    fprintf(out, "%llu instructions, %d routines\n\nopcodes:\n", total, zRoutineCount);
+    /* largest first, without sorting: pick the largest count under the last one shown */
+    for (shown = 0, under = ~0ULL; !limit || shown < limit; under = most) {
+        most = 0;
+        for (count = 0; count < PROFILE_COUNTS; count++) {
+            for (opcode = 0; opcode < 256; opcode++) {
+                if (zOpcodeCounts[count][opcode] < under && zOpcodeCounts[count][opcode] > most)
+                    most = zOpcodeCounts[count][opcode];
+            }
+        }
+        if (!most)
+            break;
+        for (count = 0; count < PROFILE_COUNTS; count++) {
+            for (opcode = 0; opcode < 256 && (!limit || shown < limit); opcode++) {
+                if (zOpcodeCounts[count][opcode] != most)
+                    continue;
+                fprintf(out, "%14llu %6.2f%%  %s\n", most, 100.0 * most / total,
+                        opcode_name(name, count, opcode));
+                shown++;
+            }
+        }
+    }
+
+    n = profile_routines(&routines);
+    if (n < 0)
+        return;
+    fprintf(out, "\nroutines:        calls      inclusive      exclusive   excl%%%s\n", zProfileCycles ? "         cycles" : "");
+    for (i = 0; i < n && (!limit || i < limit); i++) {
+        fprintf(out, "%-10s %12lu %14llu %14llu %6.2f%%", profile_name(routines[i]->address, name, sizeof(name)),
+                routines[i]->calls, routines[i]->inclusive, routines[i]->exclusive,
+                total ? 100.0 * routines[i]->exclusive / total : 0.0);
+        if (zProfileCycles)
+            fprintf(out, " %14llu", routines[i]->cycles);
+        fputc('\n', out);
+    }
+    free(routines);
+}
+
+/* Everything, one row per opcode and per routine */
+void profile_csv(FILE *out) {
+    zprofile_routine_t **routines;
+    int count, opcode, i, n;
+    char name[64];
+
+    fprintf(out, "kind,name,address,count,calls,inclusive,exclusive,cycles\n");
+    for (count = 0; count < PROFILE_COUNTS; count++) {
+        for (opcode = 0; opcode < 256; opcode++) {
+            if (zOpcodeCounts[count][opcode])
+                fprintf(out, "opcode,%s,,%llu,,,,\n", opcode_name(name, count, opcode), zOpcodeCounts[count][opcode]);
+        }
+    }
+    n = profile_routines(&routines);
+    for (i = 0; i < n; i++) {
+        fprintf(out, "routine,%s,%u,,%lu,%llu,%llu,%llu\n", profile_name(routines[i]->address, name, sizeof(name)),
+                routines[i]->address, routines[i]->calls, routines[i]->inclusive, routines[i]->exclusive,
+                routines[i]->cycles);
+    }
+    if (n >= 0)
+        free(routines);
+}
+
+/* The report to filename and the CSV to filename.csv. FALSE if either can't be written. */
+int profile_save(char *filename) {
+    char *csv;
+    FILE *out;
+    int ok;
+
+    out = fopen(filename, "w");
+    if (!out)
+        return FALSE;
+    profile_report(out, 0);
+    ok = !fclose(out);
+
+    csv = malloc(strlen(filename) + 5);
+    if (!csv)
+        return FALSE;
+    sprintf(csv, "%s.csv", filename);
+    out = fopen(csv, "w");
+    free(csv);
+    if (!out)
+        return FALSE;
+    profile_csv(out);
+    return !fclose(out) && ok;
+}
+
+/* The routine's entry, made if it's new; NULL only if the table can't grow */
+static zprofile_routine_t *routine_find(packed_addr_t address) {
+    zprofile_routine_t *table, *old;
+    int i, space, old_space;
+
+    if (zRoutineCount * 2 >= zRoutineSpace) {
+        space = zRoutineSpace ? zRoutineSpace * 2 : PROFILE_GROW;
+        table = calloc(space, sizeof(zprofile_routine_t));
+        if (!table)
+            return NULL;
+        old = zRoutineTable;
+        old_space = zRoutineSpace;
+        zRoutineTable = table;
+        zRoutineSpace = space;
+        zRoutineCount = 0;
+        for (i = 0; i < old_space; i++) {
+            if (old[i].address || old[i].calls || old[i].exclusive) {
+                *routine_find(old[i].address) = old[i];
+            }
+        }
+        free(old);
+        zCurrent = NULL;
+        zCurrentFrame = NULL;
+    }
+
+    for (i = (address * 2654435761U) & (zRoutineSpace - 1); ; i = (i + 1) & (zRoutineSpace - 1)) {
+        if (zRoutineTable[i].address == address && (address || zRoutineTable[i].calls || zRoutineTable[i].exclusive))
+            return &zRoutineTable[i];
+        if (!zRoutineTable[i].address && !zRoutineTable[i].calls && !zRoutineTable[i].exclusive)
+            break;
+    }
+    zRoutineTable[i].address = address;
+    zRoutineCount++;
+    return &zRoutineTable[i];
+}
+
+/* Is the routine already running further down the current game's stack, under frame? */
+static int outer_live(zprofile_routine_t *routine, zstack_frame_t *frame) {
+    zstack_frame_t *outer = routine->outer;
+
+    return outer && outer >= zCallStack && outer < frame
+        && outer->routine == routine->address && outer->entry == routine->outer_entry;
+}
+
+/* A different routine is running: charge the old one its time, and look up the new one */
+static void routine_switch() {
+    unsigned long long now;
+
+    if (zProfileCycles) {
+        now = profile_clock();
+        if (zCurrent && zClock)
+            zCurrent->cycles += now - zClock;
+        zClock = now;
+    }
+    zCurrent = routine_find(zFP->routine);
+    zCurrentFrame = zFP;
+}
+
+static unsigned long long profile_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static int by_exclusive(const void *a, const void *b) {
+    const zprofile_routine_t *x = *(const zprofile_routine_t **) a, *y = *(const zprofile_routine_t **) b;
+
+    if (x->exclusive != y->exclusive)
+        return x->exclusive < y->exclusive ? 1 : -1;
+    return x->address < y->address ? -1 : x->address > y->address;
+}
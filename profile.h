@@ -0,0 +1,61 @@
+/*
+    Zerp: a Z-machine interpreter
+    profile.h : counting where a game spends its instructions
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define PROFILE_COUNTS  5       /* COUNT_0OP .. COUNT_EXT */
+
+/*
+    One routine's totals; inclusive counts what it called, exclusive
+    doesn't. A recursive routine's inclusive count is taken from its
+    outermost call, which outer (and outer_entry, its stamp) remember.
+*/
+typedef struct zprofile_routine {
+    packed_addr_t address;
+    unsigned long calls;
+    unsigned long long inclusive;
+    unsigned long long exclusive;
+    unsigned long long cycles;
+    zstack_frame_t *outer;
+    unsigned int outer_entry;
+} zprofile_routine_t;
+
+/* set to count (with -DZPROFILE), for every game in the process */
+extern int zProfiling;
+/* also time each routine, in TSC cycles (or nanoseconds where there's no TSC) */
+extern int zProfileCycles;
+/* instructions counted, ever; profile_count() has those since the last reset */
+extern unsigned long long zProfileCount;
+/* set (e.g. from the command line) to write the profile there as the game ends */
+extern char *zProfileFile;
+
+/*
+    Hooks in zerp_execute(), call_zroutine() and return_zroutine(),
+    compiled in only with -DZPROFILE, like the tracepoints in trace.h.
+*/
+#ifdef ZPROFILE
+#define profile_begin(count, opcode) if (zProfiling) { profile_instruction((count), (opcode)); }
+#define profile_enter(frame) if (zProfiling) { profile_call(frame); }
+#define profile_leave(frame) if (zProfiling) { profile_return(frame); }
+#else
+#define profile_begin(count, opcode) if (0) {}
+#define profile_enter(frame) if (0) {}
+#define profile_leave(frame) if (0) {}
+#endif /* ZPROFILE */
+
+void profile_instruction(zbyte_t count, zbyte_t opcode);
+void profile_call(zstack_frame_t *frame);
+void profile_return(zstack_frame_t *frame);
+void profile_reset();
+unsigned long long profile_count();
+int profile_routines(zprofile_routine_t ***sorted);
+unsigned long long profile_opcode(zbyte_t count, int opcode);
+char *profile_name(packed_addr_t address, char *buf, int len);
+void profile_report(FILE *out, int limit);
+void profile_csv(FILE *out);
+int profile_save(char *filename);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,514 @@
+/*
+    Zerp: a Z-machine interpreter
+    quetzal.c : SAVE and RESTORE, in Quetzal format
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "arena.h"
+#include "undo.h"
+#include "quetzal.h"
+
+#define IFHD_SIZE       13
+#define FRAME_DISCARD   0x10
+#define FRAME_LOCALS    0x0f
+
+/* a growing output buffer; failed is set, and writes ignored, if it can't grow */
+typedef struct zbuffer {
+    unsigned char *data;
+    size_t len, space;
+    int failed;
+} zbuffer_t;
+
+static void put_bytes(zbuffer_t *buf, void *bytes, size_t len);
+static void put_byte(zbuffer_t *buf, int value);
+static void put_number(zbuffer_t *buf, unsigned long value, int bytes);
+static size_t begin_chunk(zbuffer_t *buf, char *id);
+static void end_chunk(zbuffer_t *buf, size_t at);
+static void put_run(zbuffer_t *buf, size_t run);
+static void put_cmem(zbuffer_t *buf);
+static void put_stacks(zbuffer_t *buf);
+static unsigned long get_number(unsigned char *p, int bytes);
+static int read_cmem(unsigned char *p, size_t len, int apply);
+static int read_umem(unsigned char *p, size_t len, int apply);
+static int read_stacks(unsigned char *p, size_t len, int apply);
+static void restore_byte(zword_t offset, zbyte_t value);
+
+/* The running game as a Quetzal file, in a malloc()ed buffer; NULL if there's no memory for it. */
+unsigned char *quetzal_encode(packed_addr_t pc, size_t *len) {
+    zbuffer_t buf;
+    size_t form, chunk;
+
+    memset(&buf, 0, sizeof(zbuffer_t));
+    form = begin_chunk(&buf, "FORM");
+    put_bytes(&buf, "IFZS", 4);
+
+    chunk = begin_chunk(&buf, "IFhd");
+    put_bytes(&buf, zGamefile + RELEASE, 2);
+    put_bytes(&buf, zGamefile + SERIAL, 6);
+    put_bytes(&buf, zGamefile + CHECKSUM, 2);
+    put_number(&buf, pc, 3);
+    end_chunk(&buf, chunk);
+
+    chunk = begin_chunk(&buf, "CMem");
+    put_cmem(&buf);
+    end_chunk(&buf, chunk);
+
+    chunk = begin_chunk(&buf, "Stks");
+    put_stacks(&buf);
+    end_chunk(&buf, chunk);
+
+    end_chunk(&buf, form);
+    if (buf.failed) {
+        free(buf.data);
+        return NULL;
+    }
+    *len = buf.len;
+    return buf.data;
+}
+
+/*
+    Load a Quetzal file into the running game, setting pc to carry on from.
+    Everything is checked before anything is changed, so a file that is
+    damaged or from another story leaves the game as it was. Returns FALSE
+    in that case.
+*/
+int quetzal_decode(unsigned char *data, size_t len, packed_addr_t *pc) {
+    unsigned char *p, *end, *ifhd, *mem, *stks;
+    size_t size, mem_len, stks_len;
+    int compressed;
+
+    if (len < 12 || memcmp(data, "FORM", 4) || memcmp(data + 8, "IFZS", 4))
+        return FALSE;
+    size = get_number(data + 4, 4);
+    if (size < 4 || size > len - 8)
+        return FALSE;
+
+    ifhd = mem = stks = NULL;
+    mem_len = stks_len = 0;
+    compressed = FALSE;
+    end = data + 8 + size;
+    for (p = data + 12; end - p >= 8; p += 8 + size + (size & 1)) {
+        size = get_number(p + 4, 4);
+        if (size > (size_t) (end - p) - 8)
+            return FALSE;
+        if (!memcmp(p, "IFhd", 4) && size >= IFHD_SIZE) {
+            ifhd = p + 8;
+        } else if (!memcmp(p, "CMem", 4) || !memcmp(p, "UMem", 4)) {
+            mem = p + 8;
+            mem_len = size;
+            compressed = p[0] == 'C';
+        } else if (!memcmp(p, "Stks", 4)) {
+            stks = p + 8;
+            stks_len = size;
+        }
+        if (size + (size & 1) > (size_t) (end - p) - 8)
+            break;
+    }
+    if (!ifhd || !mem || !stks)
+        return FALSE;
+
+    /* same release, serial and checksum as the story we're running */
+    if (memcmp(ifhd, zGamefile + RELEASE, 2) || memcmp(ifhd + 2, zGamefile + SERIAL, 6)
+        || memcmp(ifhd + 8, zGamefile + CHECKSUM, 2))
+        return FALSE;
+    *pc = get_number(ifhd + 10, 3);
+    if (*pc >= (packed_addr_t) zFilesize)
+        return FALSE;
+
+    if (!(compressed ? read_cmem(mem, mem_len, FALSE) : read_umem(mem, mem_len, FALSE))
+        || !read_stacks(stks, stks_len, FALSE))
+        return FALSE;
+
+    /* the undo snapshots belong to the game we're leaving */
+    if (zArena)
+        undo_clear(zArena->undo);
+    if (compressed) {
+        read_cmem(mem, mem_len, TRUE);
+    } else {
+        read_umem(mem, mem_len, TRUE);
+    }
+    read_stacks(stks, stks_len, TRUE);
+    return TRUE;
+}
+
+/* SAVE: ask the player for a file and write the game to it */
+int save_game(packed_addr_t pc) {
+    frefid_t ref;
+    strid_t str;
+    unsigned char *data;
+    size_t len;
+
+    ref = glk_fileref_create_by_prompt(fileusage_SavedGame | fileusage_BinaryMode, filemode_Write, 0);
+    if (!ref)
+        return FALSE;
+    str = glk_stream_open_file(ref, filemode_Write, 0);
+    glk_fileref_destroy(ref);
+    if (!str)
+        return FALSE;
+
+    data = quetzal_encode(pc, &len);
+    if (data)
+        glk_put_buffer_stream(str, (char *) data, len);
+    glk_stream_close(str, NULL);
+    free(data);
+    return data != NULL;
+}
+
+/* RESTORE: ask the player for a file and load the game from it */
+int restore_game(packed_addr_t *pc) {
+    frefid_t ref;
+    strid_t str;
+    unsigned char *data;
+    void *grown;
+    size_t len, space;
+    glui32 got;
+    int restored;
+
+    ref = glk_fileref_create_by_prompt(fileusage_SavedGame | fileusage_BinaryMode, filemode_Read, 0);
+    if (!ref)
+        return FALSE;
+    str = glk_fileref_does_file_exist(ref) ? glk_stream_open_file(ref, filemode_Read, 0) : NULL;
+    glk_fileref_destroy(ref);
+    if (!str)
+        return FALSE;
+
+    data = NULL;
+    len = space = 0;
+    do {
+        if (len == space) {
+            grown = realloc(data, space + 0x4000);
+            if (!grown) {
+                len = 0;
+                break;
+            }
+            data = grown;
+            space += 0x4000;
+        }
+        got = glk_get_buffer_stream(str, (char *) data + len, space - len);
+        len += got;
+    } while (got);
+    glk_stream_close(str, NULL);
+
+    restored = len && quetzal_decode(data, len, pc);
+    free(data);
+    return restored;
+}
+
+/* SAVE_TABLE with a table: write bytes bytes from table, as they are, to a file the player chooses */
+int save_table(zword_t table, zword_t bytes) {
+    frefid_t ref;
+    strid_t str;
+
+    if (table + bytes > zFilesize)
+        return FALSE;
+    ref = glk_fileref_create_by_prompt(fileusage_Data | fileusage_BinaryMode, filemode_Write, 0);
+    if (!ref)
+        return FALSE;
+    str = glk_stream_open_file(ref, filemode_Write, 0);
+    glk_fileref_destroy(ref);
+    if (!str)
+        return FALSE;
+    glk_put_buffer_stream(str, (char *) zMachine + table, bytes);
+    glk_stream_close(str, NULL);
+    return TRUE;
+}
+
+/* RESTORE_TABLE with a table: read up to bytes bytes into table. Returns how many there were. */
+int restore_table(zword_t table, zword_t bytes) {
+    frefid_t ref;
+    strid_t str;
+    glsi32 ch;
+    int count;
+
+    if (table + bytes > get_word(STATIC_MEM))
+        return 0;
+    ref = glk_fileref_create_by_prompt(fileusage_Data | fileusage_BinaryMode, filemode_Read, 0);
+    if (!ref)
+        return 0;
+    str = glk_fileref_does_file_exist(ref) ? glk_stream_open_file(ref, filemode_Read, 0) : NULL;
+    glk_fileref_destroy(ref);
+    if (!str)
+        return 0;
+    for (count = 0; count < bytes && (ch = glk_get_char_stream(str)) >= 0; count++) {
+        store_byte(table + count, ch)
+    }
+    glk_stream_close(str, NULL);
+    return count;
+}
+
+static void put_bytes(zbuffer_t *buf, void *bytes, size_t len) {
+    void *grown;
+    size_t space;
+
+    if (buf->failed)
+        return;
+    if (buf->len + len > buf->space) {
+        space = buf->space ? buf->space * 2 : 0x2000;
+        while (space < buf->len + len)
+            space *= 2;
+        grown = realloc(buf->data, space);
+        if (!grown) {
+            buf->failed = TRUE;
+            return;
+        }
+        buf->data = grown;
+        buf->space = space;
+    }
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+}
+
+static void put_byte(zbuffer_t *buf, int value) {
+    unsigned char byte;
+
+    byte = value;
+    put_bytes(buf, &byte, 1);
+}
+
+/* big-endian, as IFF wants */
+static void put_number(zbuffer_t *buf, unsigned long value, int bytes) {
+    while (bytes--)
+        put_byte(buf, value >> (bytes * 8));
+}
+
+/* a chunk header, with the length to be filled in by end_chunk() */
+static size_t begin_chunk(zbuffer_t *buf, char *id) {
+    put_bytes(buf, id, 4);
+    put_number(buf, 0, 4);
+    return buf->len;
+}
+
+static void end_chunk(zbuffer_t *buf, size_t at) {
+    size_t len;
+    int i;
+
+    if (buf->failed)
+        return;
+    len = buf->len - at;
+    for (i = 0; i < 4; i++)
+        buf->data[at - 1 - i] = len >> (i * 8);
+    if (len & 1)
+        put_byte(buf, 0);
+}
+
+/* runs of unchanged bytes are a zero followed by the run length less one */
+static void put_run(zbuffer_t *buf, size_t run) {
+    size_t n;
+
+    while (run) {
+        n = run > 0x100 ? 0x100 : run;
+        put_byte(buf, 0);
+        put_byte(buf, n - 1);
+        run -= n;
+    }
+}
+
+/*
+    Dynamic memory XORed with the story, with unchanged bytes run-length
+    coded. A game changes little of its memory, so most of this is
+    finding the changes: pages never written since the game started are
+    skipped without being read, and the rest are compared eight bytes at
+    a time until a difference turns up. A run reaching the end of dynamic
+    memory is left off, as the format allows.
+*/
+static void put_cmem(zbuffer_t *buf) {
+    size_t dynamic, at, run, end;
+    uint64_t now, was;
+    zbyte_t delta;
+
+    dynamic = get_word(STATIC_MEM);
+    for (at = run = 0; at < dynamic; ) {
+        if (!(at & (ZPAGE_SIZE - 1)) && !zPageStamp[at >> ZPAGE_SHIFT]) {
+            end = at + ZPAGE_SIZE < dynamic ? at + ZPAGE_SIZE : dynamic;
+            run += end - at;
+            at = end;
+            continue;
+        }
+        if (at + sizeof(uint64_t) <= dynamic) {
+            memcpy(&now, zMachine + at, sizeof(uint64_t));
+            memcpy(&was, zGamefile + at, sizeof(uint64_t));
+            if (now == was) {
+                run += sizeof(uint64_t);
+                at += sizeof(uint64_t);
+                continue;
+            }
+        }
+        delta = zMachine[at] ^ zGamefile[at];
+        at++;
+        if (!delta) {
+            run++;
+            continue;
+        }
+        put_run(buf, run);
+        run = 0;
+        put_byte(buf, delta);
+    }
+}
+
+/*
+    One frame per routine, outermost (the dummy frame the game starts in)
+    first. The evaluation stack of a frame runs from just above the word
+    frame's locals to the stack pointer saved by the next frame in, or to
+    zSP for the current frame.
+*/
+static void put_stacks(zbuffer_t *buf) {
+    zstack_frame_t *frame;
+    zword_t *bottom, *top;
+    int i;
+
+    for (frame = zCallStack; frame <= zFP; frame++) {
+        top = frame < zFP ? (frame + 1)->sp : zSP;
+        bottom = frame_bottom(frame);
+        if (frame == zCallStack) {
+            put_number(buf, 0, 6);
+        } else {
+            put_number(buf, frame->pc, 3);
+            put_byte(buf, (frame->local_count & FRAME_LOCALS) | (frame->ret_keep ? 0 : FRAME_DISCARD));
+            put_byte(buf, frame->ret_keep ? frame->ret_store : 0);
+            put_byte(buf, frame->args);
+        }
+        put_number(buf, top - bottom + 1, 2);
+        if (frame != zCallStack) {
+            for (i = 0; i < (frame->local_count & FRAME_LOCALS); i++)
+                put_number(buf, frame_locals(frame)[i], 2);
+        }
+        for (; bottom <= top; bottom++)
+            put_number(buf, *bottom, 2);
+    }
+}
+
+static unsigned long get_number(unsigned char *p, int bytes) {
+    unsigned long value;
+
+    for (value = 0; bytes--; p++)
+        value = value << 8 | *p;
+    return value;
+}
+
+/* Check CMem fits the story's dynamic memory, and with apply set, load it */
+static int read_cmem(unsigned char *p, size_t len, int apply) {
+    unsigned char *end;
+    size_t dynamic, at, run;
+
+    dynamic = get_word(STATIC_MEM);
+    end = p + len;
+    for (at = 0; p < end; ) {
+        if (*p) {
+            if (at >= dynamic)
+                return FALSE;
+            if (apply)
+                restore_byte(at, zGamefile[at] ^ *p);
+            at++;
+            p++;
+            continue;
+        }
+        if (end - p < 2)
+            return FALSE;
+        run = p[1] + 1;
+        p += 2;
+        if (at + run > dynamic)
+            return FALSE;
+        for (; apply && run; at++, run--) {
+            /* a page not written since the game began already matches */
+            if (!(at & (ZPAGE_SIZE - 1)) && run >= ZPAGE_SIZE && !zPageStamp[at >> ZPAGE_SHIFT]) {
+                at += ZPAGE_SIZE - 1;
+                run -= ZPAGE_SIZE - 1;
+                continue;
+            }
+            restore_byte(at, zGamefile[at]);
+        }
+        at += run;
+    }
+    /* and the run the file left off */
+    for (; apply && at < dynamic; at++)
+        restore_byte(at, zGamefile[at]);
+    return TRUE;
+}
+
+static int read_umem(unsigned char *p, size_t len, int apply) {
+    size_t at;
+
+    if (len != get_word(STATIC_MEM))
+        return FALSE;
+    for (at = 0; apply && at < len; at++)
+        restore_byte(at, p[at]);
+    return TRUE;
+}
+
+/* Check Stks fits our stacks, and with apply set, rebuild them from it the way call_zroutine() would */
+static int read_stacks(unsigned char *p, size_t len, int apply) {
+    unsigned char *end;
+    zword_t *sp;
+    zstack_frame_t *frame;
+    int locals, count, i;
+
+    end = p + len;
+    sp = zStack;
+    frame = zCallStack;
+    if (apply) {
+        memset(frame, 0, sizeof(zstack_frame_t));
+        frame->sp = sp;
+        frame->routine = get_word(PC_INITIAL);
+    }
+    for (; p < end; frame++) {
+        if (end - p < 8)
+            return FALSE;
+        locals = p[3] & FRAME_LOCALS;
+        count = get_number(p + 6, 2);
+        if (end - p < 8 + (locals + count) * 2)
+            return FALSE;
+
+        if (frame == zCallStack && locals)
+            return FALSE;
+        if (frame != zCallStack) {
+            if (frame >= zCallStackTop)
+                return FALSE;
+            if (apply) {
+                memset(frame, 0, sizeof(zstack_frame_t));
+                frame->pc = get_number(p, 3);
+                frame->sp = sp;
+                frame->local_count = locals;
+                frame->ret_keep = !(p[3] & FRAME_DISCARD);
+                frame->ret_store = frame->ret_keep ? p[4] : 0;
+                frame->args = p[5];
+            }
+        }
+        if (sp + locals + count >= zStackTop)
+            return FALSE;
+
+        p += 8;
+        for (i = 0; i < locals; i++, p += 2) {
+            sp++;
+            if (apply)
+                *sp = get_number(p, 2);
+        }
+        for (i = 0; i < count; i++, p += 2) {
+            sp++;
+            if (apply)
+                *sp = get_number(p, 2);
+        }
+    }
+    if (frame == zCallStack)
+        return FALSE;
+    if (apply) {
+        zSP = sp;
+        zFP = frame - 1;
+    }
+    return TRUE;
+}
+
+/* only bytes that differ are written, so only their pages are stamped dirty */
+static void restore_byte(zword_t offset, zbyte_t value) {
+    if (zMachine[offset] != value) {
+        store_byte(offset, value)
+    }
+}
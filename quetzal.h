@@ -0,0 +1,33 @@
+/*
+    Zerp: a Z-machine interpreter
+    quetzal.h : SAVE and RESTORE, in Quetzal format
+*/
+
+#ifndef QUETZAL_H
+#define QUETZAL_H
+
+#include <stddef.h>
+
+/*
+    A Quetzal file is an IFF FORM of type IFZS holding three chunks:
+
+        IFhd    which story it belongs to, and the PC to carry on from
+        CMem    dynamic memory, XORed with the story file and with runs
+                of zero bytes (unchanged memory) squeezed out
+        Stks    the call stack, outermost frame first, with each frame's
+                locals and evaluation stack
+
+    The pc handed to quetzal_encode() is the address of the SAVE's branch
+    (V3) or store byte (V4 on); RESTORE carries on from there, as if the
+    SAVE had just returned 2. Restoring also accepts UMem, the
+    uncompressed form of CMem that some interpreters write.
+*/
+unsigned char *quetzal_encode(packed_addr_t pc, size_t *len);
+int quetzal_decode(unsigned char *data, size_t len, packed_addr_t *pc);
+
+int save_game(packed_addr_t pc);
+int restore_game(packed_addr_t *pc);
+int save_table(zword_t table, zword_t bytes);
+int restore_table(zword_t table, zword_t bytes);
+
+#endif /* QUETZAL_H */
@@ -0,0 +1,203 @@
+/*
+    Zerp: a Z-machine interpreter
+    sample.c : a sampling profiler, writing folded stacks for flame graphs
+
+    Nothing is added to the instruction loop. Instead an ITIMER_PROF
+    timer raises SIGPROF every so much CPU time, and the handler, while
+    zerp_execute() is running instructions, copies out the call stack:
+    the routine address of each frame from the outermost in. A frame
+    that doesn't know its routine (one restored from a Quetzal save) is
+    recorded by the pc it's at instead, zPC for the innermost and the
+    return address kept in the frame above for the rest, and the routine
+    is found from the debugging information (debuginfo.c) when the
+    samples are written. Routines are named as the profiler names them,
+    by profile_name().
+
+    Samples go into one buffer, allocated when sampling starts, so the
+    handler does nothing but read and copy. Once it's full, further
+    samples are only counted. sample_save() writes the folded stacks
+    flamegraph.pl and similar tools read: one line for each different
+    stack, its routines root first separated by ';', then the number of
+    samples that saw it.
+
+    Linux counts ITIMER_PROF in scheduler ticks, so asking for more
+    samples a second than the kernel's HZ (often 250) gets no more.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "sample.h"
+#include "profile.h"
+#include "debuginfo.h"
+
+volatile sig_atomic_t zExecuting = FALSE;
+char *zSampleFile = NULL;
+int zSampleHz = SAMPLE_HZ;
+
+/* each sample is its depth, then that many routines (or SAMPLE_PC|pc), outermost first */
+static unsigned int *zSamples = NULL;
+static volatile unsigned long zSampleNext = 0;
+static volatile unsigned long zSampleCount = 0, zSampleDropped = 0;
+
+static void sample_take(int sig);
+static unsigned int *sample_record(unsigned int *out, zstack_frame_t *frame);
+static void sample_frame(FILE *out, unsigned int word);
+static int by_stack(const void *a, const void *b);
+
+/* Sample hz times a second of CPU time, until sample_stop() */
+int sample_start(int hz) {
+    struct sigaction sa;
+    struct itimerval timer;
+
+    if (hz <= 0 || hz > 1000000)
+        return FALSE;
+    if (!zSamples) {
+        zSamples = malloc(SAMPLE_WORDS * sizeof(unsigned int));
+        if (!zSamples)
+            return FALSE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sample_take;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    return !setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/* Stop sampling, keeping what has been taken */
+void sample_stop() {
+    struct itimerval timer;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+unsigned long sample_count() {
+    return zSampleCount;
+}
+
+unsigned long sample_dropped() {
+    return zSampleDropped;
+}
+
+/* Write the samples so far to filename as folded stacks, and start again. FALSE if it can't. */
+int sample_save(char *filename) {
+    unsigned int **stacks, *at;
+    unsigned long i, n, same, count;
+    unsigned int depth;
+    sigset_t block, old;
+    FILE *out;
+    int ok;
+
+    out = fopen(filename, "w");
+    if (!out)
+        return FALSE;
+
+    /* the handler mustn't add samples while they're sorted */
+    sigemptyset(&block);
+    sigaddset(&block, SIGPROF);
+    sigprocmask(SIG_BLOCK, &block, &old);
+
+    count = zSampleCount - zSampleDropped;
+    stacks = malloc((count ? count : 1) * sizeof(unsigned int *));
+    ok = stacks != NULL;
+    for (n = 0, at = zSamples; ok && n < count; n++, at += *at + 1) {
+        stacks[n] = at;
+        /* pcs become the routines they're in, so their stacks fold together */
+        for (depth = 1; depth <= at[0]; depth++) {
+            if (at[depth] != SAMPLE_ELIDED && (at[depth] & SAMPLE_PC))
+                at[depth] = debuginfo_routine_at(at[depth] & ~SAMPLE_PC);
+        }
+    }
+    if (ok)
+        qsort(stacks, n, sizeof(unsigned int *), by_stack);
+
+    for (i = 0; ok && i < n; i = same) {
+        for (same = i + 1; same < n && !by_stack(&stacks[i], &stacks[same]); same++) ;
+        for (depth = 0; depth < stacks[i][0]; depth++) {
+            if (depth)
+                fputc(';', out);
+            sample_frame(out, stacks[i][depth + 1]);
+        }
+        fprintf(out, " %lu\n", same - i);
+    }
+    free(stacks);
+
+    zSampleNext = 0;
+    zSampleCount = zSampleDropped = 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (fclose(out))
+        ok = FALSE;
+    return ok;
+}
+
+/* SIGPROF: copy out the current game's stack, if it's running and there's room */
+static void sample_take(int sig) {
+    unsigned int *out;
+    long depth;
+
+    (void) sig;
+    if (!zExecuting || !zSamples)
+        return;
+    zSampleCount++;
+    depth = zFP - zCallStack + 1;
+    if (depth < 1 || depth > CALLSTACKSIZE || zSampleNext + SAMPLE_DEPTH + 2 > SAMPLE_WORDS) {
+        zSampleDropped++;
+        return;
+    }
+
+    out = &zSamples[zSampleNext + 1];
+    if (depth <= SAMPLE_DEPTH) {
+        for (; depth; depth--)
+            out = sample_record(out, zFP - depth + 1);
+    } else {
+        /* the outermost and the innermost frames, with a marker where the rest would be */
+        for (depth = 0; depth < SAMPLE_DEPTH / 2; depth++)
+            out = sample_record(out, zCallStack + depth);
+        *out++ = SAMPLE_ELIDED;
+        for (depth = SAMPLE_DEPTH / 2 - 1; depth >= 1; depth--)
+            out = sample_record(out, zFP - depth + 1);
+    }
+    zSamples[zSampleNext] = out - &zSamples[zSampleNext + 1];
+    zSampleNext = out - zSamples;
+}
+
+static unsigned int *sample_record(unsigned int *out, zstack_frame_t *frame) {
+    if (frame->routine)
+        *out++ = frame->routine;
+    else
+        *out++ = SAMPLE_PC | (frame == zFP ? zPC : (frame + 1)->pc);
+    return out;
+}
+
+/* one frame of a folded stack */
+static void sample_frame(FILE *out, unsigned int word) {
+    char name[64];
+
+    fputs(word == SAMPLE_ELIDED ? "..." : profile_name(word, name, sizeof(name)), out);
+}
+
+static int by_stack(const void *a, const void *b) {
+    const unsigned int *x = *(const unsigned int **) a, *y = *(const unsigned int **) b;
+    unsigned int i;
+
+    for (i = 1; i <= x[0] && i <= y[0]; i++) {
+        if (x[i] != y[i])
+            return x[i] < y[i] ? -1 : 1;
+    }
+    return x[0] < y[0] ? -1 : x[0] > y[0];
+}
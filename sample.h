@@ -0,0 +1,29 @@
+/*
+    Zerp: a Z-machine interpreter
+    sample.h : a sampling profiler, writing folded stacks for flame graphs
+*/
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#define SAMPLE_HZ       1000            /* samples a second of CPU time, by default */
+#define SAMPLE_WORDS    (1 << 20)       /* room for samples, in words */
+#define SAMPLE_DEPTH    256             /* frames kept from a deeper stack, half from each end */
+
+#define SAMPLE_PC       0x80000000      /* a pc in a routine we didn't know the start of */
+#define SAMPLE_ELIDED   0xffffffff      /* frames left out of the middle of a deep stack */
+
+/* the interpreter is running instructions, so the stacks can be read */
+extern volatile sig_atomic_t zExecuting;
+
+/* set (e.g. from the command line) to sample the game and write what was seen there as it ends */
+extern char *zSampleFile;
+extern int zSampleHz;
+
+int sample_start(int hz);
+void sample_stop();
+int sample_save(char *filename);
+unsigned long sample_count();
+unsigned long sample_dropped();
+
+#endif /* SAMPLE_H */
@@ -0,0 +1,1251 @@
+/*
+    Zerp: a Z-machine interpreter
+    server.c : zerp-server - many sessions of one story over JSON lines
+
+    usage: zerp-server [-s socket [-n workers]] [-w width] [-h height] [-d idle] [-H idle]
+                       [-a dir [-A turns]] [-f dir] [-g debuginfo] [-l ms] storyfile
+
+    One JSON object per line in each direction, on stdin/stdout or on any
+    number of connections to a Unix socket. Requests name a session; a
+    connection can drive as many sessions as it likes.
+
+        {"type":"open","session":"s1"}          (optional "width", "height")
+        {"type":"line","session":"s1","value":"look"}
+        {"type":"char","session":"s1","value":"y"}
+        {"type":"reset","session":"s1"}         (start the game over, same memory)
+        {"type":"snapshot","session":"s1","file":"s1.zsnp"}
+        {"type":"fork","session":"s1","as":"s2"}
+        {"type":"whatif","session":"s1","commands":["take lamp","north"]}
+        {"type":"hash","session":"s1"}
+        {"type":"world","session":"s1"}         (optional "changed":true)
+        {"type":"hibernate","session":"s1"}
+        {"type":"trace","session":"s1","on":true}  (optional "file")
+        {"type":"monitor","session":"s1","command":"i"}
+        {"type":"dedup"}
+        {"type":"profile","on":true}            (optional "reset":true, "file")
+        {"type":"sample","on":true}             (optional "rate", "file")
+        {"type":"stats"}                        (optional "session")
+        {"type":"close","session":"s1"}
+
+    open, line, char and reset run the game until it next wants input and answer
+    with what changed since the last update:
+
+        {"type":"update","session":"s1","gen":2,"state":"input","input":"line",
+         "windows":[{"id":1,"text":"Taken.\n>"}],
+         "status":"Test Room                               0/1",
+         "upper":["..."]}
+
+    windows carries new text for each text buffer window (id is the window
+    rock, "clear":true if it was cleared first); status is the V3 status
+    line and upper the upper window grid, each sent when the game redraws it.
+    state is input, quit or error; sessions that stop are closed. Problems
+    are reported as {"type":"error","session":"s1","message":"..."}.
+
+    snapshot writes the session's game to a file (snapshot.c), answering
+    {"type":"snapshot","session":"s1","bytes":1234}; an open with
+    "snapshot":"s1.zsnp" starts the new session from one instead of
+    from the beginning. fork starts session "as" as a copy of the running
+    one (session_fork()), which carries on undisturbed; the copy is
+    answered with an update like a new session. Resumed and forked
+    sessions start with empty windows.
+
+    whatif plays each command from where the session is (whatif.c), in
+    parallel, leaving the session as it was, and answers with one result
+    per command:
+
+        {"type":"whatif","session":"s1","results":[{"command":"north",
+         "state":"input","text":"north\nYou can't go that way.\n>",
+         "bytes":4,"changed":[[1234,2],...],"hash":"8f3a..."},...]}
+
+    bytes counts the bytes of dynamic memory the command changed, changed
+    lists the first runs of them as [address,length], and hash is the
+    state hash (hash.c) afterwards, in hex.
+
+    hash answers {"type":"hash","session":"s1","hash":"8f3a...","full":"8f3a..."}
+    with the session's running state hash and the same worked out from
+    scratch, which should always agree.
+
+    world answers {"type":"world","session":"s1","objects":[...]} with the
+    game's object tree (world.c), read from memory without running the
+    game. With "changed":true only objects that changed since the
+    session's last world request are listed.
+
+    Sessions left waiting for input for idle seconds (-d, default 10; 0
+    turns it off) have their dynamic memory shared with other sessions
+    and the story where it's the same (dedup.c). dedup, which needs no
+    session, does that at once for every session waiting for input and
+    answers with what sharing saves:
+
+        {"type":"dedup","story":12,"shared":340,"store":25,"saved":1343488}
+
+    story and shared count pages mapped onto the story and onto the page
+    store, store the store's own pages, saved is in bytes.
+
+    With -H, sessions left waiting for input for that many seconds are
+    hibernated (hibernate.c): their game is compressed and their memory
+    given back, keeping only their windows. hibernate does the same at
+    once, answering {"type":"hibernate","session":"s1","bytes":812}. A
+    hibernated session wakes, transparently, at its next request.
+
+    trace switches the session's instruction trace (trace.c) on or off
+    with "on", and with "file" first saves what it has there, answering
+    {"type":"trace","session":"s1","tracing":true,"records":4096}. The
+    tracepoints are only there in a server built with -DZTRACE; decode a
+    saved trace with zerp-headless -decode file storyfile.
+
+    monitor runs one debug monitor command (debug.c) against the
+    session, without the game taking a turn, and answers with what it
+    printed: {"type":"monitor","session":"s1","text":"81734 instructions run\n"}.
+    i, k, m, t and r show the instruction rate, cache hit rates, the
+    game's memory, the busiest opcodes and routines, and reset the
+    counters; commands that would run or end the game are refused.
+
+    profile, which needs no session either, switches the profiler
+    (profile.c) on or off for the whole process with "on", clears its
+    counts with "reset" and with "file" writes them there, as a report
+    and as file.csv, answering
+    {"type":"profile","profiling":true,"instructions":81734,"routines":212}.
+    The counts are only kept by a server built with -DZPROFILE, and with
+    -n each worker keeps its own.
+
+    sample, also for the whole process, starts or stops the sampling
+    profiler (sample.c) with "on", taking "rate" samples a second of CPU
+    time, and with "file" writes the stacks seen so far there, folded for
+    flamegraph.pl, and starts again. It answers
+    {"type":"sample","sampling":true,"samples":5120,"dropped":0}. With -g,
+    routines are named from the story's debugging information
+    (debuginfo.c); without it they're named by address.
+
+    stats answers with the process's counters (stats.c), totalled over
+    every session it has run, and the story's turn latencies (latency.c),
+    and with "session" that session's too:
+    {"type":"stats","process":{"instructions":81734,...},"session":"s1",
+    "game":{...},"latency":{"story":{"turns":52,"time_us":{"p50":180,...},
+    "instructions":{...},"output":{...}},"game":{...}}}. A turn runs from
+    the input being taken to the game asking for more; each histogram
+    gives its percentiles and its buckets, so they can be added up.
+    SIGUSR1 writes the same to stderr as a line of JSON, as does the
+    server exiting; with -n each worker counts for itself. Turns slower
+    than -l milliseconds (default 100; 0 for none) are logged to stderr
+    with their command, as {"type":"slow_turn",...}.
+
+    With -a, every session is snapshotted to dir/<session>.zsnp every -A
+    turns (default 10) for crash recovery; an open with that file as its
+    "snapshot" (with -f the same dir) picks the game up again. The snapshot is taken as the game
+    stops for input and written by a background thread (autosave.c), so
+    the session is answered without waiting for the disk.
+
+    Files clients name, for snapshot, open, trace, profile and sample, are
+    under the -f dir: names must be relative and can't contain "..".
+    Without -f those requests can't use files.
+
+    All text is taken from memglk's window buffers, i.e. straight from the
+    interpreter's output calls; nothing is rendered.
+
+    With -n the server loads the story, shares it (story.c) and forks that
+    many workers, which all accept on the socket. A connection and its
+    sessions live in one worker; workers that die are replaced, which costs
+    a fork rather than a story load. The master exits on SIGTERM or SIGINT,
+    taking the workers with it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "glk.h"
+#include "memglk.h"
+#include "zerp.h"
+#include "json.h"
+#include "stats.h"
+#include "latency.h"
+#include "session.h"
+#include "story.h"
+#include "snapshot.h"
+#include "parse.h"
+#include "whatif.h"
+#include "hash.h"
+#include "world.h"
+#include "arena.h"
+#include "dedup.h"
+#include "hibernate.h"
+#include "autosave.h"
+#include "opcodes.h"
+#include "trace.h"
+#include "profile.h"
+#include "sample.h"
+#include "debuginfo.h"
+#include "debug.h"
+
+#define SERVER_EVENTS       64
+#define SESSION_BUCKETS     1024
+#define SESSION_ID_MAX      64
+#define READ_CHUNK          4096
+#define VALUE_MAX           256
+#define DEDUP_IDLE          10
+#define MONITOR_TEXT        65536
+
+typedef struct connection {
+    int in, out;
+    int listening, watching_out;
+    char *inbuf;
+    int inlen, insize;
+    jsonbuf_t outbuf;
+    int outpos;
+    int closing;
+    struct connection *next;
+} connection_t;
+
+typedef struct server_session {
+    char id[SESSION_ID_MAX];
+    zsession_t *session;
+    zhibernated_t *hibernated;
+    memglk_context_t *glk;
+    connection_t *owner;
+    int gen;
+    time_t active;
+    int turns;
+    zworld_mark_t world;
+    struct server_session *next;
+} server_session_t;
+
+static server_session_t *sessions[SESSION_BUCKETS];
+static connection_t *connections = NULL;
+static int epfd = -1;
+static glui32 screen_width = 80, screen_height = 24;
+static int dedup_idle = DEDUP_IDLE;
+static int hibernate_idle = 0;
+static char *autosave_dir = NULL;
+static char *file_dir = NULL;
+static volatile sig_atomic_t stopping = FALSE;
+
+static void server_exit(memglk_context_t *ctx);
+static memglk_hooks_t server_hooks = { NULL, server_exit, NULL };
+
+static int open_listener(char *socket_path);
+static int supervise(int listener, int workers);
+static pid_t spawn_worker(int listener);
+static void stop_handler(int sig);
+static int serve(int listener);
+static connection_t *conn_new(int in, int out);
+static void conn_close(connection_t *conn);
+static int conn_read(connection_t *conn);
+static void conn_flush(connection_t *conn);
+static void conn_watch(connection_t *conn, int out);
+static void handle_message(connection_t *conn, char *line);
+static void send_error(connection_t *conn, char *id, char *message);
+static void send_update(server_session_t *ss);
+static server_session_t *session_find(char *id);
+static void server_open(connection_t *conn, char *id, long width, long height, char *snapshot,
+                        server_session_t *parent);
+static void server_input(server_session_t *ss, int type, char *value);
+static void server_whatif(server_session_t *ss, char *line);
+static void server_world(server_session_t *ss, char *line);
+static void server_trace(server_session_t *ss, char *line);
+static void server_profile(connection_t *conn, char *line);
+static void server_sample(connection_t *conn, char *line);
+static void server_stats(connection_t *conn, char *line);
+static void server_monitor(server_session_t *ss, char *line);
+static void server_run(server_session_t *ss);
+static void server_autosave(server_session_t *ss);
+static int server_file(connection_t *conn, char *id, char *name, char *path);
+static void server_close(server_session_t *ss);
+static void server_select(server_session_t *ss);
+static void server_idle(int dedup_after, int hibernate_after);
+static int server_hibernate(server_session_t *ss);
+static int server_wake(server_session_t *ss);
+static time_t now();
+
+int main(int argc, char **argv) {
+    memglk_context_t *boot;
+    frefid_t ref;
+    char *socket_path = NULL, *story = NULL;
+    int listener, workers, i;
+
+    workers = 0;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            screen_width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            screen_height = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            dedup_idle = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-H") && i + 1 < argc) {
+            hibernate_idle = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+            autosave_dir = argv[++i];
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            file_dir = argv[++i];
+        } else if (!strcmp(argv[i], "-A") && i + 1 < argc) {
+            zAutosaveTurns = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            if (!debuginfo_load(argv[++i]))
+                fprintf(stderr, "%s: no routines read from %s\n", argv[0], argv[i]);
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            zLatencySlow = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !story) {
+            story = argv[i];
+        } else {
+            story = NULL;
+            break;
+        }
+    }
+    if (!story || (workers && !socket_path)) {
+        fprintf(stderr, "usage: %s [-s socket [-n workers]] [-w width] [-h height] [-d idle] [-H idle] [-a dir [-A turns]] [-f dir] [-g debuginfo] [-l ms] storyfile\n", argv[0]);
+        return 1;
+    }
+
+    /* the story is loaded once, through a context that is never shown */
+    boot = memglk_context_create(screen_width, screen_height);
+    memglk_set_context(boot);
+    zFilename = story;
+    ref = glk_fileref_create_by_name(fileusage_BinaryMode | fileusage_Data, story, 0);
+    if (!ref || !load_gamefile(ref)) {
+        fprintf(stderr, "%s: unable to load %s\n", argv[0], story);
+        return 1;
+    }
+    story_share();
+    memglk_context_destroy(boot);
+
+    stats_signal();
+    listener = -1;
+    if (socket_path && (listener = open_listener(socket_path)) < 0)
+        return 1;
+    if (workers > 0)
+        return supervise(listener, workers);
+    i = serve(listener);
+    autosave_flush();
+    stats_dump("exit");
+    return i;
+}
+
+static int open_listener(char *socket_path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror(socket_path);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+/* pre-fork mode: keep workers running until told to stop */
+static int supervise(int listener, int workers) {
+    struct sigaction sa;
+    pid_t *pids, pid;
+    int i;
+
+    pids = calloc(workers, sizeof(pid_t));
+    if (!pids) {
+        perror("zerp-server");
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    for (i = 0; i < workers; i++)
+        pids[i] = spawn_worker(listener);
+
+    while (!stopping) {
+        pid = wait(NULL);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < workers; i++) {
+            if (pids[i] == pid) {
+                fprintf(stderr, "zerp-server: worker %d exited, starting another\n", (int) pid);
+                pids[i] = spawn_worker(listener);
+            }
+        }
+    }
+
+    for (i = 0; i < workers; i++) {
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    }
+    while (wait(NULL) > 0 || errno == EINTR) ;
+    free(pids);
+    return 0;
+}
+
+static pid_t spawn_worker(int listener) {
+    pid_t pid;
+
+    pid = fork();
+    if (pid == 0) {
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        exit(serve(listener));
+    }
+    if (pid < 0)
+        perror("fork");
+    return pid;
+}
+
+static void stop_handler(int sig) {
+    (void) sig;
+    stopping = TRUE;
+}
+
+/* the event loop, on the listening socket or (listener < 0) stdin/stdout */
+static int serve(int listener) {
+    struct epoll_event ev, events[SERVER_EVENTS];
+    connection_t *conn, *stdio;
+    time_t last_idle;
+    int fd, n, i;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    stdio = NULL;
+    if (listener >= 0) {
+        /* workers share the socket: only wake one of them per connection */
+        conn = conn_new(listener, listener);
+        conn->listening = TRUE;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = conn;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+    } else {
+        stdio = conn_new(0, 1);
+        ev.events = EPOLLIN;
+        ev.data.ptr = stdio;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev) < 0) {
+            /* stdin is a plain file, which epoll won't take: just read it through */
+            while (conn_read(stdio)) ;
+            conn_close(stdio);
+            return 0;
+        }
+    }
+
+    last_idle = now();
+    while (TRUE) {
+        /* wake at least once a second to look for idle sessions */
+        n = epoll_wait(epfd, events, SERVER_EVENTS, dedup_idle > 0 || hibernate_idle > 0 ? 1000 : -1);
+        stats_poll();
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return 1;
+        }
+        for (i = 0; i < n; i++) {
+            conn = events[i].data.ptr;
+            if (conn->listening) {
+                while ((fd = accept(conn->in, NULL, NULL)) >= 0) {
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    conn_watch(conn_new(fd, fd), FALSE);
+                }
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+                conn_flush(conn);
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn_read(conn))
+                conn->closing = TRUE;
+            if (conn->closing) {
+                conn_close(conn);
+                if (conn == stdio)
+                    return 0;
+            }
+        }
+        if ((dedup_idle > 0 || hibernate_idle > 0) && now() != last_idle) {
+            server_idle(dedup_idle > 0 ? dedup_idle : -1, hibernate_idle);
+            last_idle = now();
+        }
+    }
+}
+
+/* connections */
+
+static connection_t *conn_new(int in, int out) {
+    connection_t *conn;
+
+    conn = calloc(1, sizeof(connection_t));
+    if (!conn) {
+        perror("zerp-server");
+        exit(1);
+    }
+    conn->in = in;
+    conn->out = out;
+    conn->next = connections;
+    connections = conn;
+    return conn;
+}
+
+static void conn_close(connection_t *conn) {
+    connection_t **link;
+    server_session_t *ss, *next;
+    int i;
+
+    conn_flush(conn);
+    for (i = 0; i < SESSION_BUCKETS; i++) {
+        for (ss = sessions[i]; ss; ss = next) {
+            next = ss->next;
+            if (ss->owner == conn)
+                server_close(ss);
+        }
+    }
+
+    for (link = &connections; *link && *link != conn; link = &(*link)->next) ;
+    if (*link)
+        *link = conn->next;
+    if (conn->in > 1) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn->in, NULL);
+        close(conn->in);
+    }
+    free(conn->inbuf);
+    json_free(&conn->outbuf);
+    free(conn);
+}
+
+static void conn_watch(connection_t *conn, int out) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->in, &ev) < 0)
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn->in, &ev);
+    conn->watching_out = out;
+}
+
+/* Read what's there and handle every complete line. FALSE at end of input. */
+static int conn_read(connection_t *conn) {
+    char *data, *line, *end;
+    int n, size;
+
+    if (conn->inlen + READ_CHUNK + 1 > conn->insize) {
+        size = conn->inlen + READ_CHUNK + 1;
+        data = realloc(conn->inbuf, size);
+        if (!data)
+            return FALSE;
+        conn->inbuf = data;
+        conn->insize = size;
+    }
+
+    n = read(conn->in, conn->inbuf + conn->inlen, READ_CHUNK);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR;
+    if (n == 0) {
+        if (conn->inlen) {
+            conn->inbuf[conn->inlen] = '\0';
+            handle_message(conn, conn->inbuf);
+            conn->inlen = 0;
+        }
+        conn_flush(conn);
+        return FALSE;
+    }
+    conn->inlen += n;
+    conn->inbuf[conn->inlen] = '\0';
+
+    line = conn->inbuf;
+    while ((end = strchr(line, '\n'))) {
+        *end = '\0';
+        handle_message(conn, line);
+        line = end + 1;
+    }
+    conn->inlen -= line - conn->inbuf;
+    memmove(conn->inbuf, line, conn->inlen);
+
+    conn_flush(conn);
+    return !conn->closing;
+}
+
+static void conn_flush(connection_t *conn) {
+    int n;
+
+    while (conn->outpos < conn->outbuf.len) {
+        n = write(conn->out, conn->outbuf.data + conn->outpos, conn->outbuf.len - conn->outpos);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                if (!conn->watching_out)
+                    conn_watch(conn, TRUE);
+                return;
+            }
+            conn->closing = TRUE;
+            break;
+        }
+        conn->outpos += n;
+    }
+    json_reset(&conn->outbuf);
+    conn->outpos = 0;
+    if (conn->watching_out)
+        conn_watch(conn, FALSE);
+}
+
+/* protocol */
+
+static void handle_message(connection_t *conn, char *line) {
+    char type[16], id[SESSION_ID_MAX], value[VALUE_MAX], path[PATH_MAX];
+    zdedup_stats_t stats;
+    int bytes;
+    server_session_t *ss;
+    long width, height;
+
+    while (*line == ' ' || *line == '\t' || *line == '\r')
+        line++;
+    if (!*line)
+        return;
+
+    if (!json_get_string(line, "type", type, sizeof(type))) {
+        send_error(conn, NULL, "request has no type");
+        return;
+    }
+    if (!strcmp(type, "dedup")) {
+        server_idle(0, 0);
+        dedup_stats(&stats);
+        json_printf(&conn->outbuf, "{\"type\":\"dedup\",\"story\":%d,\"shared\":%d,\"store\":%d,\"saved\":%ld}\n",
+                    stats.story, stats.shared, stats.store, stats.saved);
+        return;
+    }
+    if (!strcmp(type, "profile")) {
+        server_profile(conn, line);
+        return;
+    }
+    if (!strcmp(type, "sample")) {
+        server_sample(conn, line);
+        return;
+    }
+    if (!strcmp(type, "stats")) {
+        server_stats(conn, line);
+        return;
+    }
+    if (!json_get_string(line, "session", id, sizeof(id))) {
+        send_error(conn, NULL, "request has no session");
+        return;
+    }
+    ss = session_find(id);
+
+    if (!strcmp(type, "open")) {
+        if (ss) {
+            send_error(conn, id, "session already open");
+            return;
+        }
+        if (!json_get_number(line, "width", &width) || width < 1)
+            width = screen_width;
+        if (!json_get_number(line, "height", &height) || height < 1)
+            height = screen_height;
+        if (json_get_string(line, "snapshot", value, sizeof(value))) {
+            if (!server_file(conn, id, value, path))
+                return;
+            server_open(conn, id, width, height, path, NULL);
+        } else {
+            server_open(conn, id, width, height, NULL, NULL);
+        }
+        return;
+    }
+
+    if (!ss) {
+        send_error(conn, id, "no such session");
+        return;
+    }
+    if (ss->owner != conn) {
+        send_error(conn, id, "session belongs to another connection");
+        return;
+    }
+    ss->active = now();
+    if (ss->hibernated && strcmp(type, "close") && !server_wake(ss)) {
+        send_error(conn, id, "unable to wake session");
+        server_close(ss);
+        return;
+    }
+
+    if (!strcmp(type, "line") || !strcmp(type, "char")) {
+        if (!json_get_string(line, "value", value, sizeof(value)))
+            value[0] = '\0';
+        server_input(ss, type[0] == 'l' ? INPUT_LINE : INPUT_CHAR, value);
+    } else if (!strcmp(type, "reset")) {
+        if (!session_reset(ss->session)) {
+            send_error(conn, id, "unable to reset session");
+            server_close(ss);
+            return;
+        }
+        server_run(ss);
+    } else if (!strcmp(type, "snapshot")) {
+        if (!json_get_string(line, "file", value, sizeof(value))) {
+            send_error(conn, id, "snapshot needs a file");
+            return;
+        }
+        if (!server_file(conn, id, value, path))
+            return;
+        server_select(ss);
+        if (!(bytes = snapshot_save(path))) {
+            send_error(conn, id, "unable to write snapshot");
+            return;
+        }
+        json_printf(&conn->outbuf, "{\"type\":\"snapshot\",\"session\":");
+        json_string(&conn->outbuf, id, strlen(id));
+        json_printf(&conn->outbuf, ",\"bytes\":%d}\n", bytes);
+    } else if (!strcmp(type, "fork")) {
+        if (!json_get_string(line, "as", value, SESSION_ID_MAX)) {
+            send_error(conn, id, "fork needs a session to fork as");
+            return;
+        }
+        if (session_find(value)) {
+            send_error(conn, value, "session already open");
+            return;
+        }
+        if (!json_get_number(line, "width", &width) || width < 1)
+            width = screen_width;
+        if (!json_get_number(line, "height", &height) || height < 1)
+            height = screen_height;
+        server_open(conn, value, width, height, NULL, ss);
+    } else if (!strcmp(type, "whatif")) {
+        server_whatif(ss, line);
+    } else if (!strcmp(type, "hash")) {
+        server_select(ss);
+        json_printf(&conn->outbuf, "{\"type\":\"hash\",\"session\":");
+        json_string(&conn->outbuf, id, strlen(id));
+        json_printf(&conn->outbuf, ",\"hash\":\"%016llx\",\"full\":\"%016llx\"}\n", state_hash(), state_hash_full());
+    } else if (!strcmp(type, "hibernate")) {
+        if (ss->session->state != ZRUN_INPUT || !(bytes = server_hibernate(ss))) {
+            send_error(conn, id, "unable to hibernate session");
+            return;
+        }
+        json_printf(&conn->outbuf, "{\"type\":\"hibernate\",\"session\":");
+        json_string(&conn->outbuf, id, strlen(id));
+        json_printf(&conn->outbuf, ",\"bytes\":%d}\n", bytes);
+    } else if (!strcmp(type, "world")) {
+        server_world(ss, line);
+    } else if (!strcmp(type, "trace")) {
+        server_trace(ss, line);
+    } else if (!strcmp(type, "monitor")) {
+        server_monitor(ss, line);
+    } else if (!strcmp(type, "close")) {
+        server_close(ss);
+        json_printf(&conn->outbuf, "{\"type\":\"closed\",\"session\":");
+        json_string(&conn->outbuf, id, strlen(id));
+        json_append(&conn->outbuf, "}\n", 2);
+    } else {
+        send_error(conn, id, "unknown request type");
+    }
+}
+
+static void send_error(connection_t *conn, char *id, char *message) {
+    json_printf(&conn->outbuf, "{\"type\":\"error\"");
+    if (id) {
+        json_printf(&conn->outbuf, ",\"session\":");
+        json_string(&conn->outbuf, id, strlen(id));
+    }
+    json_printf(&conn->outbuf, ",\"message\":");
+    json_string(&conn->outbuf, message, strlen(message));
+    json_append(&conn->outbuf, "}\n", 2);
+}
+
+/* everything the session's windows gained since the last update - the session must be selected */
+static void send_update(server_session_t *ss) {
+    jsonbuf_t *out;
+    winid_t win;
+    char *text;
+    glui32 len, width, height, y;
+    int first, trim;
+
+    out = &ss->owner->outbuf;
+    json_printf(out, "{\"type\":\"update\",\"session\":");
+    json_string(out, ss->id, strlen(ss->id));
+    json_printf(out, ",\"gen\":%d,\"state\":\"%s\"", ++ss->gen,
+                ss->session->state == ZRUN_INPUT ? "input" : (ss->session->state == ZRUN_QUIT ? "quit" : "error"));
+    if (ss->session->state == ZRUN_INPUT)
+        json_printf(out, ",\"input\":\"%s\"", zInput->type == INPUT_CHAR ? "char" : "line");
+
+    json_printf(out, ",\"windows\":[");
+    first = TRUE;
+    for (win = glk_window_iterate(NULL, NULL); win; win = glk_window_iterate(win, NULL)) {
+        if (glk_window_get_type(win) != wintype_TextBuffer)
+            continue;
+        text = memglk_window_text(win, &len);
+        if (len || memglk_window_cleared(win)) {
+            json_printf(out, "%s{\"id\":%u", first ? "" : ",", glk_window_get_rock(win));
+            if (memglk_window_cleared(win))
+                json_printf(out, ",\"clear\":true");
+            json_printf(out, ",\"text\":");
+            json_string(out, text, len);
+            json_append(out, "}", 1);
+            first = FALSE;
+        }
+        memglk_window_consume(win);
+    }
+    json_append(out, "]", 1);
+
+    for (win = glk_window_iterate(NULL, NULL); win; win = glk_window_iterate(win, NULL)) {
+        if (glk_window_get_type(win) != wintype_TextGrid || !memglk_window_dirty(win))
+            continue;
+        text = memglk_window_cells(win, &width, &height);
+        if (win == statuswin) {
+            json_printf(out, ",\"status\":");
+        } else {
+            json_printf(out, ",\"upper\":");
+        }
+        if (win != statuswin)
+            json_append(out, "[", 1);
+        for (y = 0; y < height; y++) {
+            for (trim = width; trim > 0 && text[y * width + trim - 1] == ' '; trim--) ;
+            if (y)
+                json_append(out, ",", 1);
+            json_string(out, text + y * width, trim);
+            if (win == statuswin)
+                break;
+        }
+        if (win != statuswin)
+            json_append(out, "]", 1);
+        memglk_window_consume(win);
+    }
+    json_append(out, "}\n", 2);
+}
+
+/* sessions */
+
+static unsigned int session_hash(char *id) {
+    unsigned int hash = 5381;
+
+    while (*id)
+        hash = hash * 33 + (unsigned char) *id++;
+    return hash % SESSION_BUCKETS;
+}
+
+static server_session_t *session_find(char *id) {
+    server_session_t *ss;
+
+    for (ss = sessions[session_hash(id)]; ss; ss = ss->next) {
+        if (!strcmp(ss->id, id))
+            return ss;
+    }
+    return NULL;
+}
+
+static void server_select(server_session_t *ss) {
+    memglk_set_context(ss->glk);
+    session_switch(ss->session);
+}
+
+/* a new session: a new game, one resumed from a snapshot file, or a copy of parent's */
+static void server_open(connection_t *conn, char *id, long width, long height, char *snapshot,
+                        server_session_t *parent) {
+    server_session_t *ss;
+    unsigned int bucket;
+
+    ss = calloc(1, sizeof(server_session_t));
+    if (!ss) {
+        send_error(conn, id, "out of memory");
+        return;
+    }
+    strncpy(ss->id, id, SESSION_ID_MAX - 1);
+    ss->owner = conn;
+    ss->active = now();
+    ss->glk = memglk_context_create(width, height);
+    if (ss->glk) {
+        memglk_set_hooks(ss->glk, &server_hooks, ss);
+        memglk_set_context(ss->glk);
+        ss->session = parent ? session_fork(parent->session, ss) : session_create(ss);
+    }
+    if (ss->session && snapshot && !snapshot_load(snapshot)) {
+        session_destroy(ss->session);
+        ss->session = NULL;
+    }
+    if (!ss->session) {
+        memglk_context_destroy(ss->glk);
+        free(ss);
+        send_error(conn, id, snapshot ? "unable to resume session" : "unable to start session");
+        return;
+    }
+
+    bucket = session_hash(ss->id);
+    ss->next = sessions[bucket];
+    sessions[bucket] = ss;
+
+    /* a resumed or forked game is normally waiting on a read; it carries on when that comes */
+    if ((snapshot || parent) && zInput->type != INPUT_NONE) {
+        read_resume();
+        ss->session->state = ZRUN_INPUT;
+        send_update(ss);
+        return;
+    }
+    server_run(ss);
+}
+
+static void server_input(server_session_t *ss, int type, char *value) {
+    int ok;
+
+    server_select(ss);
+    if (ss->session->state != ZRUN_INPUT || zInput->type != type) {
+        send_error(ss->owner, ss->id, type == INPUT_LINE ? "session is not waiting for a line" : "session is not waiting for a key");
+        return;
+    }
+
+    if (type == INPUT_LINE) {
+        ok = memglk_line_input(value, strlen(value));
+    } else {
+        ok = memglk_char_input(value[0] ? (unsigned char) value[0] : keycode_Return);
+    }
+    if (!ok) {
+        send_error(ss->owner, ss->id, "no window is waiting for input");
+        return;
+    }
+    server_run(ss);
+}
+
+static void server_whatif(server_session_t *ss, char *line) {
+    zwhatif_t results[WHATIF_MAX];
+    char commands[WHATIF_MAX][VALUE_MAX];
+    jsonbuf_t *out;
+    int count, i, j;
+
+    for (count = 0; count < WHATIF_MAX; count++) {
+        if (!json_get_array_string(line, "commands", count, commands[count], VALUE_MAX))
+            break;
+        results[count].command = commands[count];
+    }
+    server_select(ss);
+    if (!count || !session_whatif(ss->session, results, count)) {
+        send_error(ss->owner, ss->id, count ? "session is not waiting for input" : "whatif needs commands");
+        return;
+    }
+
+    out = &ss->owner->outbuf;
+    json_printf(out, "{\"type\":\"whatif\",\"session\":");
+    json_string(out, ss->id, strlen(ss->id));
+    json_printf(out, ",\"results\":[");
+    for (i = 0; i < count; i++) {
+        json_printf(out, "%s{\"command\":", i ? "," : "");
+        json_string(out, results[i].command, strlen(results[i].command));
+        json_printf(out, ",\"state\":\"%s\",\"text\":",
+                    results[i].state == ZRUN_INPUT ? "input" : (results[i].state == ZRUN_QUIT ? "quit" : "error"));
+        json_string(out, results[i].text ? results[i].text : "", results[i].text_len);
+        json_printf(out, ",\"bytes\":%d,\"changed\":[", results[i].bytes);
+        for (j = 0; j < results[i].ranges; j++)
+            json_printf(out, "%s[%u,%u]", j ? "," : "", results[i].range_at[j], results[i].range_len[j]);
+        json_printf(out, "],\"hash\":\"%016llx\"}", results[i].hash);
+    }
+    json_append(out, "]}\n", 3);
+    whatif_free(results, count);
+}
+
+static void server_world(server_session_t *ss, char *line) {
+    jsonbuf_t *out;
+    int changed;
+
+    if (!json_get_bool(line, "changed", &changed))
+        changed = FALSE;
+    server_select(ss);
+    out = &ss->owner->outbuf;
+    json_printf(out, "{\"type\":\"world\",\"session\":");
+    json_string(out, ss->id, strlen(ss->id));
+    json_printf(out, ",\"objects\":");
+    world_export(out, &ss->world, changed);
+    json_append(out, "}\n", 2);
+}
+
+static void server_trace(server_session_t *ss, char *line) {
+    char name[VALUE_MAX], filename[PATH_MAX];
+    jsonbuf_t *out;
+    int on;
+
+    server_select(ss);
+    if (json_get_string(line, "file", name, sizeof(name))) {
+        if (!server_file(ss->owner, ss->id, name, filename))
+            return;
+        if (!trace_save(filename)) {
+            send_error(ss->owner, ss->id, "unable to write trace");
+            return;
+        }
+    }
+    if (json_get_bool(line, "on", &on)) {
+        if (!on) {
+            trace_stop();
+        } else if (!trace_start(TRACE_RECORDS)) {
+            send_error(ss->owner, ss->id, "unable to start trace");
+            return;
+        }
+    }
+    out = &ss->owner->outbuf;
+    json_printf(out, "{\"type\":\"trace\",\"session\":");
+    json_string(out, ss->id, strlen(ss->id));
+    json_printf(out, ",\"tracing\":%s,\"records\":%lu}\n", zTrace ? "true" : "false",
+                zTrace ? (zTrace->next < zTrace->size ? zTrace->next : zTrace->size) : 0UL);
+}
+
+/* one monitor command, its output caught in a memory stream rather than the game's window */
+static void server_monitor(server_session_t *ss, char *line) {
+    char command[VALUE_MAX], *text;
+    stream_result_t result;
+    strid_t stream, current;
+    jsonbuf_t *out;
+
+    if (!json_get_string(line, "command", command, sizeof(command)) || !command[0]
+        || strchr("cnq", glk_char_to_lower(command[0]))) {
+        send_error(ss->owner, ss->id, "not a monitor command");
+        return;
+    }
+    text = malloc(MONITOR_TEXT);
+    if (!text) {
+        send_error(ss->owner, ss->id, "out of memory");
+        return;
+    }
+    server_select(ss);
+    current = glk_stream_get_current();
+    stream = glk_stream_open_memory(text, MONITOR_TEXT, filemode_Write, 0);
+    glk_stream_set_current(stream);
+    debug_command(command);
+    glk_stream_close(stream, &result);
+    glk_stream_set_current(current);
+
+    out = &ss->owner->outbuf;
+    json_printf(out, "{\"type\":\"monitor\",\"session\":");
+    json_string(out, ss->id, strlen(ss->id));
+    json_printf(out, ",\"text\":");
+    json_string(out, text, result.writecount < MONITOR_TEXT ? result.writecount : MONITOR_TEXT);
+    json_append(out, "}\n", 2);
+    free(text);
+}
+
+static void server_profile(connection_t *conn, char *line) {
+    char name[VALUE_MAX], filename[PATH_MAX];
+    zprofile_routine_t **routines;
+    int on, n;
+
+    if (json_get_bool(line, "reset", &on) && on)
+        profile_reset();
+    if (json_get_bool(line, "on", &on))
+        zProfiling = on;
+    if (json_get_string(line, "file", name, sizeof(name))) {
+        if (!server_file(conn, NULL, name, filename))
+            return;
+        if (!profile_save(filename)) {
+            send_error(conn, NULL, "unable to write profile");
+            return;
+        }
+    }
+    n = profile_routines(&routines);
+    if (n >= 0)
+        free(routines);
+    json_printf(&conn->outbuf, "{\"type\":\"profile\",\"profiling\":%s,\"instructions\":%llu,\"routines\":%d}\n",
+                zProfiling ? "true" : "false", profile_count(), n < 0 ? 0 : n);
+}
+
+static void server_sample(connection_t *conn, char *line) {
+    static int sampling = FALSE;
+    char name[VALUE_MAX], filename[PATH_MAX];
+    unsigned long samples, dropped;
+    long rate;
+    int on;
+
+    if (json_get_bool(line, "on", &on)) {
+        if (!json_get_number(line, "rate", &rate) || rate < 1)
+            rate = SAMPLE_HZ;
+        if (!on) {
+            sample_stop();
+        } else if (!sample_start(rate)) {
+            send_error(conn, NULL, "unable to start sampling");
+            return;
+        }
+        sampling = on;
+    }
+    samples = sample_count();
+    dropped = sample_dropped();
+    if (json_get_string(line, "file", name, sizeof(name))) {
+        if (!server_file(conn, NULL, name, filename))
+            return;
+        if (!sample_save(filename)) {
+            send_error(conn, NULL, "unable to write samples");
+            return;
+        }
+    }
+    json_printf(&conn->outbuf, "{\"type\":\"sample\",\"sampling\":%s,\"samples\":%lu,\"dropped\":%lu}\n",
+                sampling ? "true" : "false", samples, dropped);
+}
+
+static void server_stats(connection_t *conn, char *line) {
+    char id[SESSION_ID_MAX];
+    server_session_t *ss;
+
+    ss = NULL;
+    if (json_get_string(line, "session", id, sizeof(id))) {
+        ss = session_find(id);
+        if (!ss || ss->owner != conn) {
+            send_error(conn, id, ss ? "session belongs to another connection" : "no such session");
+            return;
+        }
+    }
+    json_printf(&conn->outbuf, "{\"type\":\"stats\",\"process\":");
+    stats_json(&conn->outbuf, stats_process());
+    if (ss) {
+        json_printf(&conn->outbuf, ",\"session\":");
+        json_string(&conn->outbuf, id, strlen(id));
+        json_printf(&conn->outbuf, ",\"game\":");
+        /* a hibernated session's counters went with it */
+        stats_json(&conn->outbuf, ss->hibernated ? &ss->hibernated->session.stats : &ss->session->stats);
+    }
+    json_printf(&conn->outbuf, ",\"latency\":{\"story\":");
+    latency_json(&conn->outbuf, latency_story());
+    if (ss && (ss->hibernated ? ss->hibernated->session.latency : ss->session->latency)) {
+        json_printf(&conn->outbuf, ",\"game\":");
+        latency_json(&conn->outbuf, ss->hibernated ? ss->hibernated->session.latency : ss->session->latency);
+    }
+    json_append(&conn->outbuf, "}}\n", 3);
+}
+
+static void server_run(server_session_t *ss) {
+    server_select(ss);
+    ss->session->state = zerp_execute();
+    if (ss->session->state == ZRUN_INPUT && autosave_dir && zAutosaveTurns > 0 && ++ss->turns % zAutosaveTurns == 0)
+        server_autosave(ss);
+    send_update(ss);
+    if (ss->session->state != ZRUN_INPUT)
+        server_close(ss);
+}
+
+/* snapshot to dir/<session>.zsnp, with anything in the id that can't go in a file name made safe */
+static void server_autosave(server_session_t *ss) {
+    char filename[PATH_MAX];
+    int len, i;
+
+    len = snprintf(filename, sizeof(filename), "%s/%s.zsnp", autosave_dir, ss->id);
+    if (len >= (int) sizeof(filename))
+        return;
+    for (i = strlen(autosave_dir) + 1; i < len - 5; i++) {
+        if (!isalnum((unsigned char) filename[i]) && filename[i] != '-' && filename[i] != '_' && filename[i] != '.')
+            filename[i] = '_';
+    }
+    autosave(filename);
+}
+
+/*
+    A file a client names (snapshots, traces, profiles, samples) is under
+    the -f directory: it must be relative and not climb out with "..".
+    Puts the full name in path (PATH_MAX) or sends an error.
+*/
+static int server_file(connection_t *conn, char *id, char *name, char *path) {
+    char *p;
+
+    if (!file_dir) {
+        send_error(conn, id, "no file directory (-f)");
+        return FALSE;
+    }
+    /* p stops at a ".." component, if there is one */
+    for (p = name; *p; p++) {
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+            break;
+        p = strchr(p, '/');
+        if (!p)
+            p = name + strlen(name) - 1;
+    }
+    if (!*name || *name == '/' || *p) {
+        send_error(conn, id, "bad file name");
+        return FALSE;
+    }
+    if (snprintf(path, PATH_MAX, "%s/%s", file_dir, name) >= PATH_MAX) {
+        send_error(conn, id, "file name too long");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void server_close(server_session_t *ss) {
+    server_session_t **link;
+
+    for (link = &sessions[session_hash(ss->id)]; *link && *link != ss; link = &(*link)->next) ;
+    if (*link)
+        *link = ss->next;
+
+    server_select(ss);
+    if (ss->hibernated) {
+        hibernate_free(ss->hibernated);
+    } else {
+        session_destroy(ss->session);
+    }
+    memglk_context_destroy(ss->glk);
+    world_mark_free(&ss->world);
+    free(ss);
+}
+
+/*
+    Sessions that have been waiting for input for hibernate_after seconds
+    or more (if that's more than 0) are hibernated; of the rest, those
+    that have waited dedup_after seconds (if that's not negative) share
+    their memory.
+*/
+static void server_idle(int dedup_after, int hibernate_after) {
+    server_session_t *ss;
+    time_t t;
+    int i;
+
+    t = now();
+    for (i = 0; i < SESSION_BUCKETS; i++) {
+        for (ss = sessions[i]; ss; ss = ss->next) {
+            if (!ss->session || ss->session->state != ZRUN_INPUT)
+                continue;
+            if (hibernate_after > 0 && t - ss->active >= hibernate_after && server_hibernate(ss))
+                continue;
+            if (dedup_after >= 0 && t - ss->active >= dedup_after)
+                dedup_arena(ss->session->arena);
+        }
+    }
+}
+
+/* returns the hibernated size, or 0 if the session is still awake */
+static int server_hibernate(server_session_t *ss) {
+    zhibernated_t *hibernated;
+
+    server_select(ss);
+    hibernated = session_hibernate(ss->session);
+    if (!hibernated)
+        return 0;
+    ss->hibernated = hibernated;
+    ss->session = NULL;
+    return sizeof(zhibernated_t) + hibernated->len;
+}
+
+static int server_wake(server_session_t *ss) {
+    zsession_t *session;
+
+    memglk_set_context(ss->glk);
+    session = session_wake(ss->hibernated);
+    if (!session)
+        return FALSE;
+    ss->session = session;
+    ss->hibernated = NULL;
+    read_resume();
+    return TRUE;
+}
+
+static time_t now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* glk_exit() from inside a session ends that session, not the server */
+static void server_exit(memglk_context_t *ctx) {
+    (void) ctx;
+    zerp_abort();
+}
@@ -0,0 +1,181 @@
+/*
+    Zerp: a Z-machine interpreter
+    session.c : many games of one story in one process
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "json.h"
+#include "stats.h"
+#include "latency.h"
+#include "session.h"
+#include "arena.h"
+#include "opcodes.h"
+#include "trace.h"
+
+zsession_t *zSession = NULL;
+
+static void session_save(zsession_t *session);
+static void session_load(zsession_t *session);
+
+/*
+    Start a new game of the loaded story. Windows are opened in the current
+    Glk context, so the caller must have selected the one this session
+    should use. The new session is left switched in and stopped at its
+    start; zerp_execute() runs it.
+
+    The session itself lives in its arena, next to the game's memory and
+    stacks, so it costs one allocation and goes away with it.
+*/
+zsession_t *session_create(void *data) {
+    zsession_t *session;
+    zarena_t *arena;
+
+    arena = arena_create(sizeof(zsession_t));
+    if (!arena)
+        return NULL;
+    session = arena->data;
+    session->arena = arena;
+    session->data = data;
+    session_switch(session);
+    latency_start();
+
+    open_windows();
+    if (!mainwin || !zerp_start()) {
+        session_destroy(session);
+        return NULL;
+    }
+    session->state = ZRUN_RUNNING;
+
+    return session;
+}
+
+/*
+    A new session carrying on from where parent is, which is left as it
+    was. Memory is cloned a page at a time (arena_clone()) and only the
+    live parts of the stacks are copied, so this costs about what the game
+    has changed, not the size of the story. Undo history isn't copied.
+
+    As with session_create(), windows are opened in the current Glk
+    context. They start empty, and Glk hasn't been asked for the read
+    parent is waiting on (see read_resume()).
+*/
+zsession_t *session_fork(zsession_t *parent, void *data) {
+    zsession_t *session;
+    zarena_t *arena;
+    zstack_frame_t *frame;
+    int stack_len, frames_len;
+
+    session_switch(parent);
+    arena = arena_clone(parent->arena, sizeof(zsession_t));
+    if (!arena)
+        return NULL;
+    session = arena->data;
+    session->arena = arena;
+    session->data = data;
+    memset(&session->stats, 0, sizeof(zstats_t));
+
+    stack_len = zSP - zStack + 1;
+    frames_len = zFP - zCallStack + 1;
+    memcpy(arena->stack, zStack, stack_len * sizeof(zword_t));
+    memcpy(arena->call_stack, zCallStack, frames_len * sizeof(zstack_frame_t));
+    for (frame = arena->call_stack; frame < arena->call_stack + frames_len; frame++)
+        frame->sp = arena->stack + (frame->sp - zStack);
+    session->sp = arena->stack + stack_len - 1;
+    session->fp = arena->call_stack + frames_len - 1;
+    session->pc = zPC;
+    session->random_state = zRandomState;
+    session->input = *zInput;
+    session->state = parent->state;
+
+    session_switch(session);
+    latency_start();
+    open_windows();
+    if (!mainwin) {
+        session_destroy(session);
+        return NULL;
+    }
+    return session;
+}
+
+/* Free a session and its game. Its Glk windows belong to the caller. */
+void session_destroy(zsession_t *session) {
+    if (!session)
+        return;
+
+    session_switch(session);
+    zerp_stop();
+    trace_stop();
+    latency_stop();
+    mainwin = statuswin = upperwin = NULL;
+
+    stats_switch(NULL);
+    zSession = NULL;
+    arena_destroy(session->arena);
+}
+
+/*
+    Start the session's game again from the beginning, in the memory it
+    already has. Any read it was waiting on is cancelled and the screen is
+    put back as a new session would find it.
+*/
+int session_reset(zsession_t *session) {
+    session_switch(session);
+    if (zInput->type == INPUT_LINE)
+        glk_cancel_line_event(mainwin, NULL);
+    if (zInput->type == INPUT_CHAR)
+        glk_cancel_char_event(mainwin);
+    reset_windows();
+
+    if (!arena_reset(session->arena) || !zerp_start())
+        return FALSE;
+    session->state = ZRUN_RUNNING;
+    return TRUE;
+}
+
+/* Make session the one the interpreter runs. NULL just switches out the current one. */
+void session_switch(zsession_t *session) {
+    if (session == zSession)
+        return;
+    if (zSession)
+        session_save(zSession);
+    zSession = session;
+    if (session)
+        session_load(session);
+}
+
+static void session_save(zsession_t *session) {
+    session->sp = zSP;
+    session->fp = zFP;
+    session->pc = zPC;
+    session->random_state = zRandomState;
+    session->mainwin = mainwin;
+    session->statuswin = statuswin;
+    session->upperwin = upperwin;
+    session->trace = zTrace;
+    session->latency = zLatency;
+    zLatency = NULL;
+    stats_switch(NULL);
+}
+
+static void session_load(zsession_t *session) {
+    arena_use(session->arena);
+    zSP = session->sp;
+    zFP = session->fp;
+    zPC = session->pc;
+    zRandomState = session->random_state;
+    zInput = &session->input;
+    mainwin = session->mainwin;
+    statuswin = session->statuswin;
+    upperwin = session->upperwin;
+    zTrace = session->trace;
+    zLatency = session->latency;
+    stats_switch(&session->stats);
+}
@@ -0,0 +1,41 @@
+/*
+    Zerp: a Z-machine interpreter
+    session.h : many games of one story in one process
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+/*
+    The interpreter works on globals (zMachine, zPC, zSP and friends).
+    A session holds a copy of them while it is switched out, and
+    session_switch() swaps one set out and another in. Memory and stacks
+    come from the session's arena (arena.c), and its counters (stats.c)
+    are kept here; its turn latencies (latency.c) are malloc()ed, so
+    that a hibernated session stays small. The story itself (zGamefile
+    and the addresses read from its header) is shared.
+*/
+typedef struct zsession {
+    struct zarena *arena;
+    zword_t *sp;
+    zstack_frame_t *fp;
+    packed_addr_t pc;
+    unsigned int random_state;
+    zinput_t input;
+    winid_t mainwin, statuswin, upperwin;
+    int state;
+    struct ztrace *trace;
+    zstats_t stats;
+    struct zlatency *latency;
+    void *data;
+} zsession_t;
+
+extern zsession_t *zSession;
+
+zsession_t *session_create(void *data);
+zsession_t *session_fork(zsession_t *parent, void *data);
+void session_destroy(zsession_t *session);
+int session_reset(zsession_t *session);
+void session_switch(zsession_t *session);
+
+#endif /* SESSION_H */
@@ -0,0 +1,185 @@
+/*
+    Zerp: a Z-machine interpreter
+    snapshot.c : native snapshots, for suspending and resuming sessions
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "arena.h"
+#include "snapshot.h"
+#include "hash.h"
+#include "variables.h"
+
+#define align(n) (((n) + SNAPSHOT_ALIGN - 1) & ~(SNAPSHOT_ALIGN - 1))
+#define BYTE_ORDER_MARK 0x0102
+
+/* The running game as a snapshot, in a malloc()ed buffer; NULL if there's no memory for it. */
+unsigned char *snapshot_encode(size_t *len) {
+    zsnapshot_t header;
+    zstack_frame_t *frames;
+    unsigned char *data;
+    unsigned int i;
+    int page;
+
+    memset(&header, 0, sizeof(zsnapshot_t));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    memcpy(header.release, zGamefile + RELEASE, 2);
+    memcpy(header.serial, zGamefile + SERIAL, 6);
+    memcpy(header.checksum, zGamefile + CHECKSUM, 2);
+    header.pc = zPC;
+    header.random_state = zRandomState;
+    header.input = *zInput;
+
+    for (page = 0; page < ZPAGES && (page << ZPAGE_SHIFT) < zFilesize; page++) {
+        if (zPageStamp[page])
+            header.page[header.pages++] = page;
+    }
+    header.stack_len = zSP - zStack + 1;
+    header.frames_len = zFP - zCallStack + 1;
+    header.pages_at = align(sizeof(zsnapshot_t));
+    header.stack_at = align(header.pages_at + header.pages * ZPAGE_SIZE);
+    header.frames_at = align(header.stack_at + header.stack_len * sizeof(zword_t));
+    header.size = header.frames_at + header.frames_len * sizeof(zstack_frame_t);
+
+    data = calloc(1, header.size);
+    if (!data)
+        return NULL;
+    memcpy(data, &header, sizeof(zsnapshot_t));
+    for (i = 0; i < header.pages; i++)
+        memcpy(data + header.pages_at + i * ZPAGE_SIZE, zMachine + (header.page[i] << ZPAGE_SHIFT), ZPAGE_SIZE);
+    memcpy(data + header.stack_at, zStack, header.stack_len * sizeof(zword_t));
+    frames = (zstack_frame_t *) (data + header.frames_at);
+    memcpy(frames, zCallStack, header.frames_len * sizeof(zstack_frame_t));
+    for (i = 0; i < header.frames_len; i++)
+        frames[i].sp = (zword_t *) (size_t) (zCallStack[i].sp - zStack);
+
+    *len = header.size;
+    return data;
+}
+
+/*
+    Make the running game the one in the snapshot. Memory first goes back
+    to the story (only pages the game has written are copied), then the
+    snapshot's pages go over it. A snapshot that doesn't fit this story,
+    this build or its own length leaves the game alone and returns FALSE.
+
+    A read the game was waiting on comes back in zInput, but Glk isn't
+    asked for it: see read_resume().
+*/
+int snapshot_attach(unsigned char *data, size_t len) {
+    zsnapshot_t *header;
+    zstack_frame_t *frame;
+    unsigned int i;
+
+    header = (zsnapshot_t *) data;
+    if (!zArena || len < sizeof(zsnapshot_t) || memcmp(header->magic, SNAPSHOT_MAGIC, 4)
+        || header->version != SNAPSHOT_VERSION || header->byte_order != BYTE_ORDER_MARK
+        || header->size != len)
+        return FALSE;
+    if (memcmp(header->release, zGamefile + RELEASE, 2) || memcmp(header->serial, zGamefile + SERIAL, 6)
+        || memcmp(header->checksum, zGamefile + CHECKSUM, 2))
+        return FALSE;
+    if (header->pages > ZPAGES || header->pages_at < sizeof(zsnapshot_t)
+        || header->stack_len < 1 || header->stack_len > STACKSIZE
+        || header->frames_len < 1 || header->frames_len > CALLSTACKSIZE
+        || header->pages_at + (size_t) header->pages * ZPAGE_SIZE > header->stack_at
+        || header->stack_at + (size_t) header->stack_len * sizeof(zword_t) > header->frames_at
+        || header->frames_at + (size_t) header->frames_len * sizeof(zstack_frame_t) > len
+        || header->pc >= (packed_addr_t) zFilesize)
+        return FALSE;
+    for (i = 0; i < header->pages; i++) {
+        if ((header->page[i] << ZPAGE_SHIFT) >= zFilesize)
+            return FALSE;
+    }
+    frame = (zstack_frame_t *) (data + header->frames_at);
+    for (i = 0; i < header->frames_len; i++) {
+        if ((size_t) frame[i].sp + frame[i].local_count >= header->stack_len)
+            return FALSE;
+    }
+
+    arena_restore(zArena);
+    for (i = 0; i < header->pages; i++) {
+        hash_overwrite(header->page[i] << ZPAGE_SHIFT, data + header->pages_at + i * ZPAGE_SIZE, ZPAGE_SIZE);
+        memcpy(zMachine + (header->page[i] << ZPAGE_SHIFT), data + header->pages_at + i * ZPAGE_SIZE, ZPAGE_SIZE);
+        zPageStamp[header->page[i]] = zDirtyStamp;
+    }
+    globals_load();
+    memcpy(zStack, data + header->stack_at, header->stack_len * sizeof(zword_t));
+    zSP = zStack + header->stack_len - 1;
+    memcpy(zCallStack, frame, header->frames_len * sizeof(zstack_frame_t));
+    zFP = zCallStack + header->frames_len - 1;
+    for (frame = zCallStack; frame <= zFP; frame++)
+        frame->sp = zStack + (size_t) frame->sp;
+    zPC = header->pc;
+    zRandomState = header->random_state;
+    *zInput = header->input;
+    return TRUE;
+}
+
+/* Write a snapshot of the running game to filename. Returns its size, or 0 if that failed. */
+int snapshot_save(char *filename) {
+    unsigned char *data;
+    size_t len;
+    int ok;
+
+    data = snapshot_encode(&len);
+    if (!data)
+        return 0;
+    ok = snapshot_write(filename, data, len, FALSE);
+    free(data);
+    return ok ? len : 0;
+}
+
+/* Write an encoded snapshot to filename, and with sync wait for it to reach the disk. */
+int snapshot_write(char *filename, unsigned char *data, size_t len, int sync) {
+    size_t done;
+    ssize_t wrote;
+    int fd;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (done = 0; fd >= 0 && done < len; done += wrote) {
+        wrote = write(fd, data + done, len - done);
+        if (wrote <= 0)
+            break;
+    }
+    if (fd >= 0 && sync && done == len && fsync(fd))
+        done = 0;
+    if (fd < 0 || close(fd) || done < len)
+        return FALSE;
+    return TRUE;
+}
+
+/* Resume the running game from a snapshot file, which is mapped rather than read. */
+int snapshot_load(char *filename) {
+    struct stat info;
+    void *data;
+    int fd, attached;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+    if (fstat(fd, &info) || info.st_size < (off_t) sizeof(zsnapshot_t)) {
+        close(fd);
+        return FALSE;
+    }
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return FALSE;
+    attached = snapshot_attach(data, info.st_size);
+    munmap(data, info.st_size);
+    return attached;
+}
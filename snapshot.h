@@ -0,0 +1,56 @@
+/*
+    Zerp: a Z-machine interpreter
+    snapshot.h : native snapshots, for suspending and resuming sessions
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+
+#define SNAPSHOT_MAGIC      "ZSNP"
+#define SNAPSHOT_VERSION    2
+#define SNAPSHOT_ALIGN      64
+
+/*
+    A snapshot is the running game as this build of zerp holds it, for
+    putting it back quickly rather than for interchange (that's Quetzal,
+    quetzal.c). It is laid out the way the interpreter wants it, so
+    resuming one is a handful of memcpy()s straight out of a mapping of
+    the file:
+
+        the header      this struct
+        pages           each page of memory written since the game
+                        started, in the order listed in page[]
+        stack           the value stack, from zStack to zSP
+        frames          the call stack, from zCallStack to zFP, with each
+                        frame's sp stored as an index into the stack
+
+    Each part starts on a SNAPSHOT_ALIGN boundary. Numbers are in the
+    machine's own byte order; a snapshot from a machine that differs is
+    rejected along with one from another story or another version.
+*/
+typedef struct zsnapshot {
+    char magic[4];
+    unsigned short version;
+    unsigned short byte_order;
+    unsigned int size;
+    zbyte_t release[2];
+    zbyte_t serial[6];
+    zbyte_t checksum[2];
+    packed_addr_t pc;
+    unsigned int random_state;
+    zinput_t input;
+    unsigned int pages, pages_at;
+    unsigned int stack_len, stack_at;
+    unsigned int frames_len, frames_at;
+    zbyte_t page[ZPAGES];
+} zsnapshot_t;
+
+unsigned char *snapshot_encode(size_t *len);
+int snapshot_attach(unsigned char *data, size_t len);
+int snapshot_save(char *filename);
+int snapshot_write(char *filename, unsigned char *data, size_t len, int sync);
+int snapshot_load(char *filename);
+
+#endif /* SNAPSHOT_H */
@@ -13,11 +13,13 @@
 #include "zerp.h"
 #include "opcodes.h"
 #include "stack.h"
+#include "variables.h"
+#include "profile.h"
+#include "json.h"
+#include "stats.h"
 
+/* no room check: running off the top hits the stack's guard page (see arena.h) */
 int stack_push(zword_t value) {
-    if (zSP >= zStackTop) {
-        fatal_error("Value stack overflow!\n");
-    }
     *(++zSP) = value;
     LOG(ZDEBUG, "\nStack: push - size now %li, frame usage %li (pushed #%x)", 2051 - (zSP - zStack), (zSP - zFP->sp) - 1, value); 
     return value;
@@ -26,7 +28,7 @@ int stack_push(zword_t value) {
 zword_t stack_pop() {
     zword_t value;
 
-    if (zSP < zFP->sp) {
+    if (zSP < frame_bottom(zFP)) {
         fatal_error("Value stack underflow!\n");
     }
     value =  *(zSP--);
@@ -52,75 +54,123 @@ zword_t stack_poke(zword_t value) {
     return *(zSP) = value;
 }
 
-zstack_frame_t * call_zroutine(packed_addr_t address, zoperand_t *operands, zbyte_t ret_store, int keep_return){
+/*
+    Routine headers, by address: the local count and the locals' initial
+    values (from the header before V5, zeros from then on) in native
+    order, ready to be copied onto the stack in one go. Routines live in
+    high memory, which never changes, so an entry stays good; the rare
+    routine below the static memory mark isn't cached.
+*/
+#define ROUTINE_CACHE   1024
+
+typedef struct zroutine {
+    packed_addr_t address;
+    packed_addr_t code;
     zbyte_t local_count;
+    zword_t defaults[15];
+} zroutine_t;
+
+static zroutine_t zRoutines[ROUTINE_CACHE];
+
+static zroutine_t *routine_header(packed_addr_t address) {
+    static zroutine_t uncached;
+    zroutine_t *routine;
+    int i;
+
+    routine = &zRoutines[(address >> 1) & (ROUTINE_CACHE - 1)];
+    if (routine->address == address) {
+        stat_add(STAT_ROUTINE_HITS, 1);
+        return routine;
+    }
+    stat_add(STAT_ROUTINE_MISSES, 1);
+    if (address < get_word(STATIC_MEM))
+        routine = &uncached;
+
+    routine->address = address;
+    routine->local_count = get_byte(address) & 0x0f;
+    address++;
+    if (zGameVersion < Z_VERSION_5) {
+        /* defaults for locals stored after local count in V3/V4 */
+        for (i = 0; i < routine->local_count; i++, address += 2)
+            routine->defaults[i] = get_word(address);
+    } else {
+        memset(routine->defaults, 0, sizeof(routine->defaults));
+    }
+    routine->code = address;
+    return routine;
+}
+
+zstack_frame_t * call_zroutine(packed_addr_t address, zoperand_t *operands, zbyte_t ret_store, int keep_return){
+    zroutine_t *routine;
     zstack_frame_t *newFrame;
-    int i = 0;
-		packed_addr_t routine;
+    zword_t args[8], *locals;
+    int argc, i;
 
-		routine = address;
+    /* arguments first, as taking them can pop the caller's stack */
+    for (argc = 0; operands[argc].type != NONE; argc++)
+        args[argc] = operand_value(&operands[argc]);
 
     if (address == 0) {
-        variable_set(ret_store, 0);
-        return;
+        if (keep_return)
+            variable_set(ret_store, 0);
+        return zFP;
     }
-    
-    newFrame = zFP +1;
-    if (newFrame > zCallStackTop)
-        fatal_error("Call stack overflow");
-    
-	/* stack frames will be reused, so zero the new one out */
-	memset(newFrame, 0, sizeof(zstack_frame_t));
+
+    /* both stacks are guarded, so no room checks here either */
+    newFrame = zFP + 1;
+    routine = routine_header(address);
 
     newFrame->pc = zPC;
     newFrame->sp = zSP;
     newFrame->ret_store = ret_store;
 	newFrame->ret_keep = keep_return;
-   
-	local_count = get_byte(address++);
-	if (zGameVersion < Z_VERSION_5) {
-		/* defaults for locals stored after local count in V3/V4 */
-	    for (i = 0; i < local_count; i++) {
-	        newFrame->locals[i] = get_word(address);
-	        address += 2;
-	    }
-	}
-   
-	i = 0;
-    while (operands->type != NONE) {
-		newFrame->args |= (1 << i);
-        newFrame->locals[i++] = operands->type == VARIABLE ? variable_get(operands->bytes) : operands->bytes;
-        operands++;
-    }
-    
-	LOG(ZDEBUG, "\nCALL $%x -> V%03i", routine, ret_store)
-    zPC = address;
-    zSP++;
-    
-    return zFP++;
+	newFrame->args = (1 << argc) - 1;
+	newFrame->local_count = routine->local_count;
+    newFrame->routine = address;
+    newFrame->entry = 0;
+
+    locals = zSP + 1;
+    memcpy(locals, routine->defaults, routine->local_count * sizeof(zword_t));
+    for (i = 0; i < argc && i < routine->local_count; i++)
+        locals[i] = args[i];
+    zSP += routine->local_count;
+
+	LOG(ZDEBUG, "\nCALL $%x -> V%03i", address, ret_store)
+    zPC = routine->code;
+    zFP = newFrame;
+    stat_add(STAT_CALLS, 1);
+    stat_max(STAT_MAX_DEPTH, (unsigned long long) (newFrame - zCallStack))
+    profile_enter(newFrame)
+    return newFrame;
 }
 
+/* Back to the caller, storing the result straight into the stack, a local or a global */
 zstack_frame_t *return_zroutine(zword_t ret_value) {
+    zstack_frame_t *frame;
     zbyte_t ret_store;
-	int ret_keep;
-    
-    if ((zFP - 1) < zCallStack)
+
+    frame = zFP;
+    if (frame == zCallStack)
         fatal_error("Call stack underflow");
-    
-	if (zFP->ret_keep)
-	    LOG(ZDEBUG, "\nReturned %i into V%x (%05x)", ret_value, zFP->ret_store, zFP->pc)
-	LOG(ZDEBUG, "\nStack: returned, discarded %li outstanding items (stack top now #%hn, size %li, frame usage %li)",
-				zSP - zFP->sp, (zFP - 1)->sp, (zSP - (zFP - 1)->sp) - (zSP - zFP->sp),(zFP - 1) - zCallStack)
-
-    zSP = zFP->sp;
-    zPC = zFP->pc;
-    ret_store = zFP->ret_store;
-	ret_keep = zFP->ret_keep;
-
-    zFP--;
-    
-	if (ret_keep)
-	    variable_set(ret_store, ret_value);
 
+	if (frame->ret_keep)
+	    LOG(ZDEBUG, "\nReturned %i into V%x (%05x)", ret_value, frame->ret_store, frame->pc)
+
+    profile_leave(frame)
+    stat_add(STAT_RETURNS, 1);
+    zSP = frame->sp;
+    zPC = frame->pc;
+    zFP = frame - 1;
+    if (!frame->ret_keep)
+        return zFP;
+
+    ret_store = frame->ret_store;
+    if (ret_store == 0) {
+        *(++zSP) = ret_value;
+    } else if (ret_store < 0x10) {
+        frame_locals(zFP)[ret_store - 1] = ret_value;
+    } else {
+        store_word(zGlobals + ((ret_store - 0x10) * 2), ret_value);
+    }
     return zFP;
 }
@@ -12,4 +12,31 @@ zword_t stack_pop();
 zstack_frame_t *call_zroutine(packed_addr_t address, zoperand_t *operands, zbyte_t ret_store, int keep_return);
 zstack_frame_t *return_zroutine(zword_t ret_store);
 
+/*
+    The fast paths for the main loop: an operand already decoded to its
+    kind, and a store to a variable, with no logging.
+*/
+static inline zword_t operand_value(zoperand_t *operand) {
+    switch (operand->kind) {
+        case OPERAND_CONST:
+            return operand->bytes;
+        case OPERAND_LOCAL:
+            return zFP->sp[operand->bytes];
+        case OPERAND_GLOBAL:
+            return zGlobalValues[operand->bytes - 0x10];
+        default:
+            return stack_pop();
+    }
+}
+
+static inline void variable_store(zbyte_t variable, zword_t value) {
+    if (variable >= 0x10) {
+        store_word(zGlobals + (variable - 0x10) * 2, value)
+    } else if (variable) {
+        zFP->sp[variable] = value;
+    } else {
+        stack_push(value);
+    }
+}
+
 #endif STACK_H
\ No newline at end of file
@@ -0,0 +1,199 @@
+/*
+    Zerp: a Z-machine interpreter
+    stats.c : counters for each game and for the whole process
+
+    Counting is a single add to the current game's counters, through
+    zStats, so it is cheap enough to leave on everywhere. Sessions carry
+    their own set and session_switch() points zStats at it; the process
+    totals are brought up to date from the difference since the last
+    fold, so they cover games that have been closed as well as those
+    still running. Counters named max_ are the largest seen, not sums.
+
+    A summary of the totals (and of the current game's counters, if
+    there is one), with the turn latencies (latency.c), is written as
+    one line of JSON by stats_dump(): when
+    the process exits, from main.c and the server, and when SIGUSR1 is
+    seen, once stats_signal() has asked for it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "json.h"
+#include "arena.h"
+#include "stats.h"
+#include "latency.h"
+
+static char *zStatNames[STAT_COUNT] = {
+    "instructions", "calls", "returns", "max_depth",
+    "routine_cache_hits", "routine_cache_misses", "dictionary_lookups", "dictionary_misses",
+    "property_lookups", "object_moves", "chars_printed", "glk_calls",
+    "lines_tokenised", "turns", "dirty_bytes", "max_dirty_bytes"
+};
+
+static zstats_t zDefaultStats;
+static zstats_t zProcessStats;
+
+zstats_t *zStats = &zDefaultStats;
+char *zStatsFile = NULL;
+
+static volatile sig_atomic_t zStatsRequested = 0;
+
+static void stats_request(int sig);
+static int stat_is_max(int stat);
+
+/* Count into stats from now on (NULL: the shared set), folding in what the last set counted */
+void stats_switch(zstats_t *stats) {
+    stats_flush();
+    zStats = stats ? stats : &zDefaultStats;
+}
+
+/* Bring the process totals up to date with the current game's counters */
+void stats_flush() {
+    int i;
+
+    for (i = 0; i < STAT_COUNT; i++) {
+        if (stat_is_max(i)) {
+            if (zStats->count[i] > zProcessStats.count[i])
+                zProcessStats.count[i] = zStats->count[i];
+        } else {
+            zProcessStats.count[i] += zStats->count[i] - zStats->flushed[i];
+        }
+        zStats->flushed[i] = zStats->count[i];
+    }
+}
+
+/* Start the current game's counters again from nothing; the totals keep what they had */
+void stats_reset() {
+    stats_flush();
+    memset(zStats->count, 0, sizeof(zStats->count));
+    memset(zStats->flushed, 0, sizeof(zStats->flushed));
+}
+
+/* Input has been taken: zerp_execute() is about to run the turn */
+void stats_turn_begin() {
+    zStats->turn_stamp = arena_checkpoint();
+    zStats->in_turn = TRUE;
+}
+
+/* The turn is over (the game wants input again, or has stopped): count what it wrote */
+void stats_turn_end() {
+    unsigned char dirty[ZPAGES / 8];
+    unsigned long long bytes;
+
+    if (!zStats->in_turn)
+        return;
+    zStats->in_turn = FALSE;
+    bytes = zArena ? (unsigned long long) arena_dirty_pages(zStats->turn_stamp, dirty) * ZPAGE_SIZE : 0;
+    stat_add(STAT_TURNS, 1);
+    stat_add(STAT_DIRTY_BYTES, bytes);
+    stat_max(STAT_MAX_DIRTY_BYTES, bytes);
+}
+
+/* The process totals, up to date */
+zstats_t *stats_process() {
+    stats_flush();
+    return &zProcessStats;
+}
+
+/* stats as a JSON object of counters */
+void stats_json(jsonbuf_t *out, zstats_t *stats) {
+    int i;
+
+    json_append(out, "{", 1);
+    for (i = 0; i < STAT_COUNT; i++)
+        json_printf(out, "%s\"%s\":%llu", i ? "," : "", zStatNames[i], stats->count[i]);
+    json_append(out, "}", 1);
+}
+
+/*
+    Write a summary line to zStatsFile (appending) or stderr: which story,
+    the process totals and the current game's counters, then the story's
+    turn latencies and the game's. why says what prompted it, e.g. "exit"
+    or "signal".
+*/
+void stats_dump(char *why) {
+    jsonbuf_t buf;
+
+    memset(&buf, 0, sizeof(buf));
+    json_printf(&buf, "{\"type\":\"stats\",\"why\":");
+    json_string(&buf, why, strlen(why));
+    stats_story(&buf);
+    json_printf(&buf, ",\"process\":");
+    stats_json(&buf, stats_process());
+    if (zStats != &zDefaultStats || zArena) {
+        json_printf(&buf, ",\"game\":");
+        stats_json(&buf, zStats);
+    }
+    json_printf(&buf, ",\"latency\":{\"story\":");
+    latency_json(&buf, latency_story());
+    if (zLatency) {
+        json_printf(&buf, ",\"game\":");
+        latency_json(&buf, zLatency);
+    }
+    json_append(&buf, "}}\n", 3);
+    stats_write(&buf);
+    json_free(&buf);
+}
+
+/* ,"story":{...}: which story this is, if one is loaded */
+void stats_story(jsonbuf_t *out) {
+    int i;
+
+    if (!zGamefile)
+        return;
+    json_printf(out, ",\"story\":{\"release\":%d,\"serial\":\"", zGamefile[RELEASE] << 8 | zGamefile[RELEASE + 1]);
+    for (i = 0; i < 6; i++)
+        json_printf(out, "%c", zGamefile[SERIAL + i] >= ' ' && zGamefile[SERIAL + i] < 0x7f
+                    && zGamefile[SERIAL + i] != '"' && zGamefile[SERIAL + i] != '\\' ? zGamefile[SERIAL + i] : '?');
+    json_printf(out, "\",\"checksum\":%d}", zGamefile[CHECKSUM] << 8 | zGamefile[CHECKSUM + 1]);
+}
+
+/* Write a line of JSON where summaries go: appended to zStatsFile, or to stderr */
+void stats_write(jsonbuf_t *buf) {
+    FILE *out;
+
+    out = zStatsFile ? fopen(zStatsFile, "a") : stderr;
+    if (!out)
+        return;
+    fwrite(buf->data, 1, buf->len, out);
+    if (out != stderr)
+        fclose(out);
+    else
+        fflush(out);
+}
+
+/* Let SIGUSR1 ask for a summary; stats_poll() writes it */
+void stats_signal() {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stats_request;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* Write the summary SIGUSR1 asked for, if it has. Called between turns, and by the server between requests. */
+void stats_poll() {
+    if (!zStatsRequested)
+        return;
+    zStatsRequested = 0;
+    stats_dump("signal");
+}
+
+static void stats_request(int sig) {
+    (void) sig;
+    zStatsRequested = 1;
+}
+
+static int stat_is_max(int stat) {
+    return stat == STAT_MAX_DEPTH || stat == STAT_MAX_DIRTY_BYTES;
+}
@@ -0,0 +1,70 @@
+/*
+    Zerp: a Z-machine interpreter
+    stats.h : counters for each game and for the whole process
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+/* the counters; the names stats_json() gives them are in stats.c */
+enum {
+    STAT_INSTRUCTIONS,
+    STAT_CALLS,
+    STAT_RETURNS,
+    STAT_MAX_DEPTH,             /* deepest call stack, in frames */
+    STAT_ROUTINE_HITS,          /* routine header cache (stack.c) */
+    STAT_ROUTINE_MISSES,
+    STAT_DICT_LOOKUPS,
+    STAT_DICT_MISSES,
+    STAT_PROPERTY_LOOKUPS,
+    STAT_OBJECT_MOVES,
+    STAT_CHARS_PRINTED,
+    STAT_GLK_CALLS,
+    STAT_LINES_TOKENISED,
+    STAT_TURNS,                 /* input taken, to the next read */
+    STAT_DIRTY_BYTES,           /* dynamic memory written in those turns, in whole pages */
+    STAT_MAX_DIRTY_BYTES,       /* the most in one turn */
+    STAT_COUNT
+};
+
+/*
+    A game's counters. The interpreter adds to the current game's
+    (zStats) as it goes, and they are folded into the process's totals
+    whenever the game is switched out or the totals are read: flushed
+    is how much of each has been folded in already. A turn runs from
+    input being taken to the next read; turn_stamp is the arena
+    checkpoint it started at (see arena.c), which tells what it wrote.
+*/
+typedef struct zstats {
+    unsigned long long count[STAT_COUNT];
+    unsigned long long flushed[STAT_COUNT];
+    unsigned int turn_stamp;
+    int in_turn;
+} zstats_t;
+
+/* the current game's counters; sessions keep their own, anything else shares one set */
+extern zstats_t *zStats;
+
+/* set (e.g. from the command line) to write summaries there rather than to stderr */
+extern char *zStatsFile;
+
+#define stat_add(stat, n) (zStats->count[stat] += (n))
+#define stat_max(stat, n) if ((n) > zStats->count[stat]) { zStats->count[stat] = (n); }
+/* a Glk call, and one that printed chars characters */
+#define stat_glk() (zStats->count[STAT_GLK_CALLS]++)
+#define stat_print(chars) (zStats->count[STAT_GLK_CALLS]++, zStats->count[STAT_CHARS_PRINTED] += (chars))
+
+void stats_switch(zstats_t *stats);
+void stats_flush();
+void stats_reset();
+void stats_turn_begin();
+void stats_turn_end();
+zstats_t *stats_process();
+void stats_json(jsonbuf_t *out, zstats_t *stats);
+void stats_dump(char *why);
+void stats_story(jsonbuf_t *out);
+void stats_write(jsonbuf_t *buf);
+void stats_signal();
+void stats_poll();
+
+#endif /* STATS_H */
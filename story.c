@@ -0,0 +1,188 @@
+/*
+    Zerp: a Z-machine interpreter
+    story.c : the story image, shared between sessions and processes
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "zscii.h"
+#include "parse.h"
+#include "story.h"
+
+int zStoryFd = -1;
+zdict_entry_t *zDictIndex = NULL;
+int zDictIndexSize = 0;
+char *zAbbreviation[ABBREVIATIONS];
+int zAbbreviationLength[ABBREVIATIONS];
+
+static size_t zStorySize = 0;
+
+static unsigned long long dict_key(zword_t address, int words);
+static int dict_compare(const void *a, const void *b);
+
+/*
+    Build the shared region: the story image first (so it can be mapped on
+    its own, at offset 0), then the dictionary index, then the decoded
+    abbreviations. Must be called with the story loaded and before any
+    session starts. Returns FALSE, leaving the story as it was, if the
+    region can't be made.
+*/
+int story_share() {
+    unsigned char *region, *machine;
+    char decoded[ZSTRING_MAX], *text, *grown;
+    int offsets[ABBREVIATIONS];
+    strid_t str, current;
+    stream_result_t result;
+    zword_t header, first, table, address;
+    size_t page, image_size, index_size, text_size, text_len;
+    int entry_length, entries, words, i, fd;
+
+    if (!zGamefile || zStorySize)
+        return FALSE;
+
+    /* the decoders read through zMachine, so point it at the story for now */
+    machine = zMachine;
+    zMachine = zGamefile;
+
+    /* decode each abbreviation once, into a memory stream */
+    text = NULL;
+    text_len = 0;
+    table = get_word(ABBRV);
+    current = glk_stream_get_current();
+    for (i = 0; i < ABBREVIATIONS; i++) {
+        offsets[i] = -1;
+        if (!table || table + i * 2 + 1 >= zFilesize)
+            continue;
+        address = get_word(table + i * 2);
+        if (!address || address * 2 >= zFilesize)
+            continue;
+        str = glk_stream_open_memory(decoded, sizeof(decoded), filemode_Write, 0);
+        if (!str)
+            continue;
+        glk_stream_set_current(str);
+        print_zstring(address * 2);
+        glk_stream_close(str, &result);
+        if (result.writecount > sizeof(decoded))
+            result.writecount = sizeof(decoded);
+        grown = realloc(text, text_len + result.writecount + 1);
+        if (!grown)
+            continue;
+        text = grown;
+        memcpy(text + text_len, decoded, result.writecount);
+        offsets[i] = text_len;
+        zAbbreviationLength[i] = result.writecount;
+        text_len += result.writecount;
+    }
+    glk_stream_set_current(current);
+
+    /* the main dictionary - a negative count means unsorted, which the index doesn't mind */
+    header = get_word(DICTIONARY);
+    entry_length = get_byte(header + get_byte(header) + 1);
+    entries = (short) get_word(header + get_byte(header) + 2);
+    if (entries < 0)
+        entries = -entries;
+    first = header + get_byte(header) + 4;
+    if (entry_length < 4 || first + entries * entry_length > zFilesize)
+        entries = 0;
+    words = zGameVersion < Z_VERSION_4 ? DICT_RESOLUTION_V3 : DICT_RESOLUTION_V4;
+
+    page = sysconf(_SC_PAGESIZE);
+    image_size = (zFilesize + page - 1) & ~(page - 1);
+    index_size = (entries * sizeof(zdict_entry_t) + page - 1) & ~(page - 1);
+    text_size = (text_len + page) & ~(page - 1);
+
+    region = MAP_FAILED;
+    fd = -1;
+#ifdef __linux__
+    fd = memfd_create("zerp-story", MFD_CLOEXEC);
+    if (fd >= 0 && ftruncate(fd, image_size + index_size + text_size) == 0)
+        region = mmap(NULL, image_size + index_size + text_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED && fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+#endif
+    if (region == MAP_FAILED)
+        region = mmap(NULL, image_size + index_size + text_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        free(text);
+        zMachine = machine;
+        return FALSE;
+    }
+
+    memcpy(region, zGamefile, zFilesize);
+
+    zDictIndex = (zdict_entry_t *) (region + image_size);
+    for (i = 0; i < entries; i++) {
+        zDictIndex[i].address = first + i * entry_length;
+        zDictIndex[i].key = dict_key(zDictIndex[i].address, words);
+    }
+    qsort(zDictIndex, entries, sizeof(zdict_entry_t), dict_compare);
+    zDictIndexSize = entries;
+
+    if (text_len)
+        memcpy(region + image_size + index_size, text, text_len);
+    for (i = 0; i < ABBREVIATIONS; i++)
+        zAbbreviation[i] = offsets[i] < 0 ? NULL : (char *) region + image_size + index_size + offsets[i];
+    free(text);
+
+    mprotect(region, image_size + index_size + text_size, PROT_READ);
+    free(zGamefile);
+    zGamefile = region;
+    zStoryFd = fd;
+    zStorySize = image_size + index_size + text_size;
+    zMachine = machine;
+
+    return TRUE;
+}
+
+/* Find a word (zstring, words long) in the dictionary index. 0 if it isn't there. */
+zword_t story_lookup(zword_t *zstring, int words) {
+    unsigned long long key;
+    int low, high, mid, i;
+
+    for (key = 0, i = 0; i < 3; i++)
+        key = (key << 16) | (i < words ? zstring[i] : 0);
+
+    /* the first entry with this key, so duplicates resolve as a linear search would */
+    low = 0;
+    high = zDictIndexSize;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (zDictIndex[mid].key < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < zDictIndexSize && zDictIndex[low].key == key)
+        return zDictIndex[low].address;
+    return 0;
+}
+
+static unsigned long long dict_key(zword_t address, int words) {
+    unsigned long long key;
+    int i;
+
+    for (key = 0, i = 0; i < 3; i++)
+        key = (key << 16) | (i < words ? get_word(address + i * 2) : 0);
+    return key;
+}
+
+static int dict_compare(const void *a, const void *b) {
+    const zdict_entry_t *x = a, *y = b;
+
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->address < y->address ? -1 : (x->address > y->address);
+}
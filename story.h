@@ -0,0 +1,34 @@
+/*
+    Zerp: a Z-machine interpreter
+    story.h : the story image, shared between sessions and processes
+*/
+
+#ifndef STORY_H
+#define STORY_H
+
+#define ABBREVIATIONS 96
+
+/* a dictionary word's encoded text, packed into one key for binary search */
+typedef struct zdict_entry {
+    unsigned long long key;
+    zword_t address;
+} zdict_entry_t;
+
+/*
+    story_share() moves the loaded story into a read-only shared mapping
+    (a memfd on Linux) along with what can be worked out from it once: a
+    sorted index of the dictionary and the decoded abbreviations. Anything
+    forked afterwards shares those pages, and each game's arena (arena.c)
+    maps the image privately over them, so a game only owns the pages it
+    writes - in practice its dynamic memory.
+*/
+extern int zStoryFd;
+extern zdict_entry_t *zDictIndex;
+extern int zDictIndexSize;
+extern char *zAbbreviation[ABBREVIATIONS];
+extern int zAbbreviationLength[ABBREVIATIONS];
+
+int story_share();
+zword_t story_lookup(zword_t *zstring, int words);
+
+#endif /* STORY_H */
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Check that UNDO works the same across a hibernate/wake cycle in zerp-server.
+#
+# usage: test/hibernate_undo.sh storyfile [command]
+#
+# Plays command (default "take") and then "undo" twice over, once straight
+# through and once with the session hibernated in between, and fails if the
+# game's replies differ, or if the undo wasn't done ("Undone." not printed).
+
+story=${1:?usage: $0 storyfile [command]}
+command=${2:-take}
+server=${ZERP_SERVER:-./zerp-server}
+
+play() {
+    {
+        echo '{"type":"open","session":"u"}'
+        echo "{\"type\":\"line\",\"session\":\"u\",\"value\":\"$command\"}"
+        [ "$1" = hibernate ] && echo '{"type":"hibernate","session":"u"}'
+        echo '{"type":"line","session":"u","value":"undo"}'
+        echo "{\"type\":\"line\",\"session\":\"u\",\"value\":\"$command\"}"
+        [ "$1" = hibernate ] && echo '{"type":"hibernate","session":"u"}'
+        echo '{"type":"line","session":"u","value":"undo"}'
+        echo '{"type":"close","session":"u"}'
+    } | "$server" "$story" 2>/dev/null | grep '"type":"update"' | sed 's/"gen":[0-9]*,//'
+}
+
+straight=$(play) || exit 1
+hibernated=$(play hibernate) || exit 1
+
+if [ "$straight" != "$hibernated" ]; then
+    echo "hibernate_undo: replies differ after a hibernate"
+    echo "without: $straight"
+    echo "with:    $hibernated"
+    exit 1
+fi
+if ! echo "$hibernated" | grep -q 'Undone'; then
+    echo "hibernate_undo: undo wasn't done"
+    echo "$hibernated"
+    exit 1
+fi
+echo "hibernate_undo: ok"
@@ -0,0 +1,86 @@
+#!/bin/sh
+# Check that RESTORE reads a Quetzal file with uncompressed memory (UMem) as
+# well as the CMem zerp writes.
+#
+# usage: test/save_umem.sh [storyfile]
+#
+# Runs the unit test story (default test/unittests.z5) in zerp-headless,
+# which saves and restores through the same file, then turns that save into
+# one with UMem and runs the story again, restoring that one instead. Both
+# runs must get back the memory, locals and stack they saved.
+
+story=${1:-test/unittests.z5}
+headless=${ZERP_HEADLESS:-./zerp-headless}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# answers the save prompt with $1 and the restore prompt with $2
+play() {
+    printf '%s\n%s\n' "$1" "$2" | "$headless" "$story" 2>/dev/null
+}
+
+# The save as octal escapes for printf, with CMem replaced by UMem. CMem is
+# the game's dynamic memory XORed with the story's, a 0 and a count standing
+# for count + 1 zeros, and stops at the last change.
+to_umem() {
+    { od -An -v -tu1 "$story"; echo --; od -An -v -tu1 "$1"; } | awk '
+        function xor(a, b,   r, bit) {
+            r = 0
+            for (bit = 1; a || b; bit *= 2) {
+                if (a % 2 != b % 2)
+                    r += bit
+                a = int(a / 2)
+                b = int(b / 2)
+            }
+            return r
+        }
+        function byte(b) { body = body sprintf("\\%03o", b); size++ }
+        function word(n) { byte(int(n / 16777216) % 256); byte(int(n / 65536) % 256); byte(int(n / 256) % 256); byte(n % 256) }
+        $1 == "--" { save = 1; next }
+        { for (i = 1; i <= NF; i++) if (save) q[nq++] = $i + 0; else s[ns++] = $i + 0 }
+        END {
+            dynamic = s[14] * 256 + s[15]
+            for (p = 12; p + 8 <= nq; p += 8 + len + len % 2) {
+                id = sprintf("%c%c%c%c", q[p], q[p + 1], q[p + 2], q[p + 3])
+                len = ((q[p + 4] * 256 + q[p + 5]) * 256 + q[p + 6]) * 256 + q[p + 7]
+                if (id != "CMem") {
+                    for (i = 0; i < 8 + len + len % 2; i++)
+                        byte(q[p + i])
+                    continue
+                }
+                byte(85); byte(77); byte(101); byte(109)
+                word(dynamic)
+                at = 0
+                for (i = p + 8; i < p + 8 + len; i++) {
+                    if (q[i] == 0) {
+                        for (n = q[++i] + 1; n > 0; n--)
+                            byte(s[at++])
+                    } else {
+                        byte(xor(q[i], s[at++]))
+                    }
+                }
+                for (; at < dynamic; at++)
+                    byte(s[at])
+                if (dynamic % 2)
+                    byte(0)
+            }
+            printf "\\106\\117\\122\\115"
+            n = size + 4
+            printf "\\%03o\\%03o\\%03o\\%03o", int(n / 16777216) % 256, int(n / 65536) % 256, int(n / 256) % 256, n % 256
+            printf "\\111\\106\\132\\123%s", body
+        }'
+}
+
+cmem=$(play "$dir/cmem.sav" "$dir/cmem.sav")
+printf "$(to_umem "$dir/cmem.sav")" > "$dir/umem.sav"
+umem=$(play "$dir/again.sav" "$dir/umem.sav")
+
+for run in cmem umem; do
+    eval out=\$$run
+    if ! echo "$out" | grep -q 'Restored memory, locals and stack\.\.\.ok'; then
+        echo "save_umem: restoring $run failed"
+        echo "$out" | grep -A1 'Testing save and restore'
+        exit 1
+    fi
+done
+echo "save_umem: ok"
@@ -0,0 +1,234 @@
+/*
+    Zerp: a Z-machine interpreter
+    trace.c : a ring of the last instructions run, for looking back at
+
+    With -DZTRACE, zerp_execute() hands every instruction to
+    trace_instruction() as it starts, and to trace_result() once it's
+    done, while the game has a ring (zTrace). A record is 16 bytes and
+    holds only what the story can't tell us again: operand values and
+    the result. trace_save() writes the ring out, and trace_decode()
+    prints a saved trace against the story with print_zinstruction(),
+    the way the debugger shows code.
+
+    Tracing is switched on and off at run time: by trace_start() and
+    trace_stop() (the server's "trace" request), or by SIGUSR2 once
+    trace_signal() has named a file, which saves the ring as it stops.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "opcodes.h"
+#include "trace.h"
+
+ztrace_t *zTrace = NULL;
+char *zTraceDecode = NULL;
+
+static char *zTraceFile = NULL;
+static volatile sig_atomic_t zTraceToggle = 0;
+
+static void trace_toggle(int sig);
+static void trace_header(ztrace_header_t *header);
+static zword_t peek_variable(zbyte_t variable);
+
+/* Start tracing the current game into a ring of records records (rounded up to a power of two) */
+int trace_start(int records) {
+    ztrace_t *trace;
+    unsigned int size;
+
+    if (zTrace)
+        return TRUE;
+    for (size = 1; size < (unsigned int) records; size <<= 1) ;
+    trace = malloc(sizeof(ztrace_t) + size * sizeof(ztrace_record_t));
+    if (!trace)
+        return FALSE;
+    trace->size = size;
+    trace->next = 0;
+    trace->frame = NULL;
+    trace->record = (ztrace_record_t *) (trace + 1);
+    zTrace = trace;
+    return TRUE;
+}
+
+void trace_stop() {
+    free(zTrace);
+    zTrace = NULL;
+}
+
+/* Write the current game's ring to filename, oldest record first. FALSE if there's none, or it couldn't. */
+int trace_save(char *filename) {
+    ztrace_header_t header;
+    unsigned long at;
+    FILE *file;
+    int ok;
+
+    if (!zTrace)
+        return FALSE;
+    file = fopen(filename, "wb");
+    if (!file)
+        return FALSE;
+    trace_header(&header);
+    header.count = zTrace->next < zTrace->size ? zTrace->next : zTrace->size;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (at = zTrace->next - header.count; ok && at < zTrace->next; at++)
+        ok = fwrite(&zTrace->record[at & (zTrace->size - 1)], sizeof(ztrace_record_t), 1, file) == 1;
+    if (fclose(file))
+        ok = FALSE;
+    return ok;
+}
+
+/*
+    An instruction is about to run. Its operands haven't been taken yet,
+    so stack operands are read where they sit: the first is the top.
+*/
+void trace_instruction(packed_addr_t pc, zoperand_t *operands) {
+    ztrace_record_t *record;
+    int i, pops;
+
+    record = &zTrace->record[zTrace->next & (zTrace->size - 1)];
+    record->pc = pc;
+    record->flags = 0;
+    record->result = 0;
+    for (i = pops = 0; operands[i].type != NONE; i++) {
+        if (i >= 4)
+            continue;
+        switch (operands[i].kind) {
+            case OPERAND_CONST:
+                record->values[i] = operands[i].bytes;
+                break;
+            case OPERAND_STACK:
+                record->values[i] = zSP[-pops++];
+                break;
+            default:
+                record->values[i] = peek_variable(operands[i].bytes);
+                break;
+        }
+    }
+    record->count = i;
+    zTrace->frame = zFP;
+    zTrace->next++;
+}
+
+/* It has run. What it stored is only there to read if it stayed in the same routine (a call stores on return). */
+void trace_result(int stores, zbyte_t store) {
+    ztrace_record_t *record;
+
+    if (!stores || zFP != zTrace->frame || !zTrace->next)
+        return;
+    record = &zTrace->record[(zTrace->next - 1) & (zTrace->size - 1)];
+    record->result = peek_variable(store);
+    record->flags |= TRACE_RESULT;
+}
+
+/* Let SIGUSR2 switch tracing on and off; switching it off saves the ring to filename. */
+void trace_signal(char *filename) {
+    struct sigaction sa;
+
+    zTraceFile = filename;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_toggle;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+/* Act on SIGUSR2, between instructions: zerp_execute() calls this as it takes in each input */
+void trace_poll() {
+    if (!zTraceToggle)
+        return;
+    zTraceToggle = 0;
+    if (zTrace) {
+        if (zTraceFile)
+            trace_save(zTraceFile);
+        trace_stop();
+    } else {
+        trace_start(TRACE_RECORDS);
+    }
+}
+
+/* The game is over: save its ring to the trace_signal() file, if it's being traced */
+void trace_flush() {
+    if (zTrace && zTraceFile)
+        trace_save(zTraceFile);
+}
+
+/* Print the trace in filename, which must have been made with this story. */
+int trace_decode(char *filename) {
+    ztrace_header_t header, ours;
+    ztrace_record_t record;
+    zinstruction_t instruction;
+    zoperand_t operands[9];
+    zbranch_t branch;
+    zword_t store;
+    FILE *file;
+    int i;
+
+    file = fopen(filename, "rb");
+    if (!file) {
+        glk_printf("Can't open trace %s.\n", filename);
+        return FALSE;
+    }
+    trace_header(&ours);
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, ours.magic, sizeof(header.magic))
+        || header.version != TRACE_VERSION) {
+        glk_printf("%s isn't a trace file.\n", filename);
+        fclose(file);
+        return FALSE;
+    }
+    if (header.release != ours.release || header.checksum != ours.checksum
+        || memcmp(header.serial, ours.serial, sizeof(header.serial))) {
+        glk_printf("%s was traced with another story.\n", filename);
+        fclose(file);
+        return FALSE;
+    }
+
+    while (header.count-- && fread(&record, sizeof(record), 1, file) == 1) {
+        memset(&instruction, 0, sizeof(instruction));
+        memset(operands, 0, sizeof(operands));
+        memset(&branch, 0, sizeof(branch));
+        decode_instruction(record.pc, &instruction, operands, &store, &branch);
+        print_zinstruction(record.pc, &instruction, operands, &store, &branch, 0);
+        if (record.count) {
+            glk_put_string("  [");
+            for (i = 0; i < record.count && i < 4; i++)
+                glk_printf(i ? " %04x" : "%04x", record.values[i]);
+            glk_put_string(record.count > 4 ? " ...]" : "]");
+        }
+        if (record.flags & TRACE_RESULT)
+            glk_printf(" -> %04x", record.result);
+    }
+    glk_put_string("\n");
+    fclose(file);
+    return TRUE;
+}
+
+static void trace_toggle(int sig) {
+    (void) sig;
+    zTraceToggle = 1;
+}
+
+/* the header for a trace of this story, count aside */
+static void trace_header(ztrace_header_t *header) {
+    memset(header, 0, sizeof(ztrace_header_t));
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->release = zGamefile[RELEASE] << 8 | zGamefile[RELEASE + 1];
+    header->checksum = zGamefile[CHECKSUM] << 8 | zGamefile[CHECKSUM + 1];
+    memcpy(header->serial, zGamefile + SERIAL, sizeof(header->serial));
+}
+
+/* a variable's value, without popping or logging */
+static zword_t peek_variable(zbyte_t variable) {
+    if (variable == 0)
+        return *zSP;
+    if (variable < 0x10)
+        return zFP->sp[variable];
+    return zGlobalValues[variable - 0x10];
+}
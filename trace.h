@@ -0,0 +1,80 @@
+/*
+    Zerp: a Z-machine interpreter
+    trace.h : a ring of the last instructions run, for looking back at
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_RECORDS   4096    /* a power of two */
+#define TRACE_MAGIC     "ZTRC"
+#define TRACE_VERSION   1
+
+#define TRACE_RESULT    0x01    /* result holds what the instruction stored */
+
+/*
+    One instruction: where it was, the values of its first four operands
+    as it took them, and what it stored. The opcode and the operands'
+    types aren't kept; they're in the story at pc, which is where the
+    decoder gets them from.
+*/
+typedef struct ztrace_record {
+    packed_addr_t pc;
+    zword_t values[4];
+    zword_t result;
+    zbyte_t count;
+    zbyte_t flags;
+} ztrace_record_t;
+
+/*
+    The ring. next counts every record ever written, so the newest is
+    next - 1 and, once it has wrapped, the oldest is next - size. Only
+    the game's own thread writes, so nothing is locked.
+*/
+typedef struct ztrace {
+    unsigned int size;
+    unsigned long next;
+    zstack_frame_t *frame;
+    ztrace_record_t *record;
+} ztrace_t;
+
+/* A trace file: this header, then count records, oldest first */
+typedef struct ztrace_header {
+    char magic[4];
+    unsigned int version;
+    unsigned int count;
+    zword_t release;
+    zword_t checksum;
+    zbyte_t serial[6];
+} ztrace_header_t;
+
+/* the current game's ring, or NULL if it isn't being traced (sessions keep their own) */
+extern ztrace_t *zTrace;
+
+/* set (e.g. from the command line) to print that trace instead of running the game */
+extern char *zTraceDecode;
+
+/*
+    Tracepoints, in zerp_execute() around each instruction. They are only
+    compiled in with -DZTRACE; even then, an untraced game pays one test
+    of zTrace per instruction.
+*/
+#ifdef ZTRACE
+#define trace_begin(pc, operands) if (zTrace) { trace_instruction((pc), (operands)); }
+#define trace_end(stores, store) if (zTrace) { trace_result((stores), (store)); }
+#else
+#define trace_begin(pc, operands) if (0) {}
+#define trace_end(stores, store) if (0) {}
+#endif /* ZTRACE */
+
+int trace_start(int records);
+void trace_stop();
+int trace_save(char *filename);
+void trace_instruction(packed_addr_t pc, zoperand_t *operands);
+void trace_result(int stores, zbyte_t store);
+void trace_signal(char *filename);
+void trace_poll();
+void trace_flush();
+int trace_decode(char *filename);
+
+#endif /* TRACE_H */
@@ -0,0 +1,219 @@
+/*
+    Zerp: a Z-machine interpreter
+    undo.c : SAVE_UNDO and RESTORE_UNDO
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "arena.h"
+#include "undo.h"
+#include "hash.h"
+#include "variables.h"
+
+#define newest(undo) (&(undo)->entry[((undo)->first + (undo)->count - 1) % UNDO_LEVELS])
+
+static size_t entry_bytes(zundo_entry_t *entry);
+static void drop_oldest(zundo_t *undo);
+static void trim(zundo_t *undo);
+
+/*
+    Snapshot the running game. The snapshot is completed as pages are
+    first written from here on (see undo_touch()). store is the variable
+    RESTORE_UNDO will set to 2. Returns FALSE if there's no memory for it.
+*/
+int undo_save(zbyte_t store) {
+    zundo_t *undo;
+    zundo_entry_t *entry;
+    int stack_len, frames_len;
+    void *grown;
+
+    if (!zArena)
+        return FALSE;
+    undo = zArena->undo;
+    if (!undo) {
+        undo = zArena->undo = calloc(1, sizeof(zundo_t));
+        if (!undo)
+            return FALSE;
+    }
+    if (undo->count == UNDO_LEVELS)
+        drop_oldest(undo);
+
+    entry = &undo->entry[(undo->first + undo->count) % UNDO_LEVELS];
+    stack_len = zSP - zStack + 1;
+    frames_len = zFP - zCallStack + 1;
+    if (stack_len > entry->stack_space) {
+        grown = realloc(entry->stack, stack_len * sizeof(zword_t));
+        if (!grown)
+            return FALSE;
+        entry->stack = grown;
+        entry->stack_space = stack_len;
+    }
+    if (frames_len > entry->frames_space) {
+        grown = realloc(entry->frames, frames_len * sizeof(zstack_frame_t));
+        if (!grown)
+            return FALSE;
+        entry->frames = grown;
+        entry->frames_space = frames_len;
+    }
+
+    memcpy(entry->stack, zStack, stack_len * sizeof(zword_t));
+    entry->stack_len = stack_len;
+    memcpy(entry->frames, zCallStack, frames_len * sizeof(zstack_frame_t));
+    entry->frames_len = frames_len;
+    memset(entry->saved, 0, sizeof(entry->saved));
+    entry->pages = 0;
+    entry->pc = zPC;
+    entry->store = store;
+
+    undo->count++;
+    undo->bytes += entry_bytes(entry);
+    trim(undo);
+
+    /* so the next write to every page comes through undo_touch() */
+    arena_checkpoint();
+    return TRUE;
+}
+
+/* Go back to the last snapshot, and forget it. Sets store to the SAVE_UNDO's store variable. */
+int undo_restore(zbyte_t *store) {
+    zundo_t *undo;
+    zundo_entry_t *entry;
+    int i, page;
+
+    undo = zArena ? zArena->undo : NULL;
+    if (!undo || !undo->count)
+        return FALSE;
+
+    entry = newest(undo);
+    for (i = 0; i < entry->pages; i++) {
+        page = entry->order[i];
+        hash_overwrite(page << ZPAGE_SHIFT, entry->data + i * ZPAGE_SIZE, ZPAGE_SIZE);
+        memcpy(zMachine + (page << ZPAGE_SHIFT), entry->data + i * ZPAGE_SIZE, ZPAGE_SIZE);
+        zPageStamp[page] = zDirtyStamp;
+    }
+    globals_load();
+    memcpy(zStack, entry->stack, entry->stack_len * sizeof(zword_t));
+    zSP = zStack + entry->stack_len - 1;
+    memcpy(zCallStack, entry->frames, entry->frames_len * sizeof(zstack_frame_t));
+    zFP = zCallStack + entry->frames_len - 1;
+    zPC = entry->pc;
+    *store = entry->store;
+
+    undo->bytes -= entry_bytes(entry);
+    undo->count--;
+
+    /* the snapshot before this one collects from here */
+    arena_checkpoint();
+    return TRUE;
+}
+
+/* The game is about to write to page for the first time since the last checkpoint: keep what it holds now. */
+void undo_touch(int page) {
+    zundo_t *undo;
+    zundo_entry_t *entry;
+    void *grown;
+
+    undo = zArena->undo;
+    if (!undo->count || (page << ZPAGE_SHIFT) >= zFilesize)
+        return;
+    entry = newest(undo);
+    if (entry->saved[page >> 3] & (1 << (page & 7)))
+        return;
+
+    if (entry->pages == entry->page_space) {
+        grown = realloc(entry->data, (entry->page_space + 8) * ZPAGE_SIZE);
+        if (!grown) {
+            /* a snapshot missing a page is worse than none */
+            undo_clear(undo);
+            return;
+        }
+        entry->data = grown;
+        entry->page_space += 8;
+    }
+
+    memcpy(entry->data + entry->pages * ZPAGE_SIZE, zMachine + (page << ZPAGE_SHIFT), ZPAGE_SIZE);
+    entry->order[entry->pages++] = page;
+    entry->saved[page >> 3] |= 1 << (page & 7);
+    undo->bytes += ZPAGE_SIZE;
+    trim(undo);
+}
+
+/* Forget every snapshot, keeping the buffers for the next ones */
+void undo_clear(zundo_t *undo) {
+    if (!undo)
+        return;
+    undo->first = undo->count = 0;
+    undo->bytes = 0;
+}
+
+/*
+    Make the snapshots' frames independent of where the stacks are, for
+    a ring kept while its arena goes away (hibernate.c): each frame's sp
+    becomes an offset into the stack, as in a snapshot (snapshot.c), and
+    undo_attach() turns the offsets back into pointers into the current
+    arena's stack.
+*/
+void undo_detach(zundo_t *undo) {
+    zstack_frame_t *frame;
+    int i;
+
+    if (!undo)
+        return;
+    for (i = 0; i < undo->count; i++) {
+        zundo_entry_t *entry = &undo->entry[(undo->first + i) % UNDO_LEVELS];
+
+        for (frame = entry->frames; frame < entry->frames + entry->frames_len; frame++)
+            frame->sp = (zword_t *) (size_t) (frame->sp - zStack);
+    }
+}
+
+void undo_attach(zundo_t *undo) {
+    zstack_frame_t *frame;
+    int i;
+
+    if (!undo)
+        return;
+    for (i = 0; i < undo->count; i++) {
+        zundo_entry_t *entry = &undo->entry[(undo->first + i) % UNDO_LEVELS];
+
+        for (frame = entry->frames; frame < entry->frames + entry->frames_len; frame++)
+            frame->sp = zStack + (size_t) frame->sp;
+    }
+}
+
+void undo_free(zundo_t *undo) {
+    int i;
+
+    if (!undo)
+        return;
+    for (i = 0; i < UNDO_LEVELS; i++) {
+        free(undo->entry[i].data);
+        free(undo->entry[i].stack);
+        free(undo->entry[i].frames);
+    }
+    free(undo);
+}
+
+static size_t entry_bytes(zundo_entry_t *entry) {
+    return entry->pages * ZPAGE_SIZE + entry->stack_len * sizeof(zword_t)
+           + entry->frames_len * sizeof(zstack_frame_t);
+}
+
+static void drop_oldest(zundo_t *undo) {
+    undo->bytes -= entry_bytes(&undo->entry[undo->first]);
+    undo->first = (undo->first + 1) % UNDO_LEVELS;
+    undo->count--;
+}
+
+/* keep within budget, but never drop the snapshot still being filled */
+static void trim(zundo_t *undo) {
+    while (undo->bytes > UNDO_BUDGET && undo->count > 1)
+        drop_oldest(undo);
+}
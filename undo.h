@@ -0,0 +1,47 @@
+/*
+    Zerp: a Z-machine interpreter
+    undo.h : SAVE_UNDO and RESTORE_UNDO
+*/
+
+#ifndef UNDO_H
+#define UNDO_H
+
+#define UNDO_LEVELS     16
+#define UNDO_BUDGET     (256 * 1024)
+
+/*
+    The undo ring keeps up to UNDO_LEVELS snapshots, dropping the oldest
+    when it is full or holds more than UNDO_BUDGET bytes. A snapshot is not
+    a copy of memory: it holds the live part of the stacks when it was
+    taken, and then, as the game writes to a page for the first time since,
+    what that page held before. Restoring copies those pages back, so both
+    cost what the game changed in between - a few pages a turn.
+*/
+typedef struct zundo_entry {
+    unsigned char saved[ZPAGES / 8];
+    unsigned char order[ZPAGES];
+    int pages, page_space;
+    unsigned char *data;
+    zword_t *stack;
+    int stack_len, stack_space;
+    zstack_frame_t *frames;
+    int frames_len, frames_space;
+    packed_addr_t pc;
+    zbyte_t store;
+} zundo_entry_t;
+
+typedef struct zundo {
+    zundo_entry_t entry[UNDO_LEVELS];
+    int first, count;
+    size_t bytes;
+} zundo_t;
+
+int undo_save(zbyte_t store);
+int undo_restore(zbyte_t *store);
+void undo_touch(int page);
+void undo_clear(zundo_t *undo);
+void undo_detach(zundo_t *undo);
+void undo_attach(zundo_t *undo);
+void undo_free(zundo_t *undo);
+
+#endif /* UNDO_H */
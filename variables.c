@@ -14,6 +14,24 @@
 #include "stack.h"
 
 
+/*
+    The globals as native words, so reading one costs what reading a local
+    does. Memory is still the real copy: every store_byte() into the
+    globals table writes through to here, and whatever replaces memory
+    wholesale (switching arena, restart, undo, snapshots) calls
+    globals_load() after.
+*/
+zword_t zGlobalValues[240];
+
+void globals_load() {
+    int g;
+
+    if (!zMachine)
+        return;
+    for (g = 0; g < 240; g++)
+        zGlobalValues[g] = get_word(zGlobals + g * 2);
+}
+
 zword_t variable_get(zbyte_t variable) {
 	zword_t value;
 
@@ -22,10 +40,10 @@ zword_t variable_get(zbyte_t variable) {
         value =  stack_pop();
     } else if (variable > 0 && variable < 0x10) {
         /* read a local */
-        value = zFP->locals[variable - 1];
+        value = zFP->sp[variable];
     } else {
         /* read a global */
-        value =  get_word(zGlobals + ((variable - 0x10) * 2));
+        value =  zGlobalValues[variable - 0x10];
     }
     LOG(ZDEBUG, "\nRead variable #%x (value %i)", variable, value);
 	return value;
@@ -39,10 +57,10 @@ zword_t indirect_variable_get(zbyte_t variable) {
         value = stack_peek();
     } else if (variable > 0 && variable < 0x10) {
         /* read a local */
-        value = zFP->locals[variable - 1];
+        value = zFP->sp[variable];
     } else {
         /* read a global */
-        value = get_word(zGlobals + ((variable - 0x10) * 2));
+        value = zGlobalValues[variable - 0x10];
     }
     LOG(ZDEBUG, "\nRead variable #%x (value %i)", variable, value);
 	return value;
@@ -55,7 +73,7 @@ int variable_set(zbyte_t variable, zword_t value) {
         return stack_push(value);
     } else if (variable > 0 && variable < 0x10) {
         /* write a local */
-        return zFP->locals[variable - 1] = value;
+        return zFP->sp[variable] = value;
     } else {
         /* write a global */
         store_word(zGlobals + ((variable - 0x10) *2), value);
@@ -70,7 +88,7 @@ int indirect_variable_set(zbyte_t variable, zword_t value) {
         return stack_poke(value);
     } else if (variable > 0 && variable < 0x10) {
         /* write a local */
-        return zFP->locals[variable - 1] = value;
+        return zFP->sp[variable] = value;
     } else {
         /* write a global */
         store_word(zGlobals + ((variable - 0x10) *2), value);
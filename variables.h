@@ -8,7 +8,8 @@
 
 zword_t variable_get(unsigned char variable);
 int variable_set(unsigned char variable, zword_t value);
-int indirect_variable_get(zbyte_t variable, zword_t value);
+zword_t indirect_variable_get(zbyte_t variable);
 int indirect_variable_set(zbyte_t variable, zword_t value);
+void globals_load();
 
 #endif /* VARIABLES_H */
\ No newline at end of file
@@ -0,0 +1,197 @@
+/*
+    Zerp: a Z-machine interpreter
+    whatif.c : trying several inputs on one game at once
+
+    Each candidate runs in a child process forked from this one, so it
+    starts from the session exactly as it is, with every page shared
+    copy-on-write by the kernel, and runs on a core of its own. As many
+    children run at once as there are processors. A child plays its
+    input up to the game's next read, writes what happened down a pipe
+    and exits; the session itself never runs.
+
+    Needs memglk, to collect the text the game printed.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "glk.h"
+#include "memglk.h"
+#include "zerp.h"
+#include "json.h"
+#include "stats.h"
+#include "session.h"
+#include "arena.h"
+#include "hash.h"
+#include "whatif.h"
+
+/* what a child sends back, followed by text_len bytes of text */
+typedef struct whatif_report {
+    int state;
+    int text_len;
+    int bytes;
+    int ranges;
+    zword_t range_at[WHATIF_RANGES];
+    zword_t range_len[WHATIF_RANGES];
+    unsigned long long hash;
+} whatif_report_t;
+
+static void whatif_child(char *command, int fd);
+static void whatif_collect(zwhatif_t *result, int fd);
+static int write_all(int fd, void *data, size_t len);
+
+/*
+    Run each of results[0..count-1].command from where session is waiting
+    for input, filling in the rest of each result. session must be the
+    current session, with its Glk context selected, and is left as it
+    was. A candidate that couldn't be run comes back with state
+    ZRUN_ERROR. Returns FALSE if the session isn't waiting for input.
+*/
+int session_whatif(zsession_t *session, zwhatif_t *results, int count) {
+    int *fds, started, done, running, pipefd[2];
+    pid_t *pids;
+
+    if (session != zSession || session->state != ZRUN_INPUT)
+        return FALSE;
+    fds = malloc(count * sizeof(int));
+    pids = malloc(count * sizeof(pid_t));
+    if (!fds || !pids) {
+        free(fds);
+        free(pids);
+        return FALSE;
+    }
+    running = sysconf(_SC_NPROCESSORS_ONLN);
+    if (running < 1)
+        running = 1;
+
+    for (started = done = 0; done < count; done++) {
+        while (started < count && started - done < running) {
+            fds[started] = -1;
+            pids[started] = -1;
+            if (!pipe(pipefd)) {
+                pids[started] = fork();
+                if (pids[started] == 0) {
+                    close(pipefd[0]);
+                    whatif_child(results[started].command, pipefd[1]);
+                }
+                close(pipefd[1]);
+                fds[started] = pipefd[0];
+            }
+            started++;
+        }
+
+        memset(&results[done].state, 0, sizeof(zwhatif_t) - offsetof(zwhatif_t, state));
+        results[done].state = ZRUN_ERROR;
+        if (pids[done] > 0)
+            whatif_collect(&results[done], fds[done]);
+        if (fds[done] >= 0)
+            close(fds[done]);
+        if (pids[done] > 0)
+            waitpid(pids[done], NULL, 0);
+    }
+    free(fds);
+    free(pids);
+    return TRUE;
+}
+
+void whatif_free(zwhatif_t *results, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        free(results[i].text);
+        results[i].text = NULL;
+    }
+}
+
+/* in the child: play command, report and exit */
+static void whatif_child(char *command, int fd) {
+    whatif_report_t report;
+    unsigned char *before;
+    unsigned char dirty[ZPAGES / 8];
+    char *text;
+    glui32 len;
+    unsigned int since;
+    int dynamic, at, ok;
+
+    memset(&report, 0, sizeof(whatif_report_t));
+    dynamic = get_word(STATIC_MEM);
+    before = malloc(dynamic);
+    if (!before)
+        _exit(1);
+    memcpy(before, zMachine, dynamic);
+    since = arena_checkpoint();
+
+    if (zInput->type == INPUT_CHAR) {
+        ok = memglk_char_input(command[0] ? (unsigned char) command[0] : keycode_Return);
+    } else {
+        ok = memglk_line_input(command, strlen(command));
+    }
+    report.state = ok ? zerp_execute() : ZRUN_ERROR;
+
+    /* what changed: only pages written since the checkpoint can differ */
+    arena_dirty_pages(since, dirty);
+    for (at = 0; at < dynamic; at++) {
+        if (!(dirty[(at >> ZPAGE_SHIFT) >> 3] & (1 << ((at >> ZPAGE_SHIFT) & 7)))) {
+            at |= ZPAGE_SIZE - 1;
+            continue;
+        }
+        if (zMachine[at] == before[at])
+            continue;
+        report.bytes++;
+        if (report.ranges && report.range_at[report.ranges - 1] + report.range_len[report.ranges - 1] == at) {
+            report.range_len[report.ranges - 1]++;
+        } else if (report.ranges < WHATIF_RANGES) {
+            report.range_at[report.ranges] = at;
+            report.range_len[report.ranges++] = 1;
+        }
+    }
+    report.hash = state_hash();
+
+    text = mainwin ? memglk_window_text(mainwin, &len) : NULL;
+    report.text_len = text ? len : 0;
+    if (!write_all(fd, &report, sizeof(whatif_report_t)) || !write_all(fd, text, report.text_len))
+        _exit(1);
+    _exit(0);
+}
+
+static void whatif_collect(zwhatif_t *result, int fd) {
+    whatif_report_t report;
+    size_t got;
+    ssize_t n;
+
+    for (got = 0; got < sizeof(whatif_report_t); got += n) {
+        n = read(fd, (char *) &report + got, sizeof(whatif_report_t) - got);
+        if (n <= 0)
+            return;
+    }
+    result->text = malloc(report.text_len + 1);
+    if (!result->text)
+        return;
+    for (got = 0; got < (size_t) report.text_len; got += n) {
+        n = read(fd, result->text + got, report.text_len - got);
+        if (n <= 0)
+            break;
+    }
+    result->text[got] = '\0';
+    result->text_len = got;
+    result->state = report.state;
+    result->bytes = report.bytes;
+    result->ranges = report.ranges;
+    memcpy(result->range_at, report.range_at, sizeof(report.range_at));
+    memcpy(result->range_len, report.range_len, sizeof(report.range_len));
+    result->hash = report.hash;
+}
+
+static int write_all(int fd, void *data, size_t len) {
+    ssize_t n;
+
+    for (; len; len -= n, data = (char *) data + n) {
+        n = write(fd, data, len);
+        if (n <= 0)
+            return FALSE;
+    }
+    return TRUE;
+}
@@ -0,0 +1,33 @@
+/*
+    Zerp: a Z-machine interpreter
+    whatif.h : trying several inputs on one game at once
+*/
+
+#ifndef WHATIF_H
+#define WHATIF_H
+
+#define WHATIF_MAX      64
+#define WHATIF_RANGES   16
+
+/*
+    One candidate input and what it led to. command is the caller's; text
+    is malloc()ed (see whatif_free()). bytes counts the bytes of dynamic
+    memory that changed, and the first WHATIF_RANGES runs of them are
+    listed in range_at and range_len. hash is state_hash() at the end.
+*/
+typedef struct zwhatif {
+    char *command;
+    int state;
+    char *text;
+    int text_len;
+    int bytes;
+    int ranges;
+    zword_t range_at[WHATIF_RANGES];
+    zword_t range_len[WHATIF_RANGES];
+    unsigned long long hash;
+} zwhatif_t;
+
+int session_whatif(zsession_t *session, zwhatif_t *results, int count);
+void whatif_free(zwhatif_t *results, int count);
+
+#endif /* WHATIF_H */
@@ -0,0 +1,179 @@
+/*
+    Zerp: a Z-machine interpreter
+    world.c : the object tree as JSON, read straight from memory
+
+    One pass over the object table gives each object's place in the tree,
+    its attributes, its properties and its short name, without the game
+    running a turn. Asked for changes only, objects whose entry and
+    property table lie on pages nobody has written since the last export
+    are skipped outright; the rest are hashed, and only those whose hash
+    moved are sent.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef TARGET_OS_MAC
+#include <GlkClient/glk.h>
+#else
+#include "glk.h"
+#endif /* TARGET_OS_MAC */
+#include "zerp.h"
+#include "objects.h"
+#include "arena.h"
+#include "json.h"
+#include "world.h"
+
+#define NAME_MAX_LEN    256
+#define FNV_OFFSET      0xcbf29ce484222325ULL
+#define FNV_PRIME       0x100000001b3ULL
+
+static zword_t property_table_end(zword_t table);
+static int pages_written(zword_t at, int len, unsigned int since);
+static unsigned long long object_hash(zword_t entry, int size, zword_t table, zword_t end);
+static void export_object(jsonbuf_t *out, int number, zword_t entry, int size, zword_t table, int first);
+
+/*
+    Append the object tree to out as a JSON array of objects:
+
+        {"id":5,"name":"brass lamp","parent":3,"sibling":0,"child":0,
+         "attributes":"20000000","properties":[{"id":18,"value":1234},
+         {"id":4,"bytes":[1,2,3,4]},...]}
+
+    attributes is the raw attribute bytes in hex, attribute 0 being the top
+    bit of the first byte; properties of one or two bytes give their
+    value, longer ones their bytes. With changed (and a mark from an
+    earlier export) only objects that have changed since then are listed.
+    mark, if not NULL, is brought up to date. Returns the number of
+    objects listed.
+*/
+int world_export(jsonbuf_t *out, zworld_mark_t *mark, int changed) {
+    unsigned long long hash, *hashes;
+    zword_t entry, table, end;
+    int count, size, all, every_page, number, listed;
+
+    count = object_count();
+    all = !changed || !mark || !mark->hashes || mark->count != count;
+    every_page = all || !zArena || mark->epoch != zArena->epoch;
+
+    hashes = NULL;
+    if (mark) {
+        if (mark->count != count) {
+            free(mark->hashes);
+            mark->hashes = malloc(count * sizeof(unsigned long long));
+            mark->count = mark->hashes ? count : 0;
+        }
+        hashes = mark->hashes;
+    }
+
+    json_append(out, "[", 1);
+    for (number = 1, listed = 0; number <= count; number++) {
+        entry = object_address(number, &size);
+        table = object_property_table(number);
+        end = property_table_end(table);
+        if (!every_page && !pages_written(entry, size, mark->stamp) && !pages_written(table, end - table, mark->stamp))
+            continue;
+        if (hashes) {
+            hash = object_hash(entry, size, table, end);
+            if (!all && hash == hashes[number - 1])
+                continue;
+            hashes[number - 1] = hash;
+        }
+        export_object(out, number, entry, size, table, !listed);
+        listed++;
+    }
+    json_append(out, "]", 1);
+
+    if (mark) {
+        mark->epoch = zArena ? zArena->epoch : 0;
+        mark->stamp = arena_checkpoint();
+    }
+    return listed;
+}
+
+void world_mark_free(zworld_mark_t *mark) {
+    free(mark->hashes);
+    memset(mark, 0, sizeof(zworld_mark_t));
+}
+
+/* just past the 0 byte that ends the property table at table */
+static zword_t property_table_end(zword_t table) {
+    zword_t prop;
+    zbyte_t size;
+
+    prop = table + get_byte(table) * 2 + 1;
+    while (prop < zFilesize && (size = get_byte(prop))) {
+        if (zGameVersion >= Z_VERSION_4 && (size & V4_PROP_LEN_MASK))
+            prop++;
+        prop++;
+        prop += get_property_length(prop);
+    }
+    return prop + 1;
+}
+
+/* has any page of the len bytes at at been written since the checkpoint since? */
+static int pages_written(zword_t at, int len, unsigned int since) {
+    int page, last;
+
+    last = (at + len - 1) >> ZPAGE_SHIFT;
+    if (last >= ZPAGES)
+        last = ZPAGES - 1;
+    for (page = at >> ZPAGE_SHIFT; page <= last; page++) {
+        if (zPageStamp[page] > since)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* FNV-1a over the object's entry and its property table */
+static unsigned long long object_hash(zword_t entry, int size, zword_t table, zword_t end) {
+    unsigned long long hash;
+    int at;
+
+    hash = FNV_OFFSET;
+    for (at = entry; at < entry + size; at++)
+        hash = (hash ^ get_byte(at)) * FNV_PRIME;
+    for (at = table; at < end && at < zFilesize; at++)
+        hash = (hash ^ get_byte(at)) * FNV_PRIME;
+    return hash;
+}
+
+static void export_object(jsonbuf_t *out, int number, zword_t entry, int size, zword_t table, int first) {
+    char name[NAME_MAX_LEN];
+    zword_t prop, data;
+    zbyte_t head;
+    int len, i, j;
+
+    (void) size;
+    json_printf(out, "%s{\"id\":%d,\"name\":", first ? "" : ",", number);
+    len = object_name(number, name, sizeof(name));
+    json_string(out, name, len);
+    json_printf(out, ",\"parent\":%d,\"sibling\":%d,\"child\":%d,\"attributes\":\"",
+                object_parent(number), object_sibling(number), object_child(number));
+    /* the attributes come first in the entry: 4 bytes, or 6 from V4 on */
+    for (i = 0; i < (zGameVersion < Z_VERSION_4 ? 4 : 6); i++)
+        json_printf(out, "%02x", get_byte(entry + i));
+    json_append(out, "\",\"properties\":[", 16);
+
+    prop = table + get_byte(table) * 2 + 1;
+    for (i = 0; prop < zFilesize && (head = get_byte(prop)); i++) {
+        data = prop + 1;
+        if (zGameVersion >= Z_VERSION_4 && (head & V4_PROP_LEN_MASK))
+            data++;
+        len = get_property_length(data);
+        json_printf(out, "%s{\"id\":%d,", i ? "," : "",
+                    head & (zGameVersion < Z_VERSION_4 ? V3_PROP_NUM : V4_PROP_NUM));
+        if (len == 1) {
+            json_printf(out, "\"value\":%d}", get_byte(data));
+        } else if (len == 2) {
+            json_printf(out, "\"value\":%d}", get_word(data));
+        } else {
+            json_append(out, "\"bytes\":[", 9);
+            for (j = 0; j < len; j++)
+                json_printf(out, "%s%d", j ? "," : "", get_byte(data + j));
+            json_append(out, "]}", 2);
+        }
+        prop = data + len;
+    }
+    json_append(out, "]}", 2);
+}
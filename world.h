@@ -0,0 +1,24 @@
+/*
+    Zerp: a Z-machine interpreter
+    world.h : the object tree as JSON, read straight from memory
+*/
+
+#ifndef WORLD_H
+#define WORLD_H
+
+/*
+    What the last export saw, so the next one can leave out objects that
+    haven't changed: the arena's epoch and dirty stamp at the time, and a
+    hash of each object's entry and property table. Start from all zeroes.
+*/
+typedef struct zworld_mark {
+    unsigned int epoch;
+    unsigned int stamp;
+    int count;
+    unsigned long long *hashes;
+} zworld_mark_t;
+
+int world_export(jsonbuf_t *out, zworld_mark_t *mark, int changed);
+void world_mark_free(zworld_mark_t *mark);
+
+#endif /* WORLD_H */
@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
 #ifdef TARGET_OS_MAC
 #include <GlkClient/glk.h>
 #else
@@ -14,9 +17,20 @@
 #include "zerp.h"
 #include "opcodes.h"
 #include "stack.h"
+#include "variables.h"
 #include "objects.h"
 #include "parse.h"
 #include "debug.h"
+#include "arena.h"
+#include "undo.h"
+#include "quetzal.h"
+#include "autosave.h"
+#include "trace.h"
+#include "profile.h"
+#include "sample.h"
+#include "json.h"
+#include "stats.h"
+#include "latency.h"
 
 zword_t * zStack = 0;
 zword_t * zSP = 0;
@@ -31,34 +45,38 @@ zword_t zDictionaryHeader = 0;
 zword_t zDictionary = 0;
 packed_addr_t zPC = 0;
 packed_addr_t instructionPC = 0;
+static zinput_t zDefaultInput;
+zinput_t *zInput = &zDefaultInput;
 int zPackedShift = 0;
+unsigned int zRandomState = 1;
 
 static int test_je(zword_t value, zoperand_t *operands);
+static void restart_game();
+static void copy_table(zword_t first, zword_t second, zword_t size);
+static void seed_random(unsigned int seed);
+static unsigned int next_random();
+static int restore_saved_game(zword_t *store, zbranch_t *branch);
 
-/* main interpreter entrypoint */
-int zerp_run() {
-    zinstruction_t instruction;
-    zoperand_t operands[9]; /* 9th op will hold the end of list marker for 8 op opcodes */
-    zbranch_t branch_operand;
-    zword_t store_operand, scratch1, scratch2, scratch3, scratch4;
-    int running;
-
+static jmp_buf zFatalJump;
+static int zFatalActive = FALSE;
 
-    /* intialise the stack and pc */
-    zStack = calloc(STACKSIZE, sizeof(zword_t));
-    zStackTop = zStack + STACKSIZE;
-    zCallStack = calloc(CALLSTACKSIZE, sizeof(zstack_frame_t));
-    zCallStackTop = zCallStack + CALLSTACKSIZE;
-    if (!zStack || !zCallStack) {
-        glk_put_string("Failed to allocate stack space!\n");
-        return;
+/* set up a fresh machine in the current arena - stack pointers, pc and the story's table addresses */
+int zerp_start() {
+    if (!zMachine || !zStack || !zCallStack) {
+        glk_put_string("No memory to run the game in!\n");
+        return FALSE;
     }
     
     zSP = zStack;
     zFP = zCallStack;
     zFP->sp = zSP;
+    zFP->local_count = 0;
+    zFP->args = 0;
+    zFP->routine = get_word(PC_INITIAL);
+    zFP->entry = 0;
     zPC = get_word(PC_INITIAL);
     zGlobals = get_word(GLOBALS);
+    globals_load();
     zProperties = get_word(OBJECT_TABLE);
     zObjects = zProperties + (zGameVersion > Z_VERSION_3 ? 126 : 62);
 	zDictionaryHeader = get_word(DICTIONARY);
@@ -74,12 +92,92 @@ int zerp_run() {
 				zPackedShift = 2;
 				break;
 	}
+    memset(zInput, 0, sizeof(zinput_t));
+    zRandomState = 1;
     set_header_flags();
 
-	running = TRUE;
+    return TRUE;
+}
+
+/* the game is over; its memory belongs to the arena */
+void zerp_stop() {
+    zSP = 0;
+    zFP = 0;
+    zInput = &zDefaultInput;
+}
+
+/* main interpreter entrypoint - run the game to the end, blocking for input */
+int zerp_run() {
+    int state, turns;
+
+    if (!zerp_start())
+        return ZRUN_ERROR;
+    if (zSampleFile)
+        sample_start(zSampleHz);
+
+    /* autosaves are taken at each read the game stops for, and written in the background */
+    for (turns = 1; (state = zerp_execute()) == ZRUN_INPUT; turns++) {
+        if (zAutosaveFile && zAutosaveTurns > 0 && turns % zAutosaveTurns == 0)
+            autosave(zAutosaveFile);
+    }
+
+    /* Done, so clean up */
+    autosave_flush();
+    trace_flush();
+    if (zProfiling && zProfileFile)
+        profile_save(zProfileFile);
+    if (zSampleFile) {
+        sample_stop();
+        sample_save(zSampleFile);
+    }
+    zerp_stop();
+    return state;
+}
+
+/*
+    Fatal errors inside zerp_execute() unwind back to it, so a failing
+    session doesn't take the rest of the process down with it.
+*/
+void zerp_abort() {
+    if (zFatalActive) {
+        zFatalActive = FALSE;
+        longjmp(zFatalJump, 1);
+    }
+}
+
+/*
+    Run until the game quits or wants input. A pending read is completed
+    first (from glk_select(), so this blocks if the Glk library does), then
+    execution continues until the next read request.
+*/
+int zerp_execute() {
+    zinstruction_t instruction;
+    zoperand_t operands[9]; /* 9th op will hold the end of list marker for 8 op opcodes */
+    zbranch_t branch_operand;
+    zword_t store_operand, scratch1, scratch2, scratch3, scratch4;
+    zbyte_t undo_store;
+    int state;
+
+    if (setjmp(zFatalJump)) {
+        zExecuting = FALSE;
+        stats_turn_end();
+        latency_turn_end();
+        return ZRUN_ERROR;
+    }
+    zFatalActive = TRUE;
+    zExecuting = TRUE;
+
+    if (zInput->type != INPUT_NONE) {
+        read_complete();
+        stats_turn_begin();
+    }
+    trace_poll();
+    stats_poll();
+
+	state = ZRUN_RUNNING;
     LOG(ZDEBUG,"Running...\n", 0);
     
-    while (running) {
+    while (state == ZRUN_RUNNING) {
         instructionPC = zPC;
         zword_t res;
         
@@ -88,6 +186,11 @@ int zerp_run() {
         memset(&branch_operand, 0, sizeof(zbranch_t));
         
         zPC += decode_instruction(zPC, &instruction, operands, &store_operand, &branch_operand);
+        trace_begin(instructionPC, operands)
+        profile_begin(instruction.count, instruction.opcode)
+        stat_add(STAT_INSTRUCTIONS, 1);
+        if (zMonitorBreak)
+            debug_break();
 
        // if (zPC >= 0xb2d5 && zPC <= 0xb31c)
        // 	       print_zinstruction(instructionPC, &instruction, operands, &store_operand, &branch_operand, 0);
@@ -101,10 +204,14 @@ int zerp_run() {
                         branch_op(test_je(get_operand(0), &operands[1]))
                         break;
                     case JL:
-                        branch_op((signed short)get_operand(0) < (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        branch_op((signed short)scratch1 < (signed short)scratch2)
                         break;
                     case JG:
-                        branch_op((signed short)get_operand(0) > (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        branch_op((signed short)scratch1 > (signed short)scratch2)
                         break;
                     case DEC_CHK:
                         scratch1 = get_operand(0);
@@ -139,10 +246,14 @@ int zerp_run() {
                         branch_op((scratch1 & scratch2) == scratch2)
                         break;
                     case OR:
-                        store_op(get_operand(0) | get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op(scratch1 | scratch2)
                         break;
                     case AND:
-                        store_op(get_operand(0) & get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op(scratch1 & scratch2)
                         break;
                     case TEST_ATTR:
                         branch_op(get_attribute(get_operand(0), get_operand(1)))
@@ -183,19 +294,29 @@ int zerp_run() {
                         store_op(get_next_property(get_operand(0), get_operand(1)))
                         break;
                     case ADD:
-                        store_op((signed short)get_operand(0) + (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op((signed short)scratch1 + (signed short)scratch2)
                         break;
                     case SUB:
-                        store_op((signed short)get_operand(0) - (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op((signed short)scratch1 - (signed short)scratch2)
                         break;
                     case MUL:
-                        store_op((signed short)get_operand(0) * (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op((signed short)scratch1 * (signed short)scratch2)
                         break;
                     case DIV:
-                        store_op((signed short)get_operand(0) / (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op((signed short)scratch1 / (signed short)scratch2)
                         break;
                     case MOD:
-                        store_op((signed short)get_operand(0) % (signed short)get_operand(1))
+                        scratch1 = get_operand(0);
+                        scratch2 = get_operand(1);
+                        store_op((signed short)scratch1 % (signed short)scratch2)
                         break;
 					case CALL_2S:
 							call_zroutine(unpack(get_operand(0)), &operands[1], store_operand, TRUE);
@@ -307,29 +428,38 @@ int zerp_run() {
                     case PRINT_RET:
                         zPC += print_zstring(zPC);
                         glk_put_string("\n");
+                        stat_print(1);
                         return_zroutine(1);
                         break;
                     case NOP:
                         break;
                     case SAVE:
-						if (zGameVersion < Z_VERSION_3) {
-	                        branch_op(1)
+						/* the file carries on from the branch or store byte, which we've just passed */
+						if (zGameVersion < Z_VERSION_4) {
+	                        branch_op(save_game(zPC - (branch_operand.type == BRANCH_LONG ? 2 : 1)))
 						} else if (zGameVersion == Z_VERSION_4) {
-							store_op(1)
+							store_op(save_game(zPC - 1) ? 1 : 0)
 						} else {
 	                        fatal_error("SAVE illegal in > V4");
 						}
                         break;
                     case RESTORE:
-						if (zGameVersion < Z_VERSION_3) {
-		                      branch_op(1)
+						/* on success we carry on after the SAVE, which now succeeds (V3) or returns 2 */
+						if (zGameVersion < Z_VERSION_4) {
+							scratch3 = restore_saved_game(&store_operand, &branch_operand);
+							branch_op(scratch3)
 						} else if (zGameVersion == Z_VERSION_4) {
-							store_op(1)
+							if (restore_saved_game(&store_operand, &branch_operand)) {
+								store_op(2)
+							} else {
+								store_op(0)
+							}
 						} else {
 	                      fatal_error("RESTORE illegal in > V4");
 						}
                         break;
                     case RESTART:
+                        restart_game();
                         break;
                     case RET_POPPED:
                         return_zroutine(stack_pop());
@@ -342,10 +472,11 @@ int zerp_run() {
 						}
                         break;
                     case QUIT:
-                        running = FALSE;
+                        state = ZRUN_QUIT;
                         break;
                     case NEW_LINE:
                         glk_put_string("\n");
+                        stat_print(1);
                         break;
                     case SHOW_STATUS:
 						if (zGameVersion < Z_VERSION_4) {
@@ -385,15 +516,15 @@ int zerp_run() {
 						/* TODO: Timed input */
 						if (zGameVersion <= Z_VERSION_4) {
 							show_status_line();
-	                        read(get_operand(0), get_operand(1));
-						} else if (zGameVersion == Z_VERSION_4) {
-	                        read(get_operand(0), get_operand(1));
+	                        read_line_request(get_operand(0), get_operand(1), FALSE, 0);
 						} else {
-							store_op(read(get_operand(0), get_operand(1)))
+							read_line_request(get_operand(0), get_operand(1), TRUE, store_operand);
 						}
+						state = ZRUN_INPUT;
                         break;
                     case PRINT_CHAR:
                         glk_put_char(get_operand(0));
+                        stat_print(1);
                         break;
                     case PRINT_NUM:
                         glk_printf("%d", (signed short)get_operand(0));
@@ -401,13 +532,13 @@ int zerp_run() {
                     case RANDOM:
 						scratch1 = (signed short) get_operand(0);
                         if (scratch1 < (zword_t) 0) {
-                            srandom((unsigned short)scratch1);
+                            seed_random((unsigned short)scratch1);
                             variable_set(store_operand, 0);
                         } else if (scratch1 == 0) {
-                            srandom(time(0));
+                            seed_random(time(0));
                             variable_set(store_operand, 0);
 						} else {
-							scratch2 = (random() % scratch1) + 1;
+							scratch2 = (next_random() % scratch1) + 1;
                             variable_set(store_operand, scratch2);
                         }
                         break;
@@ -421,12 +552,13 @@ int zerp_run() {
                     case SPLIT_WINDOW:
 						// glk_printf("SPLIT_WINDOW %d", get_operand(0));
 						if (scratch1 = get_operand(0)) {
-							upperwin = glk_window_open(mainwin, winmethod_Above | winmethod_Fixed, scratch1, wintype_TextGrid, 0);
+							upperwin = glk_window_open(mainwin, winmethod_Above | winmethod_Fixed, scratch1, wintype_TextGrid, UPPERWIN_ROCK);
 							set_screen_width(upperwin);
 						} else {
 							glk_window_close(upperwin, 0);
 							upperwin = 0;
 						}
+						stat_glk();
 						break;
                     case SET_WINDOW:
 						// glk_printf("SET_WINDOW %d", get_operand(0));
@@ -438,6 +570,7 @@ int zerp_run() {
 								set_screen_width(upperwin);
 							}
 						}
+						stat_glk();
 						break;
 					case CALL_VS2:
 						call_zroutine(unpack(get_operand(0)), &operands[1], store_operand, TRUE);
@@ -454,6 +587,7 @@ int zerp_run() {
 							case -1:
 								if (upperwin)
 									glk_window_close(upperwin, 0);
+								upperwin = 0;
 								glk_window_clear(mainwin);
 								break;
 							case -2:
@@ -462,6 +596,7 @@ int zerp_run() {
 								glk_window_clear(mainwin);
 								break;
 						}
+						stat_glk();
 						break;
 					case ERASE_LINE:
 						break;
@@ -469,10 +604,12 @@ int zerp_run() {
 						// glk_printf("SET_CURSOR %d %d", get_operand(1) - 1, get_operand(0) - 1);
 						if (upperwin)
 							glk_window_move_cursor(upperwin, get_operand(1) - 1, get_operand(0) - 1);
+						stat_glk();
 						break;
 					case GET_CURSOR:
 					case SET_TEXT_STYLE:
 						scratch1 = get_operand(0);
+						stat_glk();
 						if (!scratch1) {
 							glk_set_style(style_Normal);
 							break;
@@ -495,7 +632,8 @@ int zerp_run() {
                         break;
 					case READ_CHAR:
 						/* TODO: Timed input */
-						store_op(read_char(1))
+						read_char_request(get_operand(0), store_operand);
+						state = ZRUN_INPUT;
 						break;
 					case SCAN_TABLE:
 						if (operands[3].type == NONE) {
@@ -523,7 +661,7 @@ int zerp_run() {
 						unimplemented("ENCODE_TEXT")
 						break;
 					case COPY_TABLE:
-						unimplemented("COPY_TABLE")
+						copy_table(get_operand(0), get_operand(1), get_operand(2));
 						break;
 					case PRINT_TABLE:
 						unimplemented("PRINT_TABLE")
@@ -543,10 +681,20 @@ int zerp_run() {
 			case COUNT_EXT:
 				switch (instruction.opcode) {
 					case SAVE_TABLE:
-						unimplemented("SAVE_TABLE");
+						if (operands[0].type != NONE) {
+							store_op(save_table(get_operand(0), get_operand(1)) ? 1 : 0)
+						} else {
+							store_op(save_game(zPC - 1) ? 1 : 0)
+						}
 						break;
 					case RESTORE_TABLE:
-						unimplemented("RESTORE_TABLE");
+						if (operands[0].type != NONE) {
+							store_op(restore_table(get_operand(0), get_operand(1)))
+						} else if (restore_saved_game(&store_operand, &branch_operand)) {
+							store_op(2)
+						} else {
+							store_op(0)
+						}
 						break;
 					case LOG_SHIFT:
 						scratch1 = get_operand(0);
@@ -566,9 +714,18 @@ int zerp_run() {
 							store_op(scratch1 << scratch2)
 						}
 						break;
-					case SET_FONT:
 					case SAVE_UNDO:
+						store_op(undo_save(store_operand) ? 1 : 0)
+						break;
 					case RESTORE_UNDO:
+						/* on success we carry on after the SAVE_UNDO, which now returns 2 */
+						if (undo_restore(&undo_store)) {
+							variable_set(undo_store, 2);
+						} else {
+							store_op(0)
+						}
+						break;
+					case SET_FONT:
 					case PRINT_UNICODE:
 					case CHECK_UNICODE:
 						break;
@@ -578,19 +735,23 @@ int zerp_run() {
                 LOG(ZERROR, "Unknown opcode: %#04x", instruction.bytes);
                 fatal_error("bad opcode");
         }
+        trace_end(instruction.store_flag && state == ZRUN_RUNNING, store_operand)
     }
-    
-    /* Done, so clean up */
-    free(zStack);
-    free(zCallStack);
+
+    zFatalActive = FALSE;
+    zExecuting = FALSE;
+    stats_turn_end();
+    latency_turn_end();
+    return state;
 }
 
 static int test_je(zword_t value, zoperand_t *operands) {
     int result = FALSE;
     
-    while (!result && operands->type != NONE) {
-        result = (get_operand_ptr(operands) == value);
-        operands++;        
+    /* every operand is taken, even after a match, as any of them may pop the stack */
+    for (; operands->type != NONE; operands++) {
+        if (get_operand_ptr(operands) == value)
+            result = TRUE;
     }
         
     return result;
@@ -619,6 +780,79 @@ static zword_t scan_table(zword_t item, zword_t table, zword_t length, zbyte_t f
 	return address;
 }
 
+/*
+    copy_table: with second 0, zero size bytes of first. Otherwise copy
+    size bytes from first to second, as memmove() would; a negative size
+    copies |size| bytes forwards even if the tables overlap. Every byte
+    goes through store_byte(), so globals, dirty pages and undo see it.
+*/
+static void copy_table(zword_t first, zword_t second, zword_t size) {
+	int length, i;
+
+	length = (signed short) size;
+	if (!second) {
+		for (i = 0; i < abs(length); i++)
+			store_byte(first + i, 0);
+	} else if (length < 0 || first > second) {
+		for (i = 0; i < abs(length); i++)
+			store_byte(second + i, get_byte(first + i));
+	} else {
+		for (i = length - 1; i >= 0; i--)
+			store_byte(second + i, get_byte(first + i));
+	}
+}
+
+
+/*
+    RESTART: copy back the pages the game has written and start again.
+    The transcript and fixed pitch bits of Flags 2 survive, as the
+    standard requires; the rest of the header is set up afresh.
+*/
+static void restart_game() {
+    zword_t flags;
+
+    flags = get_word(FLAGS_2) & 0x3;
+    arena_restore(zArena);
+    zerp_start();
+    store_word(FLAGS_2, (get_word(FLAGS_2) & ~0x3) | flags);
+    reset_windows();
+}
+
+/*
+    RESTORE from a file the player picks. On success the machine is the
+    saved one, with zPC past the SAVE's branch or store byte, which is
+    decoded into branch or store. As with RESTART, the transcript and
+    fixed pitch bits survive, and the header is ours again.
+*/
+static int restore_saved_game(zword_t *store, zbranch_t *branch) {
+    packed_addr_t pc;
+    zword_t flags;
+
+    flags = get_word(FLAGS_2) & 0x3;
+    if (!restore_game(&pc))
+        return FALSE;
+    zPC = pc + decode_save_result(pc, store, branch);
+    store_word(FLAGS_2, (get_word(FLAGS_2) & ~0x3) | flags);
+    set_header_flags();
+    return TRUE;
+}
+
+/*
+    RANDOM has its own generator (xorshift) rather than random(), so the
+    sequence belongs to the game: sessions don't disturb each other, and
+    the state can be saved with the rest of the machine. Every game starts
+    from the same fixed seed until it asks for another.
+*/
+static void seed_random(unsigned int seed) {
+    zRandomState = seed ? seed : 1;
+}
+
+static unsigned int next_random() {
+    zRandomState ^= zRandomState << 13;
+    zRandomState ^= zRandomState >> 17;
+    zRandomState ^= zRandomState << 5;
+    return zRandomState;
+}
 
 static void set_header_flags() {
     store_byte(TERP_NUMBER, 3);
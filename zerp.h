@@ -24,8 +24,11 @@
 #define ZDEBUG          3
 #define ZCRAZY          4
 
-#define DEBUG           1
-
+/*
+    LOG() is compiled in only when built with -DDEBUG=level, and then
+    writes text to stderr. For a record of what a game did that costs
+    nothing when off, build with -DZTRACE (see trace.h).
+*/
 #ifdef DEBUG
 #define LOG(level, fmt, ...) \
     if (DEBUG >= level) { \
@@ -34,7 +37,7 @@
 		fprintf(stderr, "%5x %s\n", instructionPC, dbuff + 1); \
 	}
 #else
-#define LOG(level, fmt, ...)
+#define LOG(level, fmt, ...) if (0) {}
 #endif
 
 
@@ -46,7 +49,7 @@ typedef unsigned char zbyte_t;
 typedef unsigned int packed_addr_t;
 
 #define get_byte(offset) *(zMachine + offset)
-#define store_byte(offset, value) get_byte(offset) = (zbyte_t) value;
+#define store_byte(offset, value) store_zbyte((offset), (zbyte_t) (value));
 #define get_word(addr) ((zword_t) (get_byte(addr) << 8 | get_byte(addr + 1)))
 #define store_word(offset, value) store_byte(offset, (zbyte_t)(value >> 8)); store_byte(offset + 1, (zbyte_t)(value & 0xff));
 #define get_word_addr(addr) get_word(addr) >> 1
@@ -55,15 +58,48 @@ typedef unsigned int packed_addr_t;
 #define store_packed_addr(addr) store_word(addr >> 1)
 #define unpack(addr) addr << zPackedShift
 
+/*
+    A routine's frame. Its locals live on the value stack, just above sp
+    (the caller's top of stack when it was called), and its own stack
+    starts above them. The outermost frame has no locals and sp = zStack.
+    routine is the address called (the outermost frame's is where the
+    game started; 0 if not known, as for frames read from a save file),
+    and entry belongs to the profiler (profile.c).
+*/
 typedef struct zstack_frame {
     packed_addr_t pc;
+    packed_addr_t routine;
     zword_t *sp;
     zbyte_t ret_store;
 	zbyte_t ret_keep;
-    zword_t locals[16];
 	zbyte_t args;
+	zbyte_t local_count;
+	unsigned int entry;
 } zstack_frame_t;
 
+#define frame_locals(frame) ((frame)->sp + 1)
+#define frame_bottom(frame) ((frame)->sp + (frame)->local_count + 1)
+
+/* A read the game is waiting on. The interpreter stops until input arrives. */
+typedef struct zinput {
+    zbyte_t type;
+    zbyte_t store_flag;
+    zbyte_t store;
+    zword_t text;
+    zword_t parse;
+    char buffer[257];
+} zinput_t;
+
+#define INPUT_NONE          0
+#define INPUT_LINE          1
+#define INPUT_CHAR          2
+
+/* zerp_execute() results */
+#define ZRUN_RUNNING        0
+#define ZRUN_INPUT          1
+#define ZRUN_QUIT           2
+#define ZRUN_ERROR          3
+
 /* game file */
 extern frefid_t zGamefileRef;
 extern int zFilesize;
@@ -82,10 +118,12 @@ extern zstack_frame_t * zCallStack;
 extern zstack_frame_t * zFP;
 extern zstack_frame_t * zCallStackTop;
 
-#define STACKSIZE 8192
-#define CALLSTACKSIZE 512
+/* reserved, not allocated: pages are committed as the stacks reach them (see arena.h) */
+#define STACKSIZE (1 << 20)
+#define CALLSTACKSIZE (1 << 16)
 
 extern zword_t zGlobals;
+extern zword_t zGlobalValues[240];
 extern zword_t zProperties;
 extern zword_t zObjects;
 extern zword_t zDictionaryHeader;
@@ -94,9 +132,67 @@ extern zword_t zDictionary;
 extern packed_addr_t zPC;
 extern packed_addr_t instructionPC;
 
+extern zinput_t *zInput;
+extern unsigned int zRandomState;
+
+/*
+    Every write to game memory stamps the page it lands in with zDirtyStamp,
+    so RESTART, undo and saves can find what changed since a given point
+    (see arena.c). A stamp of 0 means unchanged since the game started.
+    The first write to a page after each checkpoint goes through
+    page_touched(), which is where undo keeps the page's old contents.
+*/
+#define ZPAGE_SHIFT         8
+#define ZPAGE_SIZE          (1 << ZPAGE_SHIFT)
+#define ZPAGES              (0x10000 >> ZPAGE_SHIFT)
+
+extern unsigned int *zPageStamp;
+extern unsigned int zDirtyStamp;
+
+/*
+    Writes also keep *zMemoryHash, the current arena's hash of memory: the
+    XOR over every address of zobrist(address, byte), so changing a byte
+    takes out the old one's key and puts in the new one's (see hash.c).
+*/
+extern unsigned long long *zMemoryHash;
+
+void page_touched(int page);
+
+static inline unsigned long long zobrist(zword_t offset, zbyte_t value) {
+    unsigned long long key;
+
+    key = ((unsigned long long) offset << 8 | value) + 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+/*
+    A write landing in the globals table also goes to zGlobalValues, the
+    native copy the variable opcodes read (see variables.c).
+*/
+static inline void store_zbyte(zword_t offset, zbyte_t value) {
+    zword_t global;
+
+    if (zPageStamp[offset >> ZPAGE_SHIFT] != zDirtyStamp)
+        page_touched(offset >> ZPAGE_SHIFT);
+    if (zMachine[offset] != value)
+        *zMemoryHash ^= zobrist(offset, zMachine[offset]) ^ zobrist(offset, value);
+    zMachine[offset] = value;
+
+    global = offset - zGlobals;
+    if (global < 480) {
+        if (global & 1)
+            zGlobalValues[global >> 1] = (zGlobalValues[global >> 1] & 0xff00) | value;
+        else
+            zGlobalValues[global >> 1] = (zGlobalValues[global >> 1] & 0x00ff) | value << 8;
+    }
+}
+
 /* header offsets */
 #define Z_VERSION           0x00
 #define FLAGS_1             0x01
+#define RELEASE             0x02
 #define HIGH_MEM            0x04
 #define PC_INITIAL          0x06
 #define DICTIONARY          0x08
@@ -104,6 +200,7 @@ extern packed_addr_t instructionPC;
 #define GLOBALS             0x0c
 #define STATIC_MEM          0x0e
 #define FLAGS_2             0x10
+#define SERIAL              0x12
 #define ABBRV               0x18
 #define FILE_SIZE           0x1a
 #define CHECKSUM            0x1c
@@ -138,7 +235,14 @@ extern packed_addr_t instructionPC;
 
 /* function declarations */
 int zerp_run();
+int zerp_start();
+void zerp_stop();
+int zerp_execute();
+void zerp_abort();
 void show_status_line();
+int load_gamefile(frefid_t ref);
+void open_windows();
+void reset_windows();
 void fatal_error(char *message);
 int glk_printf(char *format, ...);
 void set_screen_width(winid_t win);
@@ -146,13 +250,17 @@ static void set_header_flags();
 static zword_t scan_table(zword_t item, zword_t table, zword_t length, zbyte_t form);
 
 /* The story, upper and status windows. */
+#define MAINWIN_ROCK        1
+#define STATUSWIN_ROCK      2
+#define UPPERWIN_ROCK       3
+
 extern winid_t mainwin;
 extern winid_t statuswin;
 extern winid_t upperwin;
 
 /* Some large macros to keep opcode stuff in line in the main loop */
-#define get_operand(opnum) (operands[opnum].type == VARIABLE ? variable_get(operands[opnum].bytes) : operands[opnum].bytes)
-#define get_operand_ptr(op_ptr) (op_ptr->type == VARIABLE ? variable_get(op_ptr->bytes) : op_ptr->bytes)
+#define get_operand(opnum) operand_value(&operands[opnum])
+#define get_operand_ptr(op_ptr) operand_value(op_ptr)
 
 #define branch_op(branch_test) if ((branch_test) ^ !(branch_operand.test)) { \
     if (branch_operand.offset == 0 || branch_operand.offset == 1) { \
@@ -162,7 +270,7 @@ extern winid_t upperwin;
     } \
 } 
 
-#define store_op(store_exp) variable_set(store_operand, store_exp);
+#define store_op(store_exp) variable_store(store_operand, store_exp);
 
 #define unimplemented(opcode) LOG(ZERROR, "Unimplemented opcode:%s", opcode); fatal_error("UNIMPLEMENTED");
 #endif /* ZERP_H */
\ No newline at end of file
@@ -11,6 +11,9 @@
 #endif /* TARGET_OS_MAC */
 #include "zerp.h"
 #include "zscii.h"
+#include "story.h"
+#include "json.h"
+#include "stats.h"
 
 int print_zstring(packed_addr_t address) {
     int words = 0, alpha = 0, zscii = 0, zsciichar = 0, bitshift, abbrv_index;
@@ -27,17 +30,25 @@ int print_zstring(packed_addr_t address) {
                 zscii++;
                 if (zscii++ > 2) {
                     glk_put_char((unsigned char)zsciichar);                    
+                    stat_print(1);
                     zsciichar = 0; zscii = 0; alpha = 0;
                 }
             } else if (abbriv) {
                 abbrv_index = (32 * (abbriv - 1) + zchar);
-                print_zstring(get_word(get_word(ABBRV) + (abbrv_index * 2)) * 2);
+                /* decoded once by story_share(), if the story has been shared */
+                if (zAbbreviation[abbrv_index]) {
+                    glk_put_buffer(zAbbreviation[abbrv_index], zAbbreviationLength[abbrv_index]);
+                    stat_print(zAbbreviationLength[abbrv_index]);
+                } else {
+                    print_zstring(get_word(get_word(ABBRV) + (abbrv_index * 2)) * 2);
+                }
                 abbriv = 0;
             } else {
                 switch (zchar) {
                     case 0:
                         alpha = 0;
                         glk_put_char(' ');
+                        stat_print(1);
                         break;
                     case 1:
                     case 2:
@@ -55,6 +66,7 @@ int print_zstring(packed_addr_t address) {
                         }
                     default:
                         glk_put_char(zAlphabet[alpha][zchar]);
+                        stat_print(1);
                         alpha = 0;
                     
                 }   